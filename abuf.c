@@ -6,11 +6,87 @@
 #include "core.h"
 
 
+/*
+ * An abuf's storage on the heap starts with room for prepending: front
+ * bytes of it, then a word holding front, then the cap bytes b points
+ * at. A prepend takes bytes from the back of that room, so it costs
+ * only what is prepended; when the room runs out it is made as big as
+ * the buffer, so a run of prepends copies the buffer only each time it
+ * doubles, rather than moving all of it for every byte.
+ */
+#define AB_HEAD		sizeof(size_t)
+
+
+/* ab_inline reports whether buf is still in the storage behind it. */
+static int
+ab_inline(const abuf *buf)
+{
+	return buf->cap != 0 && buf->b == (const char *)(buf + 1);
+}
+
+
+static int
+ab_heap(const abuf *buf)
+{
+	return buf->cap != 0 && !ab_inline(buf);
+}
+
+
+static size_t
+ab_front(const abuf *buf)
+{
+	size_t	 front = 0;
+
+	if (ab_heap(buf)) {
+		memcpy(&front, buf->b - AB_HEAD, sizeof(front));
+	}
+
+	return front;
+}
+
+
+static void
+ab_set_front(abuf *buf, const size_t front)
+{
+	memcpy(buf->b - AB_HEAD, &front, sizeof(front));
+}
+
+
+/*
+ * ab_make_room moves buf to new heap storage with len bytes of room in
+ * front and as many again as it holds.
+ */
+static void
+ab_make_room(abuf *buf, const size_t len)
+{
+	char	*base  = NULL;
+	size_t	 size  = buf->size;
+	size_t	 front = len + size;
+	size_t	 cap   = size + 1;
+
+	if (ab_heap(buf) && buf->cap > cap) {
+		cap = buf->cap;
+	}
+
+	base = malloc(front + AB_HEAD + cap);
+	assert(base != NULL);
+	if (size > 0) {
+		memcpy(base + front + AB_HEAD, buf->b, size);
+	}
+
+	ab_free(buf);
+	buf->b    = base + front + AB_HEAD;
+	buf->size = size;
+	buf->cap  = cap;
+	ab_set_front(buf, front);
+}
+
+
 static void
 abuf_grow(abuf *buf, size_t delta)
 {
-	if (buf->cap - buf->size < delta) {
-		ab_resize(buf, buf->cap + delta);
+	if (ab_borrowed(buf) || buf->cap - buf->size < delta) {
+		ab_resize(buf, buf->size + delta);
 	}
 }
 
@@ -36,16 +112,41 @@ ab_init_cap(abuf *buf, const size_t cap)
 }
 
 
+/*
+ * ab_init_inline sets up buf to use the n bytes that follow it, as the
+ * store of an ABUF_INLINE(n) does.
+ */
+void
+ab_init_inline(abuf *buf, const size_t n)
+{
+	assert(buf != NULL && n > 0);
+
+	buf->b    = (char *)(buf + 1);
+	buf->size = 0;
+	buf->cap  = n;
+}
+
+
 void
 ab_resize(abuf *buf, size_t cap)
 {
-	char	*newbuf = NULL;
+	char	*base  = NULL;
+	size_t	 front = ab_front(buf);
 
 	cap = cap_growth(buf->cap, cap) + 1;
-	newbuf = realloc(buf->b, cap);
-	assert(newbuf != NULL);
+	if (ab_heap(buf)) {
+		base = realloc(buf->b - AB_HEAD - front, front + AB_HEAD + cap);
+		assert(base != NULL);
+	} else {
+		base = malloc(AB_HEAD + cap);
+		assert(base != NULL);
+		if (buf->size > 0) {
+			memcpy(base + AB_HEAD, buf->b, buf->size);
+		}
+	}
 	buf->cap = cap;
-	buf->b   = newbuf;
+	buf->b   = base + front + AB_HEAD;
+	ab_set_front(buf, front);
 }
 
 
@@ -74,8 +175,6 @@ ab_append(abuf *buf, const char *s, size_t len)
 void
 ab_prependch(abuf *buf, const char c)
 {
-	abuf_grow(buf, 1);
-
 	ab_prepend(buf, &c, 1);
 }
 
@@ -83,24 +182,75 @@ ab_prependch(abuf *buf, const char c)
 void
 ab_prepend(abuf *buf, const char *s, const size_t len)
 {
-	char	*nc = NULL;
+	size_t	 front = 0;
 
-	abuf_grow(buf, len);
-	nc = buf->b;
-	assert(nc != NULL);
+	if (len == 0) {
+		return;
+	}
 
-	memmove(nc + len, nc, buf->size);
-	memcpy(nc, s, len);
+	/* inline storage has no room in front, but is small to move */
+	if (ab_inline(buf) && buf->cap - buf->size > len) {
+		memmove(buf->b + len, buf->b, buf->size);
+		memcpy(buf->b, s, len);
+		buf->size += len;
+		return;
+	}
 
-	buf->b = nc;
+	front = ab_front(buf);
+	if (front < len) {
+		ab_make_room(buf, len);
+		front = ab_front(buf);
+	}
+
+	buf->b   -= len;
+	buf->cap += len;
+	ab_set_front(buf, front - len);
+	memcpy(buf->b, s, len);
 	buf->size += len;
 }
 
 
+void
+ab_borrow(abuf *buf, const char *s, const size_t len)
+{
+	assert(buf != NULL);
+
+	buf->b    = (char *)s;
+	buf->size = len;
+	buf->cap  = 0;
+}
+
+
+int
+ab_borrowed(const abuf *buf)
+{
+	return buf->b != NULL && buf->cap == 0;
+}
+
+
+/*
+ * ab_own copies a borrowed buffer into storage it owns so that it
+ * can be modified in place; the copy is NUL-terminated like rows.
+ */
+void
+ab_own(abuf *buf)
+{
+	if (!ab_borrowed(buf)) {
+		return;
+	}
+
+	ab_resize(buf, buf->size + 1);
+	buf->b[buf->size] = '\0';
+}
+
+
 void
 ab_free(abuf *buf)
 {
-	free(buf->b);
+	if (ab_heap(buf)) {
+		free(buf->b - AB_HEAD - ab_front(buf));
+	}
+
 	buf->b    = NULL;
 	buf->size = 0;
 	buf->cap  = 0;
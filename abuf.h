@@ -17,13 +17,30 @@ typedef struct abuf {
 #define ABUF_INIT {NULL, 0, 0}
 
 
+/*
+ * A borrowed abuf points at memory it doesn't own (e.g. a mapped
+ * file); it has a zero capacity and is copied into its own storage
+ * the first time it is modified.
+ *
+ * An abuf can also start out with storage of its own right behind it,
+ * declared with ABUF_INLINE and set up with ab_init_inline, and only
+ * go to the heap once it outgrows that. Such an abuf can't be copied
+ * or moved away from its storage, so rows never use one.
+ */
+#define ABUF_INLINE(n)	struct { abuf ab; char store[(n)]; }
+
+
 void		 ab_init(abuf *buf);
 void		 ab_init_cap(abuf *buf, size_t cap);
+void		 ab_init_inline(abuf *buf, size_t n);
 void		 ab_resize(abuf *buf, size_t cap);
 void		 ab_appendch(abuf *buf, char c);
 void		 ab_append(abuf *buf, const char *s, size_t len);
 void		 ab_prependch(abuf *buf, const char c);
 void		 ab_prepend(abuf *buf, const char *s, const size_t len);
+void		 ab_borrow(abuf *buf, const char *s, size_t len);
+int		 ab_borrowed(const abuf *buf);
+void		 ab_own(abuf *buf);
 void		 ab_free(abuf *buf);
 
 
@@ -0,0 +1,204 @@
+/*
+ * bench.c - timing, test files and counters for the benchmarks
+ *
+ * Cache misses come from the CPU's performance counters through
+ * perf_event_open(2), on Linux, when the machine has them; virtual
+ * machines often don't, and then they are reported as n/a. Page faults
+ * are counted by the kernel and are nearly always there.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "bench.h"
+
+
+#define	BENCH_CHUNK	(1024 * 1024)	/* bytes written at a time */
+
+
+static int	 counters[3] = { -1, -1, -1 };
+
+
+/* buffer.c asks for buffer names through the prompt; nothing does here. */
+char *
+editor_prompt(const char *fmt, void (*cb)(char *, int16_t))
+{
+	(void)fmt;
+	(void)cb;
+	return NULL;
+}
+
+
+double
+bench_ms(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+
+/*
+ * bench_file makes path a file of size bytes of text, unless it is one
+ * already. Lines are words of lower-case letters, 0 to 120 bytes long
+ * and 60 on average, ending in CRLF if crlf is set. The text is the
+ * same every time.
+ */
+int
+bench_file(const char *path, const size_t size, const int crlf)
+{
+	struct stat	 st;
+	uint32_t	 seed = 1;
+	char		*buf  = NULL;
+	size_t		 done = 0;
+	size_t		 n    = 0;
+	size_t		 len  = 0;
+	size_t		 want = 0;
+	int		 fd   = -1;
+
+	if (stat(path, &st) == 0 && (size_t)st.st_size == size) {
+		return 0;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return -1;
+	}
+
+	buf = malloc(BENCH_CHUNK + 256);
+	if (buf == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	while (done < size) {
+		n = 0;
+		while (n < BENCH_CHUNK) {
+			seed = seed * 1103515245 + 12345;
+			want = (seed >> 16) % 121;
+			for (len = 0; len < want; len++) {
+				seed = seed * 1103515245 + 12345;
+				buf[n++] = (seed >> 16) % 6 == 0 ? ' ' :
+				    (char)('a' + (seed >> 16) % 26);
+			}
+			if (crlf) {
+				buf[n++] = '\r';
+			}
+			buf[n++] = '\n';
+		}
+
+		if (n > size - done) {
+			n = size - done;
+		}
+		if (write(fd, buf, n) != (ssize_t)n) {
+			free(buf);
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+
+	free(buf);
+	return close(fd);
+}
+
+
+#ifdef __linux__
+
+static int
+counter_open(const uint32_t type, const uint64_t config)
+{
+	struct perf_event_attr	 attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type           = type;
+	attr.size           = sizeof(attr);
+	attr.config         = config;
+	attr.disabled       = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+static int64_t
+counter_read(const int fd)
+{
+	int64_t	 n = 0;
+
+	if (fd == -1) {
+		return -1;
+	}
+
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &n, sizeof(n)) != sizeof(n)) {
+		return -1;
+	}
+
+	return n;
+}
+
+#endif
+
+
+/* bench_counters_start zeroes and starts the counters there are. */
+void
+bench_counters_start(void)
+{
+#ifdef __linux__
+	size_t	 i = 0;
+
+	if (counters[2] == -1) {
+		counters[0] = counter_open(PERF_TYPE_HARDWARE,
+		    PERF_COUNT_HW_CACHE_MISSES);
+		counters[1] = counter_open(PERF_TYPE_HARDWARE,
+		    PERF_COUNT_HW_CACHE_REFERENCES);
+		counters[2] = counter_open(PERF_TYPE_SOFTWARE,
+		    PERF_COUNT_SW_PAGE_FAULTS);
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (counters[i] != -1) {
+			ioctl(counters[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+
+void
+bench_counters_stop(bench_counts *c)
+{
+	c->misses = c->refs = c->faults = -1;
+#ifdef __linux__
+	c->misses = counter_read(counters[0]);
+	c->refs   = counter_read(counters[1]);
+	c->faults = counter_read(counters[2]);
+#endif
+}
+
+
+/* bench_counter prints a count in a column of its own, or n/a. */
+void
+bench_counter(const char *name, const int64_t n)
+{
+	if (n < 0) {
+		printf("  %s %10s", name, "n/a");
+	} else {
+		printf("  %s %10lld", name, (long long)n);
+	}
+}
@@ -0,0 +1,26 @@
+/*
+ * bench.h - what the benchmarks share
+ */
+#ifndef KE_BENCH_H
+#define KE_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* counters read around a stretch of work; -1 if the machine has none */
+typedef struct bench_counts {
+	int64_t	 misses;	/* last-level cache misses */
+	int64_t	 refs;		/* last-level cache references */
+	int64_t	 faults;	/* page faults */
+} bench_counts;
+
+
+double		 bench_ms(void);
+int		 bench_file(const char *path, size_t size, int crlf);
+void		 bench_counters_start(void);
+void		 bench_counters_stop(bench_counts *c);
+void		 bench_counter(const char *name, int64_t n);
+
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * grow.c - appending to an abuf until it is gigabytes long
+ *
+ * usage: grow [gigabytes]
+ *
+ * First the capacities cap_growth goes through on the way to each
+ * eighth of the size asked for (8 GB if none is given) are worked out,
+ * a megabyte appended at a time, next to doubling all the way. This
+ * needs no memory. It shows how many times each grows, how much room
+ * is left over, and the last step: the old and new capacity together,
+ * which is what a realloc that has to move the buffer needs.
+ *
+ * Then an abuf is really appended to, as far as half the machine's
+ * memory allows, and so is a plain realloc'd buffer that doubles. For
+ * each, the time taken, the number of times it grew and the slowest
+ * single append, which is where a copy would show, are given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "bench.h"
+#include "core.h"
+
+
+#define	CHUNK	(1024 * 1024)	/* bytes appended at a time */
+#define	GB	(1024.0 * 1024 * 1024)
+
+
+typedef struct plan {
+	size_t	 grows;
+	size_t	 cap;		/* at the end */
+	size_t	 last;		/* old and new capacity at the last grow */
+} plan;
+
+
+static void
+schedule(const size_t target, const int doubling, plan *p)
+{
+	size_t	 size = 0;
+	size_t	 cap  = 0;
+	size_t	 next = 0;
+
+	memset(p, 0, sizeof(*p));
+	for (size = CHUNK; size <= target; size += CHUNK) {
+		if (size <= cap) {
+			continue;
+		}
+
+		next = doubling ? next_power_of_2(size) : cap_growth(cap, size);
+		p->grows++;
+		p->last = cap + next;
+		cap     = next;
+	}
+	p->cap = cap;
+}
+
+
+static void
+show_plan(const size_t target)
+{
+	plan	 g;
+	plan	 d;
+
+	schedule(target, 0, &g);
+	schedule(target, 1, &d);
+	printf("  %5.2f GB %6zu %8.2f GB %6.1f%% %8.2f GB"
+	    "   %6zu %8.2f GB %6.1f%% %8.2f GB\n", (double)target / GB,
+	    g.grows, (double)g.cap / GB,
+	    100.0 * (double)(g.cap - target) / (double)target,
+	    (double)g.last / GB, d.grows, (double)d.cap / GB,
+	    100.0 * (double)(d.cap - target) / (double)target,
+	    (double)d.last / GB);
+}
+
+
+typedef struct result {
+	size_t	 size;
+	size_t	 grows;
+	double	 ms;
+	double	 worst;		/* the slowest append */
+} result;
+
+
+/* keep holds on to the faster of two runs. */
+static void
+keep(result *best, const result *r)
+{
+	if (best->ms == 0 || r->ms < best->ms) {
+		*best = *r;
+	}
+}
+
+
+static void
+show_run(const char *name, const result *r)
+{
+	printf("  %-10s %5.2f GB %9.1f ms %6.0f ms/GB %4zu grows"
+	    "   slowest append %6.2f ms\n", name, (double)r->size / GB,
+	    r->ms, r->ms / ((double)r->size / GB), r->grows, r->worst);
+}
+
+
+static void
+append_abuf(const char *chunk, const size_t target, result *r)
+{
+	abuf	 ab;
+	size_t	 cap   = 0;
+	double	 start = 0;
+	double	 t     = 0;
+
+	memset(r, 0, sizeof(*r));
+	ab_init(&ab);
+	start = bench_ms();
+	while (ab.size + CHUNK <= target) {
+		t = bench_ms();
+		ab_append(&ab, chunk, CHUNK);
+		t = bench_ms() - t;
+		if (t > r->worst) {
+			r->worst = t;
+		}
+		if (ab.cap != cap) {
+			cap = ab.cap;
+			r->grows++;
+		}
+	}
+
+	r->ms   = bench_ms() - start;
+	r->size = ab.size;
+	ab_free(&ab);
+}
+
+
+static void
+append_doubling(const char *chunk, const size_t target, result *r)
+{
+	char	*buf   = NULL;
+	char	*p     = NULL;
+	size_t	 size  = 0;
+	size_t	 cap   = 0;
+	double	 start = 0;
+	double	 t     = 0;
+
+	memset(r, 0, sizeof(*r));
+	start = bench_ms();
+	while (size + CHUNK <= target) {
+		t = bench_ms();
+		if (size + CHUNK > cap) {
+			cap = next_power_of_2(size + CHUNK);
+			p   = realloc(buf, cap);
+			if (p == NULL) {
+				printf("  doubling: no %zu bytes\n", cap);
+				break;
+			}
+			buf = p;
+			r->grows++;
+		}
+		memcpy(buf + size, chunk, CHUNK);
+		size += CHUNK;
+		t = bench_ms() - t;
+		if (t > r->worst) {
+			r->worst = t;
+		}
+	}
+
+	r->ms   = bench_ms() - start;
+	r->size = size;
+	free(buf);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char	*chunk  = NULL;
+	double	 gb     = 8;
+	size_t	 target = 0;
+	size_t	 mem    = 0;
+	size_t	 step   = 0;
+	result	 best[2];
+	result	 r;
+	int	 i      = 0;
+
+	if (argc > 1) {
+		gb = strtod(argv[1], NULL);
+	}
+	target = (size_t)(gb * GB);
+
+	printf("capacities, %d KB appended at a time\n", CHUNK / 1024);
+	printf("%29s%41s\n", "cap_growth", "doubling");
+	printf("      size  grows         cap   spare   last step"
+	    "    grows         cap   spare   last step\n");
+	for (step = target / 8; step <= target; step += target / 8) {
+		show_plan(step);
+	}
+
+	mem = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE);
+	if (target > mem / 2) {
+		target = mem / 2;
+		printf("appending %.2f GB, half of this machine's memory, "
+		    "best of two\n", (double)target / GB);
+	} else {
+		printf("appending %.2f GB, best of two\n",
+		    (double)target / GB);
+	}
+
+	chunk = malloc(CHUNK);
+	memset(chunk, 'x', CHUNK);
+	memset(best, 0, sizeof(best));
+	for (i = 0; i < 2; i++) {
+		append_abuf(chunk, target, &r);
+		keep(&best[0], &r);
+		append_doubling(chunk, target, &r);
+		keep(&best[1], &r);
+	}
+	show_run("abuf", &best[0]);
+	show_run("doubling", &best[1]);
+
+	free(chunk);
+	return 0;
+}
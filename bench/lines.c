@@ -0,0 +1,259 @@
+/*
+ * lines.c - splitting a file into lines: getline(3) against scan_lines
+ *
+ * usage: lines [-c] [megabytes ...]
+ *
+ * For each size (100 and 1024 MB if none are given) a text file of
+ * that size is made under $TMPDIR, if it isn't there already, and
+ * split three ways:
+ *
+ *	getline		a line at a time through stdio, stripping the
+ *			CR/LF
+ *	getline+rows	the same, copying each line into a row of its
+ *			own, which is how files were loaded before
+ *	scan_lines	the mapped file, a batch of spans at a time
+ *	load		buffer_map_file and buffer_index_all, which is
+ *			the scan plus the rows borrowed from the mapping
+ *
+ * Each is run once to get the file into the page cache and then timed
+ * three times; the best time is shown. -c makes the lines end in CRLF.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "bench.h"
+#include "buffer.h"
+#include "scan.h"
+
+
+#define	RUNS	3
+#define	BATCH	4096		/* spans per scan_lines call */
+
+
+typedef struct result {
+	size_t	 lines;
+	size_t	 bytes;		/* of text, without line endings */
+} result;
+
+
+static int
+by_getline(const char *path, result *r)
+{
+	FILE	*f   = NULL;
+	char	*buf = NULL;
+	size_t	 cap = 0;
+	ssize_t	 len = 0;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+
+	while ((len = getline(&buf, &cap, f)) != -1) {
+		while (len > 0 && (buf[len - 1] == '\n' ||
+		    buf[len - 1] == '\r')) {
+			len--;
+		}
+		r->lines++;
+		r->bytes += (size_t)len;
+	}
+
+	free(buf);
+	fclose(f);
+	return 0;
+}
+
+
+/* by_rows reads lines as by_getline does and copies each into a row. */
+static int
+by_rows(const char *path, result *r)
+{
+	buffer	*b   = buffer_current();
+	FILE	*f   = NULL;
+	char	*buf = NULL;
+	abuf	 row;
+	size_t	 cap = 0;
+	ssize_t	 len = 0;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+
+	while ((len = getline(&buf, &cap, f)) != -1) {
+		while (len > 0 && (buf[len - 1] == '\n' ||
+		    buf[len - 1] == '\r')) {
+			len--;
+		}
+		ab_init(&row);
+		ab_append(&row, buf, (size_t)len);
+		buffer_insert_rows(b, b->nrows, &row, 1);
+		r->bytes += (size_t)len;
+	}
+	r->lines = b->nrows;
+
+	buffer_free_rows(b);
+	free(buf);
+	fclose(f);
+	return 0;
+}
+
+
+static int
+by_scan(const char *path, result *r)
+{
+	static line_span	 spans[BATCH];
+	char			*map  = NULL;
+	size_t			 size = 0;
+	size_t			 off  = 0;
+	size_t			 used = 0;
+	size_t			 n    = 0;
+	size_t			 i    = 0;
+	int			 fd   = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	size = (size_t)lseek(fd, 0, SEEK_END);
+	map  = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	while (off < size) {
+		n = scan_lines(map + off, size - off, 1, spans, BATCH, &used);
+		for (i = 0; i < n; i++) {
+			r->bytes += spans[i].len;
+		}
+		r->lines += n;
+		off += used;
+	}
+
+	munmap(map, size);
+	return 0;
+}
+
+
+static int
+by_load(const char *path, result *r)
+{
+	buffer	*b    = NULL;
+	abuf	*rows = NULL;
+	size_t	 size = 0;
+	size_t	 y    = 0;
+	size_t	 n    = 0;
+	size_t	 i    = 0;
+	int	 fd   = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	b    = buffer_current();
+	size = (size_t)lseek(fd, 0, SEEK_END);
+	if (buffer_map_file(b, fd, size) == -1) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	buffer_index_all(b);
+	r->lines = b->nrows;
+	r->bytes = 0;
+	for (y = 0; y < b->nrows; y += n) {
+		rows = buffer_rows_at(b, y, &n);
+		for (i = 0; i < n; i++) {
+			r->bytes += rows[i].size;
+		}
+	}
+
+	buffer_free_rows(b);
+	return 0;
+}
+
+
+static void
+run(const char *name, int (*split)(const char *, result *),
+    const char *path, const size_t size)
+{
+	result	 r;
+	double	 best = 0;
+	double	 ms   = 0;
+	int	 i    = 0;
+
+	for (i = 0; i <= RUNS; i++) {
+		memset(&r, 0, sizeof(r));
+		ms = bench_ms();
+		if (split(path, &r) == -1) {
+			perror(name);
+			exit(1);
+		}
+		ms = bench_ms() - ms;
+		if (i == 1 || (i > 1 && ms < best)) {
+			best = ms;
+		}
+	}
+
+	printf("  %-12s %9.1f ms %8.0f MB/s %10zu lines %12zu bytes\n", name,
+	    best, (double)size / (1024 * 1024) / (best / 1000), r.lines,
+	    r.bytes);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const char	*tmp     = getenv("TMPDIR");
+	char		*sizes[] = { "100", "1024" };
+	char		**list   = argv + 1;
+	char		 path[4096];
+	size_t		 size    = 0;
+	int		 n       = argc - 1;
+	int		 crlf    = 0;
+	int		 i       = 0;
+
+	if (n > 0 && strcmp(list[0], "-c") == 0) {
+		crlf = 1;
+		list++;
+		n--;
+	}
+
+	if (n == 0) {
+		list = sizes;
+		n    = 2;
+	}
+
+	if (tmp == NULL) {
+		tmp = "/tmp";
+	}
+
+	buffers_init();
+	for (i = 0; i < n; i++) {
+		size = (size_t)strtoul(list[i], NULL, 10);
+		snprintf(path, sizeof(path), "%s/ke-bench-%zu%s.txt", tmp,
+		    size, crlf ? "-crlf" : "");
+
+		size *= 1024 * 1024;
+		if (bench_file(path, size, crlf) == -1) {
+			perror(path);
+			return 1;
+		}
+
+		printf("%s, %zu MB\n", path, size / (1024 * 1024));
+		run("getline", by_getline, path, size);
+		run("getline+rows", by_rows, path, size);
+		run("scan_lines", by_scan, path, size);
+		run("load", by_load, path, size);
+	}
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * plain.c - columns of printable ASCII rows, and drawing them
+ *
+ * usage: plain [bytes ...]
+ *
+ * For rows of each length (80, 4096 and 1048576 bytes if none are
+ * given) of letters and spaces, this times:
+ *
+ *	classify	finding the end of the printable run: a byte at a
+ *			time, and with scan_plain
+ *	byte->col	the column of the row's last byte: walking it with
+ *			cols_step a character at a time, and cols_at on the
+ *			row as it is (plain) and with a tab in front (mixed)
+ *	col->byte	cols_seek to the row's last column, plain and mixed
+ *	edit+draw	a change to the row, then drawing its last screen
+ *			of 80 columns, plain and mixed
+ *
+ * Times are per row, the best of three runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abuf.h"
+#include "bench.h"
+#include "buffer.h"
+#include "cols.h"
+#include "render.h"
+#include "scan.h"
+
+
+#define	RUNS	3
+#define	WORK	(64UL * 1024 * 1024)	/* bytes gone over per run */
+#define	COLS	80
+
+
+enum {
+	PLAIN = 0,
+	MIXED = 1
+};
+
+
+static buffer		*buf;
+static const char	*text;		/* the plain row */
+static size_t		 len;
+static volatile size_t	 sink;
+
+
+static void
+classify_bytes(const size_t y)
+{
+	size_t	 i = 0;
+
+	(void)y;
+	while (i < len && (unsigned char)text[i] >= 0x20 &&
+	    (unsigned char)text[i] < 0x80) {
+		i++;
+	}
+	sink = i;
+}
+
+
+static void
+classify_scan(const size_t y)
+{
+	(void)y;
+	sink = scan_plain(text, len);
+}
+
+
+static void
+walk(const size_t y)
+{
+	cols_pos	 p;
+
+	(void)y;
+	memset(&p, 0, sizeof(p));
+	while (p.off < len - 1) {
+		cols_step(&p, text + p.off, len - p.off);
+	}
+	sink = p.col;
+}
+
+
+static void
+byte_col(const size_t y)
+{
+	sink = cols_at(buf, y, buffer_row(buf, y)->size - 1);
+}
+
+
+static void
+col_byte(const size_t y)
+{
+	cols_pos	 p;
+
+	cols_seek(buf, y, buffer_row(buf, y)->size - 1, &p);
+	sink = p.off;
+}
+
+
+static void
+edit_draw(const size_t y)
+{
+	ABUF_INLINE(COLS * 4)	 line;
+	size_t			 size = buffer_row(buf, y)->size;
+
+	/* a change the same length still makes the row new */
+	buffer_row_resized(buf, y, size);
+
+	ab_init_inline(&line.ab, sizeof(line.store));
+	render_frame(1);
+	render_row(&line.ab, buf, y, size > COLS ? size - COLS : 0, COLS);
+	sink = line.ab.size;
+	ab_free(&line.ab);
+}
+
+
+static void
+run(const char *name, void (*fn)(size_t), const size_t y)
+{
+	size_t	 n    = WORK / len;
+	size_t	 i    = 0;
+	double	 best = 0;
+	double	 ms   = 0;
+	int	 r    = 0;
+
+	if (n > 1000000) {
+		n = 1000000;
+	}
+
+	for (r = 0; r < RUNS; r++) {
+		ms = bench_ms();
+		for (i = 0; i < n; i++) {
+			fn(y);
+		}
+		ms = bench_ms() - ms;
+		if (r == 0 || ms < best) {
+			best = ms;
+		}
+	}
+
+	printf("  %-22s %12.1f ns\n", name, best * 1e6 / (double)n);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char	*lens[] = { "80", "4096", "1048576" };
+	char	**list  = argv + 1;
+	char	*s      = NULL;
+	abuf	 row;
+	size_t	 i      = 0;
+	int	 n      = argc - 1;
+	int	 k      = 0;
+
+	if (n == 0) {
+		list = lens;
+		n    = 3;
+	}
+
+	buffers_init();
+	buf = buffer_current();
+	for (k = 0; k < n; k++) {
+		len = (size_t)strtoul(list[k], NULL, 10);
+		if (len < 2) {
+			len = 2;
+		}
+
+		s = malloc(len);
+		for (i = 0; i < len; i++) {
+			s[i] = i % 7 == 6 ? ' ' : (char)('a' + i % 26);
+		}
+		text = s;
+
+		/* the same text, as is and with a tab in front of it */
+		ab_init(&row);
+		ab_append(&row, s, len);
+		buffer_insert_rows(buf, PLAIN, &row, 1);
+		ab_init(&row);
+		ab_appendch(&row, '\t');
+		ab_append(&row, s + 1, len - 1);
+		buffer_insert_rows(buf, MIXED, &row, 1);
+
+		printf("%zu-byte rows\n", len);
+		run("classify, bytes", classify_bytes, PLAIN);
+		run("classify, scan_plain", classify_scan, PLAIN);
+		run("byte->col, cols_step", walk, PLAIN);
+		run("byte->col, plain", byte_col, PLAIN);
+		run("byte->col, mixed", byte_col, MIXED);
+		run("col->byte, plain", col_byte, PLAIN);
+		run("col->byte, mixed", col_byte, MIXED);
+		run("edit+draw, plain", edit_draw, PLAIN);
+		run("edit+draw, mixed", edit_draw, MIXED);
+
+		buffer_free_rows(buf);
+		free(s);
+	}
+
+	return 0;
+}
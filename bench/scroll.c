@@ -0,0 +1,350 @@
+/*
+ * scroll.c - allocations and cache misses loading a file and paging
+ * through it
+ *
+ * usage: scroll [megabytes]
+ *
+ * A text file of that size (16 MB if none is given, lines of 60 bytes
+ * on average) is loaded as ke loads it, then paged through a screen of
+ * 24 by 80 at a time, each frame built the way display_refresh builds
+ * it. Each step is counted separately:
+ *
+ *	load		buffer_map_file and buffer_index_all: the scan and
+ *			the row store's blocks and Fenwick trees
+ *	pgdn		every screen from the top down, in a frame that
+ *			starts out in 16 KB on the stack (ABUF_INLINE)
+ *	pgdn, heap	the same, in a frame that starts out empty
+ *	jump		the same number of screens at random places
+ *
+ * and, to compare the row store with a flat array of rows, both are
+ * built from the same lines and looked up a screen at a time, in
+ * order and at random:
+ *
+ *	rows, index	rows put into the row store
+ *	flat, index	rows put into one array that grows
+ *	rows, lookup	buffer_rows_at for each screen
+ *	flat, lookup	the array for each screen
+ *
+ * Allocations are counted where the linker can wrap malloc(3) and its
+ * kin (BENCH_WRAP, set by the build on Linux); cache misses and page
+ * faults come from bench_counters_start, and show as n/a where the
+ * machine has no counters for them.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "bench.h"
+#include "buffer.h"
+#include "core.h"
+#include "render.h"
+#include "scan.h"
+
+
+#define	ROWS		24
+#define	COLS		80
+#define	FRAME_INLINE	16384	/* as in main.c */
+#define	BATCH		4096	/* spans per scan_lines call */
+
+
+typedef struct allocs {
+	int64_t	 mallocs;
+	int64_t	 reallocs;
+	int64_t	 frees;
+} allocs;
+
+
+static allocs		 counted;
+static volatile size_t	 sink;
+
+
+#ifdef BENCH_WRAP
+
+void	*__real_malloc(size_t size);
+void	*__real_calloc(size_t n, size_t size);
+void	*__real_realloc(void *p, size_t size);
+void	 __real_free(void *p);
+
+
+void *
+__wrap_malloc(size_t size)
+{
+	counted.mallocs++;
+	return __real_malloc(size);
+}
+
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+	counted.mallocs++;
+	return __real_calloc(n, size);
+}
+
+
+void *
+__wrap_realloc(void *p, size_t size)
+{
+	counted.reallocs++;
+	return __real_realloc(p, size);
+}
+
+
+void
+__wrap_free(void *p)
+{
+	if (p != NULL) {
+		counted.frees++;
+	}
+	__real_free(p);
+}
+
+#endif
+
+
+static double	 started;
+static allocs	 before;
+
+
+static void
+start(void)
+{
+	before = counted;
+	bench_counters_start();
+	started = bench_ms();
+}
+
+
+static void
+stop(const char *name)
+{
+	bench_counts	 c;
+	double		 ms = bench_ms() - started;
+
+	bench_counters_stop(&c);
+	printf("  %-13s %8.1f ms", name, ms);
+#ifdef BENCH_WRAP
+	bench_counter("malloc", counted.mallocs - before.mallocs);
+	bench_counter("realloc", counted.reallocs - before.reallocs);
+	bench_counter("free", counted.frees - before.frees);
+#else
+	bench_counter("malloc", -1);
+	bench_counter("realloc", -1);
+	bench_counter("free", -1);
+#endif
+	bench_counter("misses", c.misses);
+	bench_counter("refs", c.refs);
+	bench_counter("faults", c.faults);
+	printf("\n");
+}
+
+
+/* frame draws the screen starting at row top as display_refresh would. */
+static void
+frame(const buffer *b, const size_t top, const int inline_frame)
+{
+	ABUF_INLINE(FRAME_INLINE)	 f;
+	abuf				 heap;
+	abuf				*ab = &f.ab;
+	size_t				 y  = 0;
+
+	if (inline_frame) {
+		ab_init_inline(ab, sizeof(f.store));
+	} else {
+		ab_init(&heap);
+		ab = &heap;
+	}
+
+	render_frame(ROWS);
+	for (y = top; y < top + ROWS && y < b->nrows; y++) {
+		render_row(ab, b, y, 0, COLS);
+		ab_append(ab, "\x1b[K\r\n", 5);
+	}
+
+	sink = ab->size;
+	ab_free(ab);
+}
+
+
+static size_t
+pick(uint32_t *seed, const size_t n)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return ((size_t)*seed << 16 ^ (size_t)(*seed >> 8)) % n;
+}
+
+
+/* lookup fetches a screen of rows from top, as drawing would. */
+static void
+lookup(const buffer *b, size_t top)
+{
+	abuf	*rows = NULL;
+	size_t	 want = ROWS;
+	size_t	 n    = 0;
+	size_t	 sum  = 0;
+	size_t	 i    = 0;
+
+	while (want > 0 && top < b->nrows) {
+		rows = buffer_rows_at(b, top, &n);
+		for (i = 0; i < n && i < want; i++) {
+			sum += rows[i].size;
+		}
+		top  += i;
+		want -= i;
+	}
+	sink = sum;
+}
+
+
+static void
+lookup_flat(const abuf *rows, const size_t nrows, const size_t top)
+{
+	size_t	 sum = 0;
+	size_t	 y   = 0;
+
+	for (y = top; y < top + ROWS && y < nrows; y++) {
+		sum += rows[y].size;
+	}
+	sink = sum;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	static line_span	 spans[BATCH];
+	const char		*tmp     = getenv("TMPDIR");
+	char			 path[4096];
+	buffer			*b       = NULL;
+	abuf			*flat    = NULL;
+	abuf			 row;
+	char			*map     = NULL;
+	size_t			 size    = 16;
+	size_t			 nflat   = 0;
+	size_t			 cap     = 0;
+	size_t			 off     = 0;
+	size_t			 used    = 0;
+	size_t			 screens = 0;
+	size_t			 n       = 0;
+	size_t			 i       = 0;
+	size_t			 y       = 0;
+	uint32_t		 seed    = 1;
+	int			 fd      = -1;
+
+	if (argc > 1) {
+		size = (size_t)strtoul(argv[1], NULL, 10);
+	}
+	if (tmp == NULL) {
+		tmp = "/tmp";
+	}
+
+	snprintf(path, sizeof(path), "%s/ke-bench-%zu.txt", tmp, size);
+	size *= 1024 * 1024;
+	if (bench_file(path, size, 0) == -1) {
+		perror(path);
+		return 1;
+	}
+
+	buffers_init();
+	b  = buffer_current();
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return 1;
+	}
+
+	printf("%s, %zu MB, %dx%d screens\n", path, size / (1024 * 1024),
+	    ROWS, COLS);
+
+	start();
+	if (buffer_map_file(b, fd, size) == -1) {
+		perror("buffer_map_file");
+		return 1;
+	}
+	buffer_index_all(b);
+	stop("load");
+
+	screens = (b->nrows + ROWS - 1) / ROWS;
+	printf("  %zu rows, %zu screens\n", b->nrows, screens);
+
+	start();
+	for (y = 0; y < b->nrows; y += ROWS) {
+		frame(b, y, 1);
+	}
+	stop("pgdn");
+
+	start();
+	for (y = 0; y < b->nrows; y += ROWS) {
+		frame(b, y, 0);
+	}
+	stop("pgdn, heap");
+
+	start();
+	for (i = 0; i < screens; i++) {
+		frame(b, pick(&seed, b->nrows), 1);
+	}
+	stop("jump");
+
+	/* the same lines once more, into a flat array of rows */
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	buffer_free_rows(b);
+	start();
+	for (off = 0; off < size; off += used) {
+		n = scan_lines(map + off, size - off, 1, spans, BATCH, &used);
+		for (i = 0; i < n; i++) {
+			ab_borrow(&row, map + off + spans[i].off, spans[i].len);
+			buffer_insert_rows(b, b->nrows, &row, 1);
+		}
+	}
+	stop("rows, index");
+
+	start();
+	for (off = 0; off < size; off += used) {
+		n = scan_lines(map + off, size - off, 1, spans, BATCH, &used);
+		for (i = 0; i < n; i++) {
+			if (nflat == cap) {
+				cap  = cap_growth(cap, nflat);
+				flat = realloc(flat, cap * sizeof(abuf));
+			}
+			ab_borrow(&flat[nflat++], map + off + spans[i].off,
+			    spans[i].len);
+		}
+	}
+	stop("flat, index");
+
+	start();
+	for (y = 0; y < b->nrows; y += ROWS) {
+		lookup(b, y);
+	}
+	seed = 1;
+	for (i = 0; i < screens; i++) {
+		lookup(b, pick(&seed, b->nrows));
+	}
+	stop("rows, lookup");
+
+	start();
+	for (y = 0; y < nflat; y += ROWS) {
+		lookup_flat(flat, nflat, y);
+	}
+	seed = 1;
+	for (i = 0; i < screens; i++) {
+		lookup_flat(flat, nflat, pick(&seed, nflat));
+	}
+	stop("flat, lookup");
+
+	free(flat);
+	buffer_drop_rows(b);
+	munmap(map, size);
+	return 0;
+}
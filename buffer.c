@@ -1,18 +1,53 @@
 /* buffer.c - multiple file buffers */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "abuf.h"
 #include "buffer.h"
 #include "core.h"
 #include "editor.h"
+#include "fileio.h"
+#include "follow.h"
+#include "guard.h"
+#include "hex.h"
+#include "journal.h"
+#include "reload.h"
+#include "scan.h"
+#include "view.h"
 
 
 #define		NO_NAME		 "[No Name]"
+#define		INDEX_BATCH	 1024
+#define		LOAD_PENDING	 (1 << 20)	/* spans the loader may queue */
+#define		GAP_MIN		 64		/* smallest gap opened in a row */
+
+
+/*
+ * A loader splits a mapped file into lines on a worker thread. It
+ * only ever reads the mapping; the spans it finds are queued under
+ * the lock and turned into rows by the UI thread, which is the only
+ * one that touches the buffer itself.
+ */
+struct loader {
+	pthread_t	 thread;
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 cond;
+	const char	*map;
+	size_t		 len;
+	line_span	*pend;		/* spans found but not yet rows */
+	size_t		 npend;
+	size_t		 cap;
+	size_t		 scanned;	/* end of the last queued span */
+	int		 done;
+	int		 cancel;
+};
 
 
 /* externs from other modules */
@@ -240,7 +275,7 @@ buffer_list_resize(void)
     buffer	**newlist = NULL;
 
     if (editor.bufcount == editor.bufcap) {
-        editor.bufcap = (size_t)cap_growth((int)editor.bufcap, (int)editor.bufcount + 1);
+        editor.bufcap = cap_growth(editor.bufcap, editor.bufcount + 1);
 
         newlist = realloc(editor.buffers, sizeof(buffer *) * editor.bufcap);
         assert(newlist != NULL);
@@ -266,7 +301,23 @@ buffer_add_empty(void)
 	buf->nrows     = 0;
 	buf->rowoffs   = 0;
 	buf->coloffs   = 0;
-	buf->row       = NULL;
+	memset(&buf->rows, 0, sizeof(buf->rows));
+	buf->slabs     = NULL;
+	buf->map       = NULL;
+	buf->maplen    = 0;
+	buf->mapoff    = 0;
+	buf->loader    = NULL;
+	buf->view      = NULL;
+	buf->hex       = NULL;
+	buf->follow    = NULL;
+	buf->saver     = NULL;
+	buf->journal   = NULL;
+	buf->reload    = NULL;
+	buf->gaprow    = 0;
+	buf->gapat     = 0;
+	buf->gaplen    = 0;
+	buf->compress  = COMPRESS_NONE;
+	buf->readonly  = 0;
 	buf->filename  = NULL;
 	buf->dirty     = 0;
 	buf->mark_set  = 0;
@@ -317,7 +368,7 @@ buffer_is_unnamed_and_empty(const buffer *b)
 		return 0;
 	}
 
-	if (b->row != NULL) {
+	if (b->rows.blk != NULL) {
 		return 0;
 	}
 
@@ -399,12 +450,7 @@ buffer_close_current(void)
 
 	b = editor.buffers[closing];
 	if (b) {
-		if (b->row) {
-			for (size_t i = 0; i < b->nrows; i++) {
-				ab_free(&b->row[i]);
-			}
-			free(b->row);
-		}
+		buffer_free_rows(b);
 
 		if (b->filename) {
 			free(b->filename);
@@ -464,3 +510,556 @@ buffer_switch_by_name(void)
 
 	free(name);
 }
+
+
+/*
+ * buffer_map_file maps an open file read-only; rows are borrowed
+ * from the mapping as they are indexed, and only copied once they
+ * are edited.
+ */
+int
+buffer_map_file(buffer *b, const int fd, const size_t len)
+{
+	void	*map = NULL;
+
+	assert(b->map == NULL);
+
+	if (fstat(fd, &b->mapst) == -1) {
+		return -1;
+	}
+
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	guard_map(map, len, PROT_READ);
+	b->map    = map;
+	b->maplen = len;
+	b->mapoff = 0;
+	return 0;
+}
+
+
+static void *
+loader_run(void *arg)
+{
+	struct loader	*ld = arg;
+	line_span	 lines[INDEX_BATCH];
+	line_span	*pend = NULL;
+	size_t		 off  = 0;
+	size_t		 used = 0;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+
+	while (off < ld->len) {
+		n = scan_lines(ld->map + off, ld->len - off, 1,
+		    lines, INDEX_BATCH, &used);
+
+		pthread_mutex_lock(&ld->lock);
+		while (ld->npend >= LOAD_PENDING && !ld->cancel) {
+			pthread_cond_wait(&ld->cond, &ld->lock);
+		}
+
+		if (ld->cancel) {
+			pthread_mutex_unlock(&ld->lock);
+			break;
+		}
+
+		if (ld->npend + n > ld->cap) {
+			ld->cap = ld->cap ? ld->cap * 2 : INDEX_BATCH * 16;
+			pend = realloc(ld->pend, sizeof(line_span) * ld->cap);
+			assert(pend != NULL);
+			ld->pend = pend;
+		}
+
+		for (i = 0; i < n; i++) {
+			ld->pend[ld->npend].off   = off + lines[i].off;
+			ld->pend[ld->npend++].len = lines[i].len;
+		}
+
+		off += used;
+		ld->scanned = off;
+		pthread_cond_broadcast(&ld->cond);
+		pthread_mutex_unlock(&ld->lock);
+	}
+
+	pthread_mutex_lock(&ld->lock);
+	ld->done = 1;
+	pthread_cond_broadcast(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+
+	return NULL;
+}
+
+
+static void
+loader_free(buffer *b)
+{
+	struct loader	*ld = b->loader;
+
+	pthread_mutex_lock(&ld->lock);
+	ld->cancel = 1;
+	pthread_cond_broadcast(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+
+	pthread_join(ld->thread, NULL);
+	pthread_mutex_destroy(&ld->lock);
+	pthread_cond_destroy(&ld->cond);
+	free(ld->pend);
+	free(ld);
+	b->loader = NULL;
+}
+
+
+/*
+ * loader_drain turns the spans queued by the loader into rows. If
+ * wait is set, it blocks until row want exists or the file is done.
+ */
+static void
+loader_drain(buffer *b, const size_t want, const int wait)
+{
+	struct loader	*ld   = b->loader;
+	line_span	*pend = NULL;
+	abuf		 row;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+	int		 done = 0;
+
+	pthread_mutex_lock(&ld->lock);
+	for (;;) {
+		pend      = ld->pend;
+		n         = ld->npend;
+		b->mapoff = ld->scanned;
+		done      = ld->done;
+		ld->pend  = NULL;
+		ld->npend = ld->cap = 0;
+		pthread_cond_broadcast(&ld->cond);
+		pthread_mutex_unlock(&ld->lock);
+
+		for (i = 0; i < n; i++) {
+			ab_borrow(&row, b->map + pend[i].off, pend[i].len);
+			buffer_insert_rows(b, b->nrows, &row, 1);
+		}
+		free(pend);
+
+		if (done || !wait || b->nrows > want) {
+			break;
+		}
+
+		pthread_mutex_lock(&ld->lock);
+		while (ld->npend == 0 && !ld->done) {
+			pthread_cond_wait(&ld->cond, &ld->lock);
+		}
+	}
+
+	if (done) {
+		loader_free(b);
+	}
+}
+
+
+/*
+ * buffer_load_async starts splitting a mapped buffer into rows in the
+ * background; rows show up as the UI thread drains them.
+ */
+int
+buffer_load_async(buffer *b)
+{
+	struct loader	*ld = NULL;
+
+	if (b->map == NULL || b->loader != NULL) {
+		return -1;
+	}
+
+	ld = calloc(1, sizeof(*ld));
+	assert(ld != NULL);
+
+	ld->map = b->map;
+	ld->len = b->maplen;
+	pthread_mutex_init(&ld->lock, NULL);
+	pthread_cond_init(&ld->cond, NULL);
+
+	if (pthread_create(&ld->thread, NULL, loader_run, ld) != 0) {
+		pthread_mutex_destroy(&ld->lock);
+		pthread_cond_destroy(&ld->cond);
+		free(ld);
+		return -1;
+	}
+
+	b->loader = ld;
+	return 0;
+}
+
+
+int
+buffer_loading(const buffer *b)
+{
+	return b != NULL && b->loader != NULL;
+}
+
+
+/*
+ * buffer_poll picks up any rows the loader has found since the last
+ * call without waiting for more; it returns 1 if anything changed.
+ */
+int
+buffer_poll(buffer *b)
+{
+	size_t	 nrows = 0;
+
+	if (!buffer_loading(b)) {
+		return 0;
+	}
+
+	nrows = b->nrows;
+	loader_drain(b, 0, 0);
+	return b->nrows != nrows || b->loader == NULL;
+}
+
+
+/*
+ * buffer_index_rows splits the mapping into rows until row want
+ * exists or the whole file has been indexed, waiting on the loader
+ * if there is one.
+ */
+void
+buffer_index_rows(buffer *b, const size_t want)
+{
+	line_span	 lines[INDEX_BATCH];
+	abuf		 row;
+	size_t		 used = 0;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+
+	if (b == NULL || b->map == NULL) {
+		return;
+	}
+
+	if (b->loader != NULL) {
+		loader_drain(b, want, 1);
+		return;
+	}
+
+	while (b->mapoff < b->maplen && b->nrows <= want) {
+		n = scan_lines(b->map + b->mapoff, b->maplen - b->mapoff, 1,
+		    lines, INDEX_BATCH, &used);
+		for (i = 0; i < n; i++) {
+			ab_borrow(&row, b->map + b->mapoff + lines[i].off,
+			    lines[i].len);
+			buffer_insert_rows(b, b->nrows, &row, 1);
+		}
+		b->mapoff += used;
+	}
+}
+
+
+void
+buffer_index_all(buffer *b)
+{
+	buffer_index_rows(b, SIZE_MAX);
+}
+
+
+int
+buffer_indexed(const buffer *b)
+{
+	return b->map == NULL || b->mapoff == b->maplen;
+}
+
+
+/*
+ * buffer_unmap copies every row still borrowed from the mapping and
+ * releases it; this is needed before the file is rewritten in place.
+ */
+void
+buffer_unmap(buffer *b)
+{
+	abuf	*row = NULL;
+	size_t	 n   = 0;
+	size_t	 i   = 0;
+	size_t	 j   = 0;
+
+	if (b == NULL || b->map == NULL) {
+		return;
+	}
+
+	buffer_index_all(b);
+	for (i = 0; i < b->nrows; i += n) {
+		row = buffer_rows_at(b, i, &n);
+		for (j = 0; j < n; j++) {
+			ab_own(&row[j]);
+		}
+	}
+
+	guard_unmap(b->map);
+	munmap(b->map, b->maplen);
+	b->map    = NULL;
+	b->maplen = 0;
+	b->mapoff = 0;
+}
+
+
+/*
+ * buffer_clean_rows counts the leading rows that are still in the
+ * mapped file just as a save would write them, each borrowed from its
+ * own place and followed by a newline; off is set to where they end.
+ */
+size_t
+buffer_clean_rows(const buffer *b, size_t *off)
+{
+	const abuf	*row = NULL;
+	size_t		 n   = 0;
+	size_t		 i   = 0;
+	size_t		 j   = 0;
+
+	*off = 0;
+	if (b->map == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < b->nrows; i += n) {
+		row = buffer_rows_at(b, i, &n);
+		for (j = 0; j < n; j++, row++) {
+			if (!ab_borrowed(row) || row->b != b->map + *off ||
+			    *off + row->size >= b->maplen ||
+			    row->b[row->size] != '\n') {
+				return i + j;
+			}
+			*off += row->size + 1;
+		}
+	}
+
+	return i;
+}
+
+
+/*
+ * buffer_rebase maps the file the buffer has just been saved to and
+ * points every row back into it, dropping the copies made for edits
+ * and any slabs, so the next save can tell which rows are already on
+ * disk. If the file can't be mapped or doesn't hold exactly the rows,
+ * the buffer is left as it is.
+ */
+void
+buffer_rebase(buffer *b, const int fd)
+{
+	struct stat	 st;
+	abuf		*row  = NULL;
+	char		*map  = NULL;
+	size_t		 len  = 0;
+	size_t		 off  = 0;
+	size_t		 size = 0;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+	size_t		 j    = 0;
+
+	assert(b->loader == NULL);
+
+	len = buffer_offset(b, b->nrows);
+	if (len == 0 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    (size_t)st.st_size != len) {
+		return;
+	}
+
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return;
+	}
+	guard_map(map, len, PROT_READ);
+
+	for (i = 0; i < b->nrows; i += n) {
+		row = buffer_rows_at(b, i, &n);
+		for (j = 0; j < n; j++) {
+			size = row[j].size;
+			ab_free(&row[j]);
+			ab_borrow(&row[j], map + off, size);
+			off += size + 1;
+		}
+	}
+	buffer_free_slabs(b);
+
+	if (b->map != NULL) {
+		guard_unmap(b->map);
+		munmap(b->map, b->maplen);
+	}
+
+	b->map    = map;
+	b->maplen = len;
+	b->mapoff = len;
+	b->mapst  = st;
+}
+
+
+/*
+ * buffer_moved_bytes returns how many bytes of borrowed rows would
+ * change place in the file if the buffer were written back over it,
+ * which is what buffer_own_moved would have to copy.
+ */
+size_t
+buffer_moved_bytes(const buffer *b)
+{
+	const abuf	*row   = NULL;
+	size_t		 off   = 0;
+	size_t		 moved = 0;
+	size_t		 n     = 0;
+	size_t		 i     = 0;
+	size_t		 j     = 0;
+
+	if (b == NULL || b->map == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < b->nrows; i += n) {
+		row = buffer_rows_at(b, i, &n);
+		for (j = 0; j < n; j++, row++) {
+			if (ab_borrowed(row) && row->b != b->map + off) {
+				moved += row->size;
+			}
+			off += row->size + 1;
+		}
+	}
+
+	return moved;
+}
+
+
+/*
+ * buffer_own_moved copies the borrowed rows whose place in the file
+ * would change if the buffer were written back over it. Rows that
+ * stay put can be written straight from the mapping: rewriting them
+ * in place writes the same bytes, even if the save fails partway.
+ */
+void
+buffer_own_moved(buffer *b)
+{
+	abuf	*row = NULL;
+	size_t	 off = 0;
+	size_t	 n   = 0;
+	size_t	 i   = 0;
+	size_t	 j   = 0;
+
+	if (b == NULL || b->map == NULL) {
+		return;
+	}
+
+	buffer_index_all(b);
+	for (i = 0; i < b->nrows; i += n) {
+		row = buffer_rows_at(b, i, &n);
+		for (j = 0; j < n; j++, row++) {
+			if (ab_borrowed(row) && row->b != b->map + off) {
+				ab_own(row);
+			}
+			off += row->size + 1;
+		}
+	}
+}
+
+
+/*
+ * The row being typed into keeps a gap of spare bytes at the cursor,
+ * so a character typed or backspaced over there costs the same however
+ * long the row is, rather than a move of everything after it. While a
+ * gap is open the row's bytes from gapat on sit gaplen further along.
+ * Only one row of a buffer has a gap. It stays open from frame to
+ * frame, the screen reading the row around it (see buffer_row_text),
+ * and is closed, moving those bytes back, when the cursor leaves the
+ * row or anything but typing wants the rows.
+ *
+ * buffer_gap_move puts the gap of row y at byte at, with room for at
+ * least need bytes and one to spare, so filling it never leaves the
+ * row without the NUL after its last byte. A gap already open in the
+ * row slides there, moving only the bytes in between; otherwise the
+ * open gap is closed and a new one made, a quarter of the row long so
+ * a paste into a long row opens one only every so often.
+ */
+void
+buffer_gap_move(buffer *b, const size_t y, const size_t at, const size_t need)
+{
+	abuf	*row = buffer_row(b, y);
+	size_t	 len = 0;
+
+	if (b->gaplen > 0 && b->gaprow == y && b->gaplen > need) {
+		if (at < b->gapat) {
+			memmove(row->b + at + b->gaplen, row->b + at,
+			    b->gapat - at);
+		} else if (at > b->gapat) {
+			memmove(row->b + b->gapat,
+			    row->b + b->gapat + b->gaplen, at - b->gapat);
+		}
+		b->gapat = at;
+		return;
+	}
+
+	buffer_gap_close(b);
+
+	/* a delete makes its own gap out of the byte it removes */
+	if (need > 0) {
+		len = row->size / 4;
+		if (len < GAP_MIN) {
+			len = GAP_MIN;
+		}
+		if (len <= need) {
+			len = need + 1;
+		}
+	}
+
+	if (ab_borrowed(row) || row->cap < row->size + len + 1) {
+		ab_resize(row, row->size + len);
+	}
+	memmove(row->b + at + len, row->b + at, row->size - at);
+	row->b[row->size + len] = '\0';
+
+	b->gaprow = y;
+	b->gapat  = at;
+	b->gaplen = len;
+}
+
+
+void
+buffer_gap_close(buffer *b)
+{
+	abuf	*row = NULL;
+
+	if (b == NULL || b->gaplen == 0) {
+		return;
+	}
+
+	row = buffer_row(b, b->gaprow);
+	memmove(row->b + b->gapat, row->b + b->gapat + b->gaplen,
+	    row->size - b->gapat);
+	row->b[row->size] = '\0';
+	b->gaplen = 0;
+}
+
+
+void
+buffer_free_rows(buffer *b)
+{
+	fileio_stats	 stats;
+
+	/* a save on the worker is still reading the rows */
+	if (b->saver != NULL) {
+		(void)fileio_save_finish(b, 1, &stats);
+	}
+
+	if (b->loader != NULL) {
+		loader_free(b);
+	}
+	follow_stop(b);
+	journal_close(b);
+	reload_stop(b);
+
+	buffer_drop_rows(b);
+
+	if (b->map) {
+		guard_unmap(b->map);
+		munmap(b->map, b->maplen);
+	}
+	view_free(b);
+	hex_free(b);
+
+	b->map    = NULL;
+	b->maplen = 0;
+	b->mapoff = 0;
+}
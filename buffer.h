@@ -1,7 +1,32 @@
 #ifndef KE_BUFFER_H
 #define KE_BUFFER_H
 
+#include <sys/stat.h>
+
 #include "abuf.h"
+#include "compress.h"
+
+
+/* a buffer's rows, in blocks; see rows.c */
+typedef struct rowtree {
+	struct rowblock	**blk;
+	size_t		  nblk;
+	size_t		  cap;
+	size_t		 *rows;		/* Fenwick trees over blk of the rows */
+	size_t		 *bytes;	/* and the bytes, a newline each */
+} rowtree;
+
+
+/*
+ * A row as it is read while it may have the gap open in it: the bytes
+ * before gapat are at b, the rest gaplen bytes further along.
+ */
+typedef struct rowtext {
+	const char	*b;
+	size_t		 size;
+	size_t		 gapat;		/* size if there is no gap */
+	size_t		 gaplen;
+} rowtext;
 
 
 typedef struct buffer {
@@ -9,7 +34,23 @@ typedef struct buffer {
 	size_t	 rx;
 	size_t	 nrows;
 	size_t	 rowoffs, coloffs;
-	abuf	*row;
+	rowtree	 rows;
+	struct slab	*slabs;		/* text rows borrow, not in a file */
+	char	*map;		/* read-only mapping of the file */
+	size_t	 maplen;
+	size_t	 mapoff;	/* bytes of the mapping indexed into rows */
+	struct stat	 mapst;	/* the mapped file as it was when mapped */
+	struct loader	*loader;	/* background indexer, if running */
+	struct view	*view;		/* window onto a file too big to load */
+	struct hex	*hex;		/* flat bytes, in hex mode */
+	struct follow	*follow;	/* reading what is appended to the file */
+	struct saver	*saver;		/* save running on a worker, if any */
+	struct journal	*journal;	/* edits not yet saved, for recovery */
+	struct reload	*reload;	/* watching the file for changes */
+	size_t	 gaprow;	/* row being typed into, and */
+	size_t	 gapat, gaplen;	/* its gap, if gaplen > 0 */
+	compress_kind	 compress;	/* how the file is compressed */
+	int	 readonly;
 	char	*filename;
 	int	 dirty;
 	int	 mark_set;
@@ -20,7 +61,7 @@ typedef struct buffer {
 buffer		*buffer_current(void);
 
 #define CURBUF			(buffer_current())
-#define EROW			(CURBUF->row)
+#define EROW(y)			(*buffer_row(CURBUF, (y)))
 #define ENROWS			(CURBUF->nrows)
 #define ECURX			(CURBUF->curx)
 #define ECURY			(CURBUF->cury)
@@ -44,6 +85,41 @@ void		 buffer_switch_by_name(void);
 void		 buffer_close_current(void);
 const char	*buffer_name(buffer *b);
 int		 buffer_is_unnamed_and_empty(const buffer *b);
+int		 buffer_map_file(buffer *b, int fd, size_t len);
+int		 buffer_load_async(buffer *b);
+int		 buffer_loading(const buffer *b);
+int		 buffer_poll(buffer *b);
+void		 buffer_index_rows(buffer *b, size_t want);
+void		 buffer_index_all(buffer *b);
+int		 buffer_indexed(const buffer *b);
+size_t		 buffer_clean_rows(const buffer *b, size_t *off);
+void		 buffer_rebase(buffer *b, int fd);
+void		 buffer_unmap(buffer *b);
+size_t		 buffer_moved_bytes(const buffer *b);
+void		 buffer_own_moved(buffer *b);
+void		 buffer_gap_move(buffer *b, size_t y, size_t at, size_t need);
+void		 buffer_gap_close(buffer *b);
+void		 buffer_free_rows(buffer *b);
+
+/* rows.c */
+abuf		*buffer_row(const buffer *b, size_t y);
+abuf		*buffer_rows_at(const buffer *b, size_t y, size_t *n);
+void		 buffer_insert_rows(buffer *b, size_t at, const abuf *rows,
+		    size_t n);
+void		 buffer_delete_rows(buffer *b, size_t at, size_t n);
+void		 buffer_row_resized(buffer *b, size_t y, size_t was);
+size_t		 buffer_row_gen(const buffer *b, size_t y);
+int		 buffer_row_plain(const buffer *b, size_t y);
+void		 buffer_row_set_plain(buffer *b, size_t y);
+void		 buffer_row_text(const buffer *b, size_t y, rowtext *t);
+size_t		 rowtext_span(const rowtext *t, size_t off, const char **s);
+size_t		 rowtext_read(const rowtext *t, size_t off, char *dst,
+		    size_t len);
+size_t		 buffer_offset(const buffer *b, size_t y);
+void		 buffer_drop_rows(buffer *b);
+void		 buffer_copy_row(buffer *b, abuf *row, const char *s,
+		    size_t len);
+void		 buffer_free_slabs(buffer *b);
 
 
 #endif
@@ -0,0 +1,339 @@
+/*
+ * cols.c - where a row's bytes show on screen
+ *
+ * Which column a byte shows at depends on every character before it
+ * in the row: tabs, control characters, multibyte and wide characters.
+ * Working it out from the start of the row on every key is nothing
+ * for a line of text, but in a file that is one line of megabytes it
+ * takes milliseconds a key.
+ *
+ * A row longer than COLS_LONG gets a table of checkpoints instead: the
+ * first character at or past every COLS_STEP bytes, with the column it
+ * starts at. The table is only built
+ * as far as it has been asked about. Finding a byte's column, or a
+ * column's byte, is then a binary search of the table and a walk of
+ * at most COLS_STEP bytes from the checkpoint before it. The tables
+ * go with a row's generation, and an edit only cuts its row's table
+ * back to where the edit was.
+ *
+ * A row that is all printable ASCII, as most are, needs none of that:
+ * every byte is a column. Other rows are still walked a run of plain
+ * bytes at a time, with scan_plain finding where each run stops.
+ *
+ * The row being typed into is read around its gap, which stays open
+ * between keys.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "cols.h"
+#include "core.h"
+#include "scan.h"
+#include "utf8.h"
+
+
+#define	COLS_STEP	1024		/* bytes between checkpoints */
+#define	COLS_LONG	(8 * COLS_STEP)	/* a shorter row is walked whole */
+#define	COLS_TABLES	8		/* tables of long rows kept */
+
+
+struct table {
+	size_t		 gen;		/* of the row, or 0 if unused */
+	size_t		 used;		/* when it was last looked at */
+	cols_pos	*pt;
+	size_t		 n;
+	size_t		 cap;
+	int		 done;		/* pt has every checkpoint */
+};
+
+
+static struct table	 tables[COLS_TABLES];
+static size_t		 uses;
+
+
+size_t
+cols_step(cols_pos *p, const char *s, const size_t len)
+{
+	unsigned char	 c  = (unsigned char)s[0];
+	uint32_t	 cp = 0;
+	size_t		 n  = 1;
+	size_t		 w  = 1;
+
+	if (c == '\t') {
+		w = TAB_STOP - p->col % TAB_STOP;
+	} else if (c < 0x20) {
+		w = 3;
+	} else if (c >= 0x80) {
+		n = utf8_decode(s, len, &cp);
+		if (n == 0) {
+			/* not a character; go on from the next byte */
+			n = 1;
+		} else {
+			w = (size_t)utf8_width(cp);
+		}
+	}
+
+	p->off += n;
+	p->col += w;
+	return w;
+}
+
+
+/*
+ * step moves p past the character of t at p->off and returns the
+ * columns it takes, putting it back together first if the gap cuts it.
+ */
+static size_t
+step(cols_pos *p, const rowtext *t)
+{
+	const char	*s = NULL;
+	char		 seq[4];
+	size_t		 n = 0;
+
+	n = rowtext_span(t, p->off, &s);
+	if (n < sizeof(seq) && (unsigned char)s[0] >= 0x80) {
+		n = rowtext_read(t, p->off, seq, sizeof(seq));
+		s = seq;
+	}
+
+	return cols_step(p, s, n);
+}
+
+
+/* plain moves p over the printable ASCII of t at p->off, up to len bytes. */
+static void
+plain(cols_pos *p, const rowtext *t, size_t len)
+{
+	const char	*s    = NULL;
+	size_t		 span = 0;
+	size_t		 n    = 0;
+
+	do {
+		span    = rowtext_span(t, p->off, &s);
+		n       = scan_plain(s, span < len ? span : len);
+		p->off += n;
+		p->col += n;
+		len    -= n;
+	} while (n == span && n > 0 && len > 0);
+}
+
+
+static void
+to_byte(cols_pos *p, const rowtext *t, size_t at)
+{
+	if (at > t->size) {
+		at = t->size;
+	}
+
+	while (p->off < at) {
+		plain(p, t, at - p->off);
+		if (p->off < at) {
+			step(p, t);
+		}
+	}
+}
+
+
+static void
+to_col(cols_pos *p, const rowtext *t, const size_t col)
+{
+	cols_pos	 q;
+
+	while (p->off < t->size) {
+		if (p->col < col) {
+			plain(p, t, col - p->col);
+			if (p->off == t->size) {
+				break;
+			}
+		}
+
+		q = *p;
+		if (q.col + step(&q, t) > col) {
+			break;
+		}
+		*p = q;
+	}
+}
+
+
+/*
+ * table returns the table of row y, which is long enough to have one,
+ * taking over the one used longest ago if it has none.
+ */
+static struct table *
+table(const buffer *b, const size_t y)
+{
+	struct table	*t   = NULL;
+	size_t		 gen = buffer_row_gen(b, y);
+	size_t		 i   = 0;
+
+	for (i = 0; i < COLS_TABLES; i++) {
+		if (tables[i].gen == gen) {
+			t = &tables[i];
+			break;
+		}
+
+		if (t == NULL || tables[i].used < t->used) {
+			t = &tables[i];
+		}
+	}
+
+	if (t->gen != gen) {
+		if (t->pt == NULL) {
+			t->cap = 64;
+			t->pt  = malloc(t->cap * sizeof(*t->pt));
+			assert(t->pt != NULL);
+		}
+		memset(&t->pt[0], 0, sizeof(t->pt[0]));
+		t->gen  = gen;
+		t->n    = 1;
+		t->done = 0;
+	}
+
+	t->used = ++uses;
+	return t;
+}
+
+
+/*
+ * extend adds checkpoints until the last is within COLS_STEP bytes of
+ * at and past col, or there are no more.
+ */
+static void
+extend(struct table *t, const rowtext *row, const size_t at, const size_t col)
+{
+	cols_pos	 p;
+
+	while (!t->done && (t->pt[t->n - 1].off + COLS_STEP <= at ||
+	    t->pt[t->n - 1].col < col)) {
+		p = t->pt[t->n - 1];
+		to_byte(&p, row, t->n * COLS_STEP);
+		if (p.off >= row->size) {
+			t->done = 1;
+			break;
+		}
+
+		if (t->n == t->cap) {
+			t->cap = cap_growth(t->cap, t->n);
+			t->pt  = realloc(t->pt, t->cap * sizeof(*t->pt));
+			assert(t->pt != NULL);
+		}
+		t->pt[t->n++] = p;
+	}
+}
+
+
+/* before returns the last checkpoint at or before byte at. */
+static size_t
+before(const struct table *t, const size_t at)
+{
+	size_t	 lo  = 0;
+	size_t	 hi  = t->n;
+	size_t	 mid = 0;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (t->pt[mid].off <= at) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+
+/* before_col returns the last checkpoint at or before column col. */
+static size_t
+before_col(const struct table *t, const size_t col)
+{
+	size_t	 lo  = 0;
+	size_t	 hi  = t->n;
+	size_t	 mid = 0;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (t->pt[mid].col <= col) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+
+size_t
+cols_at(const buffer *b, const size_t y, const size_t at)
+{
+	struct table	*t = NULL;
+	rowtext		 row;
+	cols_pos	 p;
+
+	buffer_row_text(b, y, &row);
+	if (buffer_row_plain(b, y)) {
+		return at < row.size ? at : row.size;
+	}
+
+	memset(&p, 0, sizeof(p));
+	if (row.size > COLS_LONG) {
+		t = table(b, y);
+		extend(t, &row, at, 0);
+		p = t->pt[before(t, at)];
+	}
+
+	to_byte(&p, &row, at);
+	return p.col;
+}
+
+
+void
+cols_seek(const buffer *b, const size_t y, const size_t col, cols_pos *p)
+{
+	struct table	*t = NULL;
+	rowtext		 row;
+
+	buffer_row_text(b, y, &row);
+	memset(p, 0, sizeof(*p));
+	if (buffer_row_plain(b, y)) {
+		p->off = p->col = col < row.size ? col : row.size;
+		return;
+	}
+
+	if (row.size > COLS_LONG) {
+		t = table(b, y);
+		extend(t, &row, 0, col);
+		*p = t->pt[before_col(t, col)];
+	}
+
+	to_col(p, &row, col);
+}
+
+
+void
+cols_edited(const size_t was, const size_t gen, const size_t at)
+{
+	size_t	 i = 0;
+
+	for (i = 0; i < COLS_TABLES; i++) {
+		if (tables[i].gen == was && was != 0) {
+			/*
+			 * The last checkpoint at or before at goes too, as
+			 * one at at itself may now be inside a character;
+			 * the one at the row's start always holds.
+			 */
+			tables[i].gen  = gen;
+			tables[i].n    = before(&tables[i], at);
+			tables[i].done = 0;
+			if (tables[i].n == 0) {
+				tables[i].n = 1;
+			}
+		}
+	}
+}
@@ -0,0 +1,39 @@
+/*
+ * cols.h - where a row's bytes show on screen
+ */
+#ifndef KE_COLS_H
+#define KE_COLS_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+
+/* a place in a row: a byte and the column it shows at */
+typedef struct cols_pos {
+	size_t		 off;
+	size_t		 col;
+} cols_pos;
+
+
+/*
+ * A tab takes up to the next tab stop, a control character shows as
+ * \xx, and a byte that isn't part of a character takes one column.
+ *
+ * cols_step moves p past the character at s, which has len bytes left
+ * in it, and returns the columns it takes. cols_at returns the column
+ * byte at of row y starts at. cols_seek sets p to the character of row
+ * y that column col is in, or to the end of the row if it is past it.
+ *
+ * Long rows keep a checkpoint every so many bytes, built as far as it
+ * is needed, so both walk at most that far. cols_edited is told that
+ * the row that had generation was has gen now, and is the same up to
+ * byte at, which keeps the checkpoints before at.
+ */
+size_t		 cols_step(cols_pos *p, const char *s, size_t len);
+size_t		 cols_at(const buffer *b, size_t y, size_t at);
+void		 cols_seek(const buffer *b, size_t y, size_t col, cols_pos *p);
+void		 cols_edited(size_t was, size_t gen, size_t at);
+
+
+#endif
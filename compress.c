@@ -0,0 +1,562 @@
+/*
+ * compress.c - streaming gzip and zstd
+ *
+ * Compressed files are decompressed as they are read and compressed
+ * as they are written, a block at a time, so neither side ever needs
+ * a temporary file or a second copy of the data. Each format is only
+ * available if ke was built with its library (KE_ZLIB, KE_ZSTD); the
+ * uncompressed "format" is always there, so callers can read and
+ * write everything the same way.
+ */
+#include <sys/types.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef KE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef KE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+
+#define	ZBLOCK		(256 * 1024)	/* compressed bytes per read/write */
+
+
+struct zreader {
+	int		 fd;
+	compress_kind	 kind;
+	char		*in;
+	size_t		 inlen;
+	int		 eof;		/* nothing more to read */
+	int		 done;		/* last frame decoded */
+#ifdef KE_ZLIB
+	z_stream	 z;
+#endif
+#ifdef KE_ZSTD
+	ZSTD_DCtx	*zd;
+	ZSTD_inBuffer	 zin;
+	size_t		 want;		/* ZSTD_decompressStream's hint */
+#endif
+};
+
+
+struct zwriter {
+	int		 fd;
+	compress_kind	 kind;
+	char		*out;
+	size_t		 written;
+#ifdef KE_ZLIB
+	z_stream	 z;
+#endif
+#ifdef KE_ZSTD
+	ZSTD_CCtx	*zc;
+#endif
+};
+
+
+compress_kind
+compress_detect(const unsigned char *buf, const size_t len)
+{
+	if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b) {
+		return COMPRESS_GZIP;
+	}
+
+	if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 &&
+	    buf[2] == 0x2f && buf[3] == 0xfd) {
+		return COMPRESS_ZSTD;
+	}
+
+	return COMPRESS_NONE;
+}
+
+
+/*
+ * compress_by_name picks the format for a new file from its name.
+ */
+compress_kind
+compress_by_name(const char *path)
+{
+	size_t	 len = strlen(path);
+
+	if (len > 3 && strcmp(path + len - 3, ".gz") == 0) {
+		return COMPRESS_GZIP;
+	}
+
+	if (len > 4 && strcmp(path + len - 4, ".zst") == 0) {
+		return COMPRESS_ZSTD;
+	}
+
+	return COMPRESS_NONE;
+}
+
+
+const char *
+compress_name(const compress_kind kind)
+{
+	switch (kind) {
+	case COMPRESS_GZIP:
+		return "gzip";
+	case COMPRESS_ZSTD:
+		return "zstd";
+	default:
+		return "plain";
+	}
+}
+
+
+int
+compress_supported(const compress_kind kind)
+{
+	switch (kind) {
+	case COMPRESS_NONE:
+		return 1;
+#ifdef KE_ZLIB
+	case COMPRESS_GZIP:
+		return 1;
+#endif
+#ifdef KE_ZSTD
+	case COMPRESS_ZSTD:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+
+#if defined(KE_ZLIB) || defined(KE_ZSTD)
+/*
+ * zread_fill reads the next block of compressed input.
+ */
+static int
+zread_fill(zreader *zr)
+{
+	ssize_t	 nr = 0;
+
+	do {
+		nr = read(zr->fd, zr->in, ZBLOCK);
+	} while (nr == -1 && errno == EINTR);
+
+	if (nr == -1) {
+		return -1;
+	}
+
+	zr->inlen = (size_t)nr;
+	zr->eof   = (nr == 0);
+	return 0;
+}
+#endif
+
+
+zreader *
+zread_open(const int fd, const compress_kind kind)
+{
+	zreader	*zr = NULL;
+
+	if (!compress_supported(kind)) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	zr = calloc(1, sizeof(*zr));
+	if (zr == NULL) {
+		return NULL;
+	}
+
+	zr->fd   = fd;
+	zr->kind = kind;
+	if (kind != COMPRESS_NONE) {
+		zr->in = malloc(ZBLOCK);
+		if (zr->in == NULL) {
+			free(zr);
+			return NULL;
+		}
+	}
+
+#ifdef KE_ZLIB
+	/* 15 + 32: a window of any size, with a gzip or zlib header */
+	if (kind == COMPRESS_GZIP && inflateInit2(&zr->z, 15 + 32) != Z_OK) {
+		goto open_fail;
+	}
+#endif
+#ifdef KE_ZSTD
+	if (kind == COMPRESS_ZSTD && (zr->zd = ZSTD_createDCtx()) == NULL) {
+		goto open_fail;
+	}
+#endif
+
+	return zr;
+
+#if defined(KE_ZLIB) || defined(KE_ZSTD)
+open_fail:
+	free(zr->in);
+	free(zr);
+	errno = ENOMEM;
+	return NULL;
+#endif
+}
+
+
+#ifdef KE_ZLIB
+static ssize_t
+gz_read(zreader *zr, char *buf, size_t len)
+{
+	int	 rv = 0;
+
+	if (len > UINT_MAX) {
+		len = UINT_MAX;
+	}
+
+	zr->z.next_out  = (Bytef *)buf;
+	zr->z.avail_out = (uInt)len;
+	while (zr->z.avail_out > 0 && !zr->done) {
+		if (zr->z.avail_in == 0 && !zr->eof) {
+			if (zread_fill(zr) == -1) {
+				return -1;
+			}
+			zr->z.next_in  = (Bytef *)zr->in;
+			zr->z.avail_in = (uInt)zr->inlen;
+		}
+
+		rv = inflate(&zr->z, Z_NO_FLUSH);
+		if (rv == Z_STREAM_END) {
+			if (zr->z.avail_in == 0 && !zr->eof) {
+				if (zread_fill(zr) == -1) {
+					return -1;
+				}
+				zr->z.next_in  = (Bytef *)zr->in;
+				zr->z.avail_in = (uInt)zr->inlen;
+			}
+
+			/* rotated logs are often several members back to back */
+			if (zr->z.avail_in == 0) {
+				zr->done = 1;
+			} else if (inflateReset(&zr->z) != Z_OK) {
+				errno = EIO;
+				return -1;
+			}
+		} else if (rv == Z_BUF_ERROR && zr->z.avail_in == 0 &&
+		    !zr->eof) {
+			continue;
+		} else if (rv != Z_OK) {
+			/* corrupt, or cut short */
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return (ssize_t)(len - zr->z.avail_out);
+}
+#endif
+
+
+#ifdef KE_ZSTD
+static ssize_t
+zst_read(zreader *zr, char *buf, const size_t len)
+{
+	ZSTD_outBuffer	 out;
+	size_t		 before = 0;
+
+	out.dst  = buf;
+	out.size = len;
+	out.pos  = 0;
+	while (out.pos < out.size) {
+		if (zr->zin.pos == zr->zin.size && !zr->eof) {
+			if (zread_fill(zr) == -1) {
+				return -1;
+			}
+			zr->zin.src  = zr->in;
+			zr->zin.size = zr->inlen;
+			zr->zin.pos  = 0;
+		}
+
+		if (zr->zin.pos == zr->zin.size && zr->eof && zr->want == 0) {
+			break;
+		}
+
+		before   = out.pos;
+		zr->want = ZSTD_decompressStream(zr->zd, &out, &zr->zin);
+		if (ZSTD_isError(zr->want)) {
+			errno = EIO;
+			return -1;
+		}
+
+		if (zr->zin.pos == zr->zin.size && zr->eof &&
+		    out.pos == before && zr->want != 0) {
+			/* the last frame was cut short */
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return (ssize_t)out.pos;
+}
+#endif
+
+
+/*
+ * zread fills buf with up to len bytes of decompressed data. It
+ * returns 0 at the end of the data and -1 on a read error or bad
+ * input.
+ */
+ssize_t
+zread(zreader *zr, char *buf, const size_t len)
+{
+	ssize_t	 nr = 0;
+
+	switch (zr->kind) {
+#ifdef KE_ZLIB
+	case COMPRESS_GZIP:
+		return gz_read(zr, buf, len);
+#endif
+#ifdef KE_ZSTD
+	case COMPRESS_ZSTD:
+		return zst_read(zr, buf, len);
+#endif
+	default:
+		do {
+			nr = read(zr->fd, buf, len);
+		} while (nr == -1 && errno == EINTR);
+		return nr;
+	}
+}
+
+
+void
+zread_close(zreader *zr)
+{
+	if (zr == NULL) {
+		return;
+	}
+
+#ifdef KE_ZLIB
+	if (zr->kind == COMPRESS_GZIP) {
+		inflateEnd(&zr->z);
+	}
+#endif
+#ifdef KE_ZSTD
+	if (zr->kind == COMPRESS_ZSTD) {
+		ZSTD_freeDCtx(zr->zd);
+	}
+#endif
+
+	free(zr->in);
+	free(zr);
+}
+
+
+/*
+ * zwrite_flush writes out n bytes of output, picking up after short
+ * writes.
+ */
+static int
+zwrite_flush(zwriter *zw, const char *buf, size_t n)
+{
+	ssize_t	 nw = 0;
+
+	while (n > 0) {
+		nw = write(zw->fd, buf, n);
+		if (nw == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		buf         += nw;
+		n           -= (size_t)nw;
+		zw->written += (size_t)nw;
+	}
+
+	return 0;
+}
+
+
+zwriter *
+zwrite_open(const int fd, const compress_kind kind)
+{
+	zwriter	*zw = NULL;
+
+	if (!compress_supported(kind)) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	zw = calloc(1, sizeof(*zw));
+	if (zw == NULL) {
+		return NULL;
+	}
+
+	zw->fd   = fd;
+	zw->kind = kind;
+	if (kind != COMPRESS_NONE) {
+		zw->out = malloc(ZBLOCK);
+		if (zw->out == NULL) {
+			free(zw);
+			return NULL;
+		}
+	}
+
+#ifdef KE_ZLIB
+	/* 15 + 16: the largest window, with a gzip header */
+	if (kind == COMPRESS_GZIP &&
+	    deflateInit2(&zw->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+	    8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		goto open_fail;
+	}
+#endif
+#ifdef KE_ZSTD
+	if (kind == COMPRESS_ZSTD && (zw->zc = ZSTD_createCCtx()) == NULL) {
+		goto open_fail;
+	}
+#endif
+
+	return zw;
+
+#if defined(KE_ZLIB) || defined(KE_ZSTD)
+open_fail:
+	free(zw->out);
+	free(zw);
+	errno = ENOMEM;
+	return NULL;
+#endif
+}
+
+
+#ifdef KE_ZLIB
+static int
+gz_deflate(zwriter *zw, const int flush)
+{
+	int	 rv = 0;
+
+	do {
+		zw->z.next_out  = (Bytef *)zw->out;
+		zw->z.avail_out = ZBLOCK;
+		rv = deflate(&zw->z, flush);
+		if (rv == Z_STREAM_ERROR) {
+			errno = EIO;
+			return -1;
+		}
+
+		if (zwrite_flush(zw, zw->out, ZBLOCK - zw->z.avail_out) == -1) {
+			return -1;
+		}
+	} while (zw->z.avail_out == 0 || (flush == Z_FINISH &&
+	    rv != Z_STREAM_END));
+
+	return 0;
+}
+#endif
+
+
+#ifdef KE_ZSTD
+static int
+zst_compress(zwriter *zw, ZSTD_inBuffer *in, const ZSTD_EndDirective end)
+{
+	ZSTD_outBuffer	 out;
+	size_t		 left = 0;
+
+	do {
+		out.dst  = zw->out;
+		out.size = ZBLOCK;
+		out.pos  = 0;
+		left = ZSTD_compressStream2(zw->zc, &out, in, end);
+		if (ZSTD_isError(left)) {
+			errno = EIO;
+			return -1;
+		}
+
+		if (zwrite_flush(zw, zw->out, out.pos) == -1) {
+			return -1;
+		}
+	} while (in->pos < in->size || (end == ZSTD_e_end && left != 0));
+
+	return 0;
+}
+#endif
+
+
+/*
+ * zwrite compresses len bytes from buf and writes out whatever
+ * compressed output is ready.
+ */
+int
+zwrite(zwriter *zw, const char *buf, size_t len)
+{
+#ifdef KE_ZSTD
+	ZSTD_inBuffer	 in;
+#endif
+#ifdef KE_ZLIB
+	size_t		 n = 0;
+#endif
+
+	switch (zw->kind) {
+#ifdef KE_ZLIB
+	case COMPRESS_GZIP:
+		while (len > 0) {
+			n = (len > UINT_MAX) ? UINT_MAX : len;
+			zw->z.next_in  = (Bytef *)buf;
+			zw->z.avail_in = (uInt)n;
+			if (gz_deflate(zw, Z_NO_FLUSH) == -1) {
+				return -1;
+			}
+			buf += n;
+			len -= n;
+		}
+		return 0;
+#endif
+#ifdef KE_ZSTD
+	case COMPRESS_ZSTD:
+		in.src  = buf;
+		in.size = len;
+		in.pos  = 0;
+		return zst_compress(zw, &in, ZSTD_e_continue);
+#endif
+	default:
+		return zwrite_flush(zw, buf, len);
+	}
+}
+
+
+/*
+ * zwrite_close finishes the compressed stream and frees zw, storing
+ * the number of bytes written to the file in written.
+ */
+int
+zwrite_close(zwriter *zw, size_t *written)
+{
+	int		 rv = 0;
+#ifdef KE_ZSTD
+	ZSTD_inBuffer	 in;
+#endif
+
+#ifdef KE_ZLIB
+	if (zw->kind == COMPRESS_GZIP) {
+		zw->z.next_in  = Z_NULL;
+		zw->z.avail_in = 0;
+		rv = gz_deflate(zw, Z_FINISH);
+		deflateEnd(&zw->z);
+	}
+#endif
+#ifdef KE_ZSTD
+	if (zw->kind == COMPRESS_ZSTD) {
+		in.src  = NULL;
+		in.size = 0;
+		in.pos  = 0;
+		rv = zst_compress(zw, &in, ZSTD_e_end);
+		ZSTD_freeCCtx(zw->zc);
+	}
+#endif
+
+	*written = zw->written;
+	free(zw->out);
+	free(zw);
+	return rv;
+}
@@ -0,0 +1,37 @@
+/*
+ * compress.h - streaming gzip and zstd
+ */
+#ifndef KE_COMPRESS_H
+#define KE_COMPRESS_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+
+
+typedef enum compress_kind {
+	COMPRESS_NONE = 0,
+	COMPRESS_GZIP = 1,
+	COMPRESS_ZSTD = 2,
+} compress_kind;
+
+
+typedef struct zreader	zreader;
+typedef struct zwriter	zwriter;
+
+
+compress_kind	 compress_detect(const unsigned char *buf, size_t len);
+compress_kind	 compress_by_name(const char *path);
+const char	*compress_name(compress_kind kind);
+int		 compress_supported(compress_kind kind);
+
+zreader		*zread_open(int fd, compress_kind kind);
+ssize_t		 zread(zreader *zr, char *buf, size_t len);
+void		 zread_close(zreader *zr);
+
+zwriter		*zwrite_open(int fd, compress_kind kind);
+int		 zwrite(zwriter *zw, const char *buf, size_t len);
+int		 zwrite_close(zwriter *zw, size_t *written);
+
+
+#endif
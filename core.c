@@ -1,10 +1,15 @@
+#include <sys/stat.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "abuf.h"
 #include "core.h"
 
 #ifdef	INCLUDE_STRNSTR
@@ -44,33 +49,47 @@ swap_size_t(size_t *first, size_t *second)
 }
 
 
-int
-next_power_of_2(int n)
+size_t
+next_power_of_2(size_t n)
 {
+	size_t	 shift = 0;
+
 	if (n < 2) {
 		n = 2;
 	}
 
 	n--;
-	n |= n >> 1;
-	n |= n >> 2;
-	n |= n >> 4;
-	n |= n >> 8;
-	n |= n >> 16;
+	for (shift = 1; shift < sizeof(n) * CHAR_BIT; shift <<= 1) {
+		n |= n >> shift;
+	}
 
 	return n + 1;
 }
 
 
-int
-cap_growth(int cap, int sz)
+/*
+ * cap_growth returns a capacity bigger than sz, starting from cap. It
+ * doubles up to GROWTH_SLOW and grows by half after that, so a buffer
+ * of gigabytes doesn't need room for twice itself every time it grows.
+ * If growing would overflow, it returns just enough.
+ */
+size_t
+cap_growth(size_t cap, const size_t sz)
 {
 	if (cap == 0) {
 		cap = INITIAL_CAPACITY;
 	}
 
 	while (cap <= sz) {
-		cap = next_power_of_2(cap + 1);
+		if (cap > SIZE_MAX / 3) {
+			return sz + 1;
+		}
+
+		if (cap < GROWTH_SLOW) {
+			cap = next_power_of_2(cap + 1);
+		} else {
+			cap += cap / 2;
+		}
 	}
 
 	return cap;
@@ -89,19 +108,80 @@ kstrnlen(const char *buf, const size_t max)
 
 
 void
-kwrite(const int fd, const char* buf, const int len)
+kwrite(const int fd, const char* buf, const size_t len)
 {
-	int wlen = 0;
+	ssize_t wlen = 0;
 
 	wlen = write(fd, buf, len);
 	assert(wlen != -1);
-	assert(wlen == len);
+	assert((size_t)wlen == len);
 	if (wlen == -1) {
 		abort();
 	}
 }
 
 
+/*
+ * kstat_same reports whether a and b are the same file, unchanged: the
+ * same inode, size and modification time, and the change time too if
+ * changed is set. Times are compared to the nanosecond where there are
+ * nanoseconds, so a rewrite within the same second still shows.
+ */
+int
+kstat_same(const struct stat *a, const struct stat *b, const int changed)
+{
+	if (a->st_dev != b->st_dev || a->st_ino != b->st_ino ||
+	    a->st_size != b->st_size || a->st_mtime != b->st_mtime ||
+	    (changed && a->st_ctime != b->st_ctime)) {
+		return 0;
+	}
+
+#ifdef __linux__
+	return a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+	    (!changed || a->st_ctim.tv_nsec == b->st_ctim.tv_nsec);
+#else
+	return 1;
+#endif
+}
+
+
+/*
+ * kread_all reads the whole of the regular file open on fd into a new
+ * buffer, with room for a NUL after it, and sets *len to its length.
+ */
+unsigned char *
+kread_all(const int fd, size_t *len)
+{
+	struct stat	 st;
+	unsigned char	*buf = NULL;
+	size_t		 got = 0;
+	ssize_t		 nr  = 0;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+
+	buf = malloc((size_t)st.st_size + 1);
+	if (buf == NULL) {
+		return NULL;
+	}
+
+	while (got < (size_t)st.st_size) {
+		nr = read(fd, buf + got, (size_t)st.st_size - got);
+		if (nr == -1 && errno == EINTR) {
+			continue;
+		}
+		if (nr <= 0) {
+			break;
+		}
+		got += (size_t)nr;
+	}
+
+	*len = got;
+	return buf;
+}
+
+
 void
 die(const char* s)
 {
@@ -111,3 +191,125 @@ die(const char* s)
 	perror(s);
 	exit(1);
 }
+
+
+uint32_t
+fnv1a(const unsigned char *p, size_t len)
+{
+	uint32_t	 h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+void
+put_u64(abuf *ab, const uint64_t v)
+{
+	unsigned char	 b[8];
+	int		 i = 0;
+
+	for (i = 0; i < 8; i++) {
+		b[i] = (unsigned char)(v >> (i * 8));
+	}
+	ab_append(ab, (const char *)b, sizeof(b));
+}
+
+
+uint64_t
+get_u64(const unsigned char *p)
+{
+	uint64_t	 v = 0;
+	int		 i = 0;
+
+	for (i = 7; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+
+	return v;
+}
+
+
+/*
+ * Counts, offsets and lengths are LEB128 varints, so most fields take
+ * a byte or two.
+ */
+void
+put_varint(abuf *ab, uint64_t v)
+{
+	unsigned char	 b[10];
+	size_t		 n = 0;
+
+	do {
+		b[n] = (unsigned char)(v & 0x7f);
+		v >>= 7;
+		if (v != 0) {
+			b[n] |= 0x80;
+		}
+		n++;
+	} while (v != 0);
+
+	ab_append(ab, (const char *)b, n);
+}
+
+
+static uint64_t
+mtime_ns(const struct stat *st)
+{
+#ifdef __linux__
+	return (uint64_t)st->st_mtim.tv_nsec;
+#else
+	(void)st;
+	return 0;
+#endif
+}
+
+
+/*
+ * A stamp records which file, and which version of it, something
+ * saved alongside it was made from. It is what kstat_same compares,
+ * without the change time.
+ */
+void
+put_stamp(abuf *ab, const struct stat *st)
+{
+	put_u64(ab, (uint64_t)st->st_dev);
+	put_u64(ab, (uint64_t)st->st_ino);
+	put_u64(ab, (uint64_t)st->st_size);
+	put_u64(ab, (uint64_t)st->st_mtime);
+	put_u64(ab, mtime_ns(st));
+}
+
+
+/* stamp_same reports whether the stamp at p is st's file as it is. */
+int
+stamp_same(const unsigned char *p, const struct stat *st)
+{
+	return get_u64(p) == (uint64_t)st->st_dev &&
+	    get_u64(p + 8) == (uint64_t)st->st_ino &&
+	    get_u64(p + 16) == (uint64_t)st->st_size &&
+	    get_u64(p + 24) == (uint64_t)st->st_mtime &&
+	    get_u64(p + 32) == mtime_ns(st);
+}
+
+
+const unsigned char *
+get_varint(const unsigned char *p, const unsigned char *end, uint64_t *v)
+{
+	int	 shift = 0;
+
+	*v = 0;
+	while (p < end && shift < 64) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			return p;
+		}
+		shift += 7;
+	}
+
+	return NULL;
+}
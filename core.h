@@ -1,10 +1,14 @@
 #ifndef KE_CORE_H
 #define KE_CORE_H
 
+#include <sys/stat.h>
 #include <stddef.h>
+#include <stdint.h>
 
 
 #define		INITIAL_CAPACITY	8
+#define		GROWTH_SLOW		(64 * 1024 * 1024)	/* grow by half past this */
+#define		TAB_STOP		8
 
 
 typedef enum key_press {
@@ -23,17 +27,37 @@ typedef enum key_press {
 } key_press;
 
 
+struct abuf;
+
+
 #ifndef strnstr
 char	*strnstr(const char *s, const char *find, size_t slen);
 #define	INCLUDE_STRNSTR
 #endif
 
 void		 swap_size_t(size_t *first, size_t *second);
-int 		 next_power_of_2(int n);
-int 		 cap_growth(int cap, int sz);
+size_t		 next_power_of_2(size_t n);
+size_t		 cap_growth(size_t cap, size_t sz);
 size_t		 kstrnlen(const char *buf, size_t max);
-void		 kwrite(int fd, const char *buf, int len);
+void		 kwrite(int fd, const char *buf, size_t len);
+int		 kstat_same(const struct stat *a, const struct stat *b,
+		    int changed);
+unsigned char	*kread_all(int fd, size_t *len);
 void		 die(const char *s);
 
+/* checksums and the little-endian fields of ke's own files */
+uint32_t	 fnv1a(const unsigned char *p, size_t len);
+void		 put_u64(struct abuf *ab, uint64_t v);
+uint64_t	 get_u64(const unsigned char *p);
+void		 put_varint(struct abuf *ab, uint64_t v);
+const unsigned char
+		*get_varint(const unsigned char *p, const unsigned char *end,
+		    uint64_t *v);
+
+/* a file's identity: device, inode, size and mtime to the nanosecond */
+#define	KSTAMP_LEN	40
+void		 put_stamp(struct abuf *ab, const struct stat *st);
+int		 stamp_same(const unsigned char *p, const struct stat *st);
+
 
 #endif
@@ -3,6 +3,7 @@
   stdenv,
   cmake,
   installShellFiles,
+  zlib,
   ...
 }:
 let
@@ -22,6 +23,10 @@ stdenv.mkDerivation {
     installShellFiles
   ];
 
+  buildInputs = [
+    zlib
+  ];
+
   cmakeFlags = [
     "-DENABLE_ASAN=on"
     "-DCMAKE_BUILD_TYPE=Debug"
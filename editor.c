@@ -11,6 +11,7 @@
 #include "core.h"
 #include "editor.h"
 #include "term.h"
+#include "view.h"
 
 /*
  * Global editor instance
@@ -30,6 +31,13 @@ struct editor editor = {
 	.bufcount = 0,
 	.curbuf   = 0,
 	.bufcap   = 0,
+	.sync     = SYNC_DATA,
+	.incremental = 0,
+	.viewer   = 0,
+	.viewmem  = VIEW_LIMIT_DEFAULT,
+	.linecache = 1,
+	.hex      = 0,
+	.follow   = 0,
 };
 
 
@@ -85,14 +93,7 @@ reset_editor(void)
 		return;
 	}
 
-	if (b->row) {
-		for (size_t i = 0; i < b->nrows; i++) {
-			ab_free(&b->row[i]);
-		}
-		free(b->row);
-	}
-	b->row = NULL;
-	b->nrows = 0;
+	buffer_free_rows(b);
 	b->rowoffs = 0;
 	b->coloffs = 0;
 	b->rx = 0;
@@ -7,6 +7,7 @@
 
 #include "abuf.h"
 #include "buffer.h"
+#include "fileio.h"
 
 
 struct editor {
@@ -23,6 +24,13 @@ struct editor {
 	size_t		  bufcount; /* number of buffers */
 	size_t		  curbuf;   /* current buffer index */
 	size_t		  bufcap;   /* current buffer capacity */
+	sync_policy	  sync;     /* how hard saves push data to disk */
+	int		  incremental; /* save big files from the first change */
+	int		  viewer;   /* open files read-only, a window at a time */
+	size_t		  viewmem;  /* memory limit for each view */
+	int		  linecache; /* keep line indexes of big files */
+	int		  hex;      /* open files in hex mode */
+	int		  follow;   /* follow files named on the command line */
 };
 
 
@@ -0,0 +1,848 @@
+/*
+ * fileio.c - writing buffers out to files
+ *
+ * Rows are handed to the kernel directly with writev(2) rather than
+ * being joined into one big buffer first, so saving doesn't need a
+ * second copy of the file in memory.
+ *
+ * Saves are atomic where possible: the rows are written to a new file
+ * in the same directory, synced, and renamed over the original, so a
+ * crash or a full disk leaves either the old file or the new one.
+ *
+ * When only the end of a big file has changed, rewriting all of it is
+ * most of the cost of a save. If incremental saves are asked for and
+ * the file is still the one the rows were read from, only the rows from
+ * the first one that differs are written, in place, and the file is
+ * cut to its new length. That is only done when few of the rows after
+ * it change place: each of those has to be copied out of the mapping
+ * before the write, so an edit near the start of a huge file is saved
+ * atomically instead.
+ *
+ * Buffers read from a compressed file are compressed again as they
+ * are written. That takes long enough on a big file that such saves
+ * run on a worker thread while the buffer is locked against edits.
+ */
+#ifdef __linux__
+#define	_GNU_SOURCE		/* O_TMPFILE */
+#endif
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "compress.h"
+#include "core.h"
+#include "fileio.h"
+
+#ifndef IOV_MAX
+#define	IOV_MAX		1024
+#endif
+
+#define	INCREMENTAL_MIN	(1UL << 20)	/* unchanged bytes worth keeping */
+#define	INCREMENTAL_MOVE	(8UL << 20)	/* most bytes copied to save in place */
+#define	ZSTAGE		(1UL << 20)	/* rows gathered per compressor call */
+
+
+/*
+ * A saver runs fileio_save on a worker thread. The buffer is refused
+ * edits until the UI thread collects the result.
+ */
+struct saver {
+	pthread_t	 thread;
+	pthread_mutex_t	 lock;
+	char		*path;
+	buffer		*b;
+	sync_policy	 policy;
+	int		 incremental;
+	fileio_stats	 stats;
+	int		 rv;
+	int		 err;
+	int		 done;		/* guarded by lock */
+};
+
+
+static char	 newline[] = "\n";
+
+
+/*
+ * flush_iov writes out n iovecs, picking up after short writes.
+ */
+static int
+flush_iov(const int fd, struct iovec *iov, int n, size_t *written)
+{
+	ssize_t	 nw = 0;
+
+	while (n > 0) {
+		nw = writev(fd, iov, n);
+		if (nw == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		*written += (size_t)nw;
+		while (n > 0 && (size_t)nw >= iov->iov_len) {
+			nw -= (ssize_t)iov->iov_len;
+			iov++;
+			n--;
+		}
+
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + nw;
+			iov->iov_len -= (size_t)nw;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * push_iov adds a span to the batch, merging it into the previous
+ * iovec when the two are adjacent in memory. Unedited rows of a
+ * mapped file usually are, so they go out as a few large iovecs.
+ */
+static void
+push_iov(struct iovec *iov, int *n, char *base, const size_t len)
+{
+	struct iovec	*last = NULL;
+
+	if (len == 0) {
+		return;
+	}
+
+	if (*n > 0) {
+		last = &iov[*n - 1];
+		if ((char *)last->iov_base + last->iov_len == base) {
+			last->iov_len += len;
+			return;
+		}
+	}
+
+	iov[*n].iov_base = base;
+	iov[*n].iov_len  = len;
+	(*n)++;
+}
+
+
+/*
+ * fileio_write_rows writes the rows of b from first on to fd, each
+ * followed by a newline, in batches of at most IOV_MAX iovecs. The
+ * number of bytes written is stored in written even if the write
+ * fails.
+ */
+int
+fileio_write_rows(const int fd, const buffer *b, const size_t first,
+    size_t *written)
+{
+	struct iovec	 iov[IOV_MAX];
+	const abuf	*row = NULL;
+	const char	*end = NULL;
+	int		 n   = 0;
+	size_t		 run = 0;
+	size_t		 i   = 0;
+	size_t		 j   = 0;
+
+	if (b->map != NULL) {
+		end = b->map + b->maplen;
+	}
+
+	*written = 0;
+	for (i = first; i < b->nrows; i += run) {
+		row = buffer_rows_at(b, i, &run);
+		for (j = 0; j < run; j++, row++) {
+			/*
+			 * A row borrowed from the mapping that is followed by
+			 * its own newline can be written along with it.
+			 */
+			if (end != NULL && ab_borrowed(row) &&
+			    row->b >= b->map && row->b + row->size < end &&
+			    row->b[row->size] == '\n') {
+				push_iov(iov, &n, row->b, row->size + 1);
+			} else {
+				push_iov(iov, &n, row->b, row->size);
+				push_iov(iov, &n, newline, 1);
+			}
+
+			if (n >= IOV_MAX - 1) {
+				if (flush_iov(fd, iov, n, written) == -1) {
+					return -1;
+				}
+				n = 0;
+			}
+		}
+	}
+
+	return flush_iov(fd, iov, n, written);
+}
+
+
+/*
+ * write_compressed writes all the rows through a compressor, gathered
+ * into large blocks so it isn't called once per line. written is the
+ * size of the compressed output.
+ */
+static int
+write_compressed(const int fd, const buffer *b, fileio_stats *stats)
+{
+	zwriter		*zw   = NULL;
+	char		*blk  = NULL;
+	const abuf	*row  = NULL;
+	size_t		 used = 0;
+	size_t		 run  = 0;
+	size_t		 i    = 0;
+	size_t		 j    = 0;
+	int		 err  = 0;
+
+	zw = zwrite_open(fd, b->compress);
+	if (zw == NULL) {
+		return -1;
+	}
+
+	blk = malloc(ZSTAGE);
+	if (blk == NULL) {
+		goto compressed_fail;
+	}
+
+	for (i = 0; i < b->nrows; i += run) {
+		row = buffer_rows_at(b, i, &run);
+		for (j = 0; j < run; j++, row++) {
+			if (used + row->size + 1 > ZSTAGE) {
+				if (zwrite(zw, blk, used) == -1) {
+					goto compressed_fail;
+				}
+				stats->raw += used;
+				used = 0;
+			}
+
+			if (row->size + 1 > ZSTAGE) {
+				if (zwrite(zw, row->b, row->size) == -1 ||
+				    zwrite(zw, newline, 1) == -1) {
+					goto compressed_fail;
+				}
+				stats->raw += row->size + 1;
+				continue;
+			}
+
+			memcpy(blk + used, row->b, row->size);
+			used += row->size;
+			blk[used++] = '\n';
+		}
+	}
+
+	if (zwrite(zw, blk, used) == -1) {
+		goto compressed_fail;
+	}
+	stats->raw += used;
+	free(blk);
+
+	return zwrite_close(zw, &stats->written);
+
+compressed_fail:
+	err = errno;
+	free(blk);
+	(void)zwrite_close(zw, &stats->written);
+	errno = err;
+	return -1;
+}
+
+
+/*
+ * write_rows writes the buffer from row first on, compressed if the
+ * file it came from was.
+ */
+static int
+write_rows(const int fd, const buffer *b, const size_t first,
+    fileio_stats *stats)
+{
+	if (b->compress != COMPRESS_NONE) {
+		return write_compressed(fd, b, stats);
+	}
+
+	if (fileio_write_rows(fd, b, first, &stats->written) == -1) {
+		return -1;
+	}
+
+	stats->raw = stats->written;
+	return 0;
+}
+
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec	 now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) * 1000.0 +
+	    (double)(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+/*
+ * sync_fd flushes fd according to the sync policy, adding the time it
+ * took to the save stats.
+ */
+static int
+sync_fd(const int fd, const sync_policy policy, fileio_stats *stats)
+{
+	struct timespec	 start;
+	int		 rv = 0;
+
+	if (policy == SYNC_NONE) {
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (policy == SYNC_DATA) {
+		rv = fdatasync(fd);
+	} else {
+		rv = fsync(fd);
+	}
+	stats->sync_ms += elapsed_ms(&start);
+
+	return rv;
+}
+
+
+static int
+sync_dir(const char *dir, const sync_policy policy, fileio_stats *stats)
+{
+	int	 fd = -1;
+	int	 rv = 0;
+
+	if (policy == SYNC_NONE) {
+		return 0;
+	}
+
+	fd = open(dir, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	/* directories can only be fsync'd as a whole */
+	rv = sync_fd(fd, SYNC_FULL, stats);
+	close(fd);
+	return rv;
+}
+
+
+/*
+ * unchanged reports whether st is still the file the buffer's rows
+ * were mapped from.
+ */
+static int
+unchanged(const buffer *b, const struct stat *st)
+{
+	return b->map != NULL && S_ISREG(st->st_mode) &&
+	    (size_t)st->st_size == b->maplen && kstat_same(st, &b->mapst, 1);
+}
+
+
+/*
+ * save_inplace rewrites the file in place, starting at the first row
+ * that isn't already there if the file hasn't changed since it was
+ * read. Borrowed rows that would move are copied first so the write
+ * doesn't clobber them.
+ */
+static int
+save_inplace(const char *path, buffer *b, const sync_policy policy,
+    fileio_stats *stats)
+{
+	struct stat	 st;
+	size_t		 first = 0;
+	size_t		 off   = 0;
+	int		 fd    = -1;
+	int		 rv    = -1;
+	int		 err   = 0;
+
+	/* read access lets the saved file be mapped back in */
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1 && errno == EACCES) {
+		fd = open(path, O_WRONLY | O_CREAT, 0644);
+	}
+
+	if (fd == -1) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) == 0 && unchanged(b, &st)) {
+		first = buffer_clean_rows(b, &off);
+	}
+	buffer_own_moved(b);
+
+	if ((off == 0 || lseek(fd, (off_t)off, SEEK_SET) != (off_t)-1) &&
+	    write_rows(fd, b, first, stats) == 0 &&
+	    ftruncate(fd, (off_t)(off + stats->written)) == 0 &&
+	    sync_fd(fd, policy, stats) == 0) {
+		stats->size = off + stats->written;
+		if (b->compress == COMPRESS_NONE) {
+			buffer_rebase(b, fd);
+		}
+		rv = 0;
+	}
+
+	err = errno;
+	close(fd);
+	errno = err;
+	return rv;
+}
+
+
+/*
+ * open_temp creates an unnamed file in dir with O_TMPFILE, if unnamed
+ * is set and the kernel and filesystem support it, and otherwise a
+ * hidden temporary next to the file. name is left empty for an
+ * unnamed file.
+ */
+static int
+open_temp(const char *dir, const char *base, char *name, const size_t namesz,
+    const int unnamed)
+{
+	int	 fd = -1;
+
+	name[0] = '\0';
+
+#ifdef O_TMPFILE
+	if (unnamed) {
+		fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+		if (fd != -1) {
+			return fd;
+		}
+	}
+#else
+	(void)unnamed;
+#endif
+
+	if ((size_t)snprintf(name, namesz, "%s/.%s.ke-XXXXXX", dir, base) >=
+	    namesz) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return mkstemp(name);
+}
+
+
+/*
+ * link_temp gives an unnamed temp file a name so it can be renamed
+ * over the target; linkat(2) can't replace an existing file.
+ */
+static int
+link_temp(const int fd, const char *dir, const char *base, char *name,
+    const size_t namesz)
+{
+#ifdef O_TMPFILE
+	char	 proc[64];
+	int	 tries = 0;
+
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	for (tries = 0; tries < 16; tries++) {
+		if ((size_t)snprintf(name, namesz, "%s/.%s.ke-%ld-%d", dir,
+		    base, (long)getpid(), tries) >= namesz) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		if (linkat(AT_FDCWD, proc, AT_FDCWD, name,
+		    AT_SYMLINK_FOLLOW) == 0) {
+			return 0;
+		}
+
+		if (errno != EEXIST) {
+			break;
+		}
+	}
+
+	name[0] = '\0';
+	return -1;
+#else
+	(void)fd;
+	(void)dir;
+	(void)base;
+	(void)name;
+	(void)namesz;
+
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/*
+ * write_temp writes the buffer to a temp file in dir and renames it
+ * over path. It returns 1 if the temp file couldn't be created at all,
+ * and 2 if it was unnamed and couldn't be given a name, which needs
+ * linkat(2) through /proc; nothing is left behind either way.
+ */
+static int
+write_temp(const char *path, const char *dir, const char *base, buffer *b,
+    const struct stat *orig, const sync_policy policy, fileio_stats *stats,
+    const int unnamed)
+{
+	char		 tmp[PATH_MAX];
+	mode_t		 mask  = 0;
+	int		 fd    = -1;
+	int		 err   = 0;
+
+	fd = open_temp(dir, base, tmp, sizeof(tmp), unnamed);
+	if (fd == -1) {
+		return 1;
+	}
+
+	if (orig != NULL) {
+		/* best effort: only root can give the file away */
+		if (fchown(fd, orig->st_uid, orig->st_gid) == -1) {
+			(void)fchown(fd, (uid_t)-1, orig->st_gid);
+		}
+		if (fchmod(fd, orig->st_mode & 07777) == -1) {
+			goto atomic_fail;
+		}
+	} else {
+		mask = umask(0);
+		umask(mask);
+		if (fchmod(fd, 0644 & ~mask) == -1) {
+			goto atomic_fail;
+		}
+	}
+
+	if (write_rows(fd, b, 0, stats) == -1) {
+		goto atomic_fail;
+	}
+
+	if (sync_fd(fd, policy, stats) == -1) {
+		goto atomic_fail;
+	}
+
+	if (tmp[0] == '\0' &&
+	    link_temp(fd, dir, base, tmp, sizeof(tmp)) == -1) {
+		close(fd);
+		return 2;
+	}
+
+	if (rename(tmp, path) == -1) {
+		goto atomic_fail;
+	}
+
+	stats->size   = stats->written;
+	stats->atomic = 1;
+	if (b->compress == COMPRESS_NONE) {
+		buffer_rebase(b, fd);
+	}
+	close(fd);
+
+	/* a failed directory sync doesn't undo the rename */
+	(void)sync_dir(dir, policy, stats);
+	return 0;
+
+atomic_fail:
+	err = errno;
+	if (tmp[0] != '\0') {
+		unlink(tmp);
+	}
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+
+/*
+ * save_atomic writes the buffer to a temp file in the target's
+ * directory and renames it into place. It returns 1 if the temp file
+ * couldn't be created at all, so the caller can fall back to writing
+ * in place.
+ */
+static int
+save_atomic(const char *path, buffer *b, const struct stat *orig,
+    const sync_policy policy, fileio_stats *stats)
+{
+	char		 dir[PATH_MAX];
+	const char	*slash = NULL;
+	const char	*base  = NULL;
+	size_t		 dlen  = 0;
+	int		 rv    = 0;
+
+	slash = strrchr(path, '/');
+	if (slash == NULL) {
+		base = path;
+		strcpy(dir, ".");
+	} else {
+		base = slash + 1;
+		dlen = (size_t)(slash - path);
+		if (dlen >= sizeof(dir)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		memcpy(dir, path, dlen);
+		dir[dlen] = '\0';
+		if (dlen == 0) {
+			strcpy(dir, "/");
+		}
+	}
+
+	rv = write_temp(path, dir, base, b, orig, policy, stats, 1);
+	if (rv == 2) {
+		/* no /proc to link through, as in a chroot: use a named file */
+		stats->written = 0;
+		stats->raw     = 0;
+		rv = write_temp(path, dir, base, b, orig, policy, stats, 0);
+	}
+
+	return rv;
+}
+
+
+/*
+ * save_path writes the buffer to path, atomically if it can. Files
+ * with more than one link, and anything that isn't a regular file,
+ * are written in place so the other names (or the device) see the
+ * new contents; so are files in directories we can't create the temp
+ * file in. With incremental set, so are files that start with at least
+ * INCREMENTAL_MIN bytes the save would leave alone, as long as no more
+ * than INCREMENTAL_MOVE bytes after them would move. A symlink is
+ * followed and its target replaced.
+ */
+static int
+save_path(const char *path, buffer *b, const sync_policy policy,
+    const int incremental, fileio_stats *stats)
+{
+	char		 real[PATH_MAX];
+	struct stat	 st;
+	size_t		 off    = 0;
+	int		 exists = 0;
+	int		 rv     = 0;
+
+	if (lstat(path, &st) == 0) {
+		if (S_ISLNK(st.st_mode)) {
+			if (realpath(path, real) == NULL) {
+				return -1;
+			}
+			path = real;
+			exists = (stat(path, &st) == 0);
+		} else {
+			exists = 1;
+		}
+	} else if (errno != ENOENT) {
+		return -1;
+	}
+
+	if (exists && (!S_ISREG(st.st_mode) || st.st_nlink > 1)) {
+		return save_inplace(path, b, policy, stats);
+	}
+
+	if (incremental && exists && b->compress == COMPRESS_NONE &&
+	    unchanged(b, &st)) {
+		(void)buffer_clean_rows(b, &off);
+		if (off >= INCREMENTAL_MIN &&
+		    buffer_moved_bytes(b) <= INCREMENTAL_MOVE) {
+			return save_inplace(path, b, policy, stats);
+		}
+	}
+
+	rv = save_atomic(path, b, exists ? &st : NULL, policy, stats);
+	if (rv == 1) {
+		memset(stats, 0, sizeof(*stats));
+		return save_inplace(path, b, policy, stats);
+	}
+
+	return rv;
+}
+
+
+int
+fileio_save(const char *path, buffer *b, const sync_policy policy,
+    const int incremental, fileio_stats *stats)
+{
+	struct timespec	 start;
+	int		 rv = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	buffer_index_all(b);
+
+	rv = save_path(path, b, policy, incremental, stats);
+	stats->ms = elapsed_ms(&start);
+	return rv;
+}
+
+
+/*
+ * fileio_patch writes len bytes from buf at off in the file at path,
+ * creating it if need be, and sets its length to size. The rest of the
+ * file is left as it is. This is how bytes overwritten in hex mode are
+ * saved; it is never atomic.
+ */
+int
+fileio_patch(const char *path, const char *buf, size_t len, size_t off,
+    const size_t size, const sync_policy policy, fileio_stats *stats)
+{
+	struct timespec	 start;
+	struct stat	 st;
+	ssize_t		 nw  = 0;
+	int		 fd  = -1;
+	int		 rv  = -1;
+	int		 err = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd == -1) {
+		return -1;
+	}
+
+	while (len > 0) {
+		nw = pwrite(fd, buf, len, (off_t)off);
+		if (nw == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			goto patch_done;
+		}
+
+		buf            += nw;
+		len            -= (size_t)nw;
+		off            += (size_t)nw;
+		stats->written += (size_t)nw;
+	}
+
+	if (fstat(fd, &st) == -1 || ((size_t)st.st_size != size &&
+	    ftruncate(fd, (off_t)size) == -1)) {
+		goto patch_done;
+	}
+
+	if (sync_fd(fd, policy, stats) == 0) {
+		stats->size = size;
+		stats->raw  = stats->written;
+		rv = 0;
+	}
+
+patch_done:
+	err = errno;
+	close(fd);
+	stats->ms = elapsed_ms(&start);
+	errno = err;
+	return rv;
+}
+
+
+static void *
+save_run(void *arg)
+{
+	struct saver	*sv = arg;
+
+	sv->rv  = fileio_save(sv->path, sv->b, sv->policy, sv->incremental,
+	    &sv->stats);
+	sv->err = errno;
+
+	pthread_mutex_lock(&sv->lock);
+	sv->done = 1;
+	pthread_mutex_unlock(&sv->lock);
+	return NULL;
+}
+
+
+/*
+ * fileio_save_async starts saving b to path on a worker thread. The
+ * caller must not change the buffer until fileio_save_finish has
+ * collected the result.
+ */
+int
+fileio_save_async(const char *path, buffer *b, const sync_policy policy,
+    const int incremental)
+{
+	struct saver	*sv = NULL;
+
+	if (b->saver != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	sv = calloc(1, sizeof(*sv));
+	if (sv == NULL) {
+		return -1;
+	}
+
+	sv->path = strdup(path);
+	if (sv->path == NULL) {
+		free(sv);
+		return -1;
+	}
+
+	sv->b           = b;
+	sv->policy      = policy;
+	sv->incremental = incremental;
+	pthread_mutex_init(&sv->lock, NULL);
+
+	/* the worker must only read the rows */
+	buffer_index_all(b);
+	if (pthread_create(&sv->thread, NULL, save_run, sv) != 0) {
+		pthread_mutex_destroy(&sv->lock);
+		free(sv->path);
+		free(sv);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	b->saver = sv;
+	return 0;
+}
+
+
+int
+fileio_saving(const buffer *b)
+{
+	return b->saver != NULL;
+}
+
+
+/*
+ * fileio_save_finish collects a save started by fileio_save_async,
+ * waiting for it if wait is set. It returns 0 if there is no save or
+ * it hasn't finished, 1 if it succeeded, and -1 (with errno set) if it
+ * failed.
+ */
+int
+fileio_save_finish(buffer *b, const int wait, fileio_stats *stats)
+{
+	struct saver	*sv   = b->saver;
+	int		 done = 0;
+	int		 rv   = 0;
+
+	if (sv == NULL) {
+		return 0;
+	}
+
+	if (!wait) {
+		pthread_mutex_lock(&sv->lock);
+		done = sv->done;
+		pthread_mutex_unlock(&sv->lock);
+		if (!done) {
+			return 0;
+		}
+	}
+
+	pthread_join(sv->thread, NULL);
+	pthread_mutex_destroy(&sv->lock);
+	*stats = sv->stats;
+	rv = (sv->rv == 0) ? 1 : -1;
+	errno = sv->err;
+
+	free(sv->path);
+	free(sv);
+	b->saver = NULL;
+	return rv;
+}
@@ -0,0 +1,41 @@
+/*
+ * fileio.h - writing buffers out to files
+ */
+#ifndef KE_FILEIO_H
+#define KE_FILEIO_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+
+typedef enum sync_policy {
+	SYNC_NONE = 0,		/* leave it to the kernel */
+	SYNC_DATA = 1,		/* fdatasync the file, fsync the directory */
+	SYNC_FULL = 2,		/* fsync the file and the directory */
+} sync_policy;
+
+
+typedef struct fileio_stats {
+	size_t	 written;
+	size_t	 size;		/* length of the file after the save */
+	size_t	 raw;		/* bytes before compression */
+	double	 sync_ms;	/* time spent in fsync/fdatasync */
+	double	 ms;		/* time the whole save took */
+	int	 atomic;	/* was the file replaced atomically? */
+} fileio_stats;
+
+
+int	 fileio_write_rows(int fd, const buffer *b, size_t first,
+	    size_t *written);
+int	 fileio_save(const char *path, buffer *b, sync_policy policy,
+	    int incremental, fileio_stats *stats);
+int	 fileio_patch(const char *path, const char *buf, size_t len,
+	    size_t off, size_t size, sync_policy policy, fileio_stats *stats);
+int	 fileio_save_async(const char *path, buffer *b, sync_policy policy,
+	    int incremental);
+int	 fileio_saving(const buffer *b);
+int	 fileio_save_finish(buffer *b, int wait, fileio_stats *stats);
+
+
+#endif
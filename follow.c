@@ -0,0 +1,309 @@
+/*
+ * follow.c - keeping a buffer attached to a growing file
+ *
+ * A followed file is read from where the buffer's contents end, so a
+ * log that grows by a line costs a line, however big it is. On Linux
+ * the file and its directory are watched with inotify and nothing is
+ * read until something happens to one of them; elsewhere the file is
+ * checked with fstat(2) each time the editor is idle.
+ *
+ * When the file gets shorter it was truncated, and when its name
+ * leads to a different file it was rotated; either way the caller is
+ * told to load it again from the start.
+ */
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "follow.h"
+#include "scan.h"
+
+
+#define	FOLLOW_BLOCK	65536		/* read size */
+#define	FOLLOW_LINES	1024		/* rows split out per scan */
+#define	FOLLOW_MAX	(16UL << 20)	/* bytes read per poll */
+
+
+struct follow {
+	char		*path;
+	int		 fd;
+	size_t		 off;		/* bytes of the file in the buffer */
+	int		 partial;	/* the last row has no newline yet */
+	int		 more;		/* the last poll stopped at FOLLOW_MAX */
+	int		 ifd;		/* inotify descriptor, or -1 */
+	char		*blk;
+};
+
+
+#ifdef __linux__
+/*
+ * watch sets up inotify on the file, for appends and truncation, and
+ * on its directory, for a new file taking its name.
+ */
+static void
+watch(struct follow *f)
+{
+	char	 dir[PATH_MAX];
+	char	*slash = NULL;
+
+	f->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (f->ifd == -1) {
+		return;
+	}
+
+	if (strlen(f->path) >= sizeof(dir)) {
+		goto watch_fail;
+	}
+	strcpy(dir, f->path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+	} else if (slash == dir) {
+		dir[1] = '\0';
+	} else {
+		*slash = '\0';
+	}
+
+	if (inotify_add_watch(f->ifd, f->path, IN_MODIFY | IN_ATTRIB |
+	    IN_MOVE_SELF | IN_DELETE_SELF) == -1 ||
+	    inotify_add_watch(f->ifd, dir, IN_CREATE | IN_MOVED_TO) == -1) {
+		goto watch_fail;
+	}
+	return;
+
+watch_fail:
+	close(f->ifd);
+	f->ifd = -1;
+}
+
+
+/*
+ * changed empties the inotify queue, returning 1 if there was anything
+ * in it.
+ */
+static int
+changed(struct follow *f)
+{
+	char	 ev[4096];
+	int	 any = 0;
+
+	while (read(f->ifd, ev, sizeof(ev)) > 0) {
+		any = 1;
+	}
+
+	return any;
+}
+#else
+static void
+watch(struct follow *f)
+{
+	f->ifd = -1;
+}
+
+
+static int
+changed(struct follow *f)
+{
+	(void)f;
+	return 1;
+}
+#endif
+
+
+/*
+ * follow_start follows b's file from off, the number of its bytes the
+ * buffer already holds, reading through fd, which it takes over.
+ */
+int
+follow_start(buffer *b, const int fd, const size_t off)
+{
+	struct follow	*f = NULL;
+
+	if (b->follow != NULL || b->filename == NULL) {
+		return -1;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL) {
+		return -1;
+	}
+
+	f->path = strdup(b->filename);
+	f->blk  = malloc(FOLLOW_BLOCK);
+	if (f->path == NULL || f->blk == NULL) {
+		free(f->path);
+		free(f->blk);
+		free(f);
+		return -1;
+	}
+
+	f->fd  = fd;
+	f->off = off;
+
+	/* a last line without its newline is finished by what comes next */
+	f->partial = (b->nrows > 0 && off > 0 && b->map != NULL &&
+	    off == b->maplen && b->map[off - 1] != '\n');
+
+	watch(f);
+	b->follow = f;
+	return 0;
+}
+
+
+void
+follow_stop(buffer *b)
+{
+	struct follow	*f = b->follow;
+
+	if (f == NULL) {
+		return;
+	}
+
+	if (f->ifd != -1) {
+		close(f->ifd);
+	}
+
+	close(f->fd);
+	free(f->path);
+	free(f->blk);
+	free(f);
+	b->follow = NULL;
+}
+
+
+int
+follow_active(const buffer *b)
+{
+	return b != NULL && b->follow != NULL;
+}
+
+
+/*
+ * append adds newly read bytes to the buffer: first to the end of a
+ * last row still waiting for its newline, then as new rows.
+ */
+static void
+append(buffer *b, struct follow *f, const char *buf, const size_t len)
+{
+	line_span	 lines[FOLLOW_LINES];
+	abuf		*row   = NULL;
+	abuf		 line;
+	const char	*nl    = NULL;
+	size_t		 start = 0;
+	size_t		 used  = 0;
+	size_t		 n     = 0;
+	size_t		 i     = 0;
+
+	if (f->partial && b->nrows > 0) {
+		buffer_gap_close(b);
+		row = buffer_row(b, b->nrows - 1);
+		nl  = memchr(buf, '\n', len);
+		n   = (nl == NULL) ? len : (size_t)(nl - buf);
+		used = row->size;
+		ab_append(row, buf, n);
+		if (nl != NULL) {
+			while (row->size > 0 && row->b[row->size - 1] == '\r') {
+				row->size--;
+			}
+		}
+		buffer_row_resized(b, b->nrows - 1, used);
+		if (nl == NULL) {
+			return;
+		}
+		start = n + 1;
+	}
+
+	while (start < len) {
+		n = scan_lines(buf + start, len - start, 1, lines,
+		    FOLLOW_LINES, &used);
+		for (i = 0; i < n; i++) {
+			buffer_copy_row(b, &line, buf + start + lines[i].off,
+			    lines[i].len);
+			buffer_insert_rows(b, b->nrows, &line, 1);
+		}
+		start += used;
+	}
+
+	f->partial = (buf[len - 1] != '\n');
+}
+
+
+/*
+ * replaced reports whether the file's name now leads to a different
+ * file than the one being read.
+ */
+static int
+replaced(const struct follow *f)
+{
+	struct stat	 cur;
+	struct stat	 st;
+
+	if (stat(f->path, &st) == -1 || fstat(f->fd, &cur) == -1) {
+		/* gone for now; keep reading what is left of it */
+		return 0;
+	}
+
+	return st.st_dev != cur.st_dev || st.st_ino != cur.st_ino;
+}
+
+
+/*
+ * follow_poll reads whatever has been appended to the file since the
+ * last call. It doesn't touch the buffer while it is still being
+ * loaded.
+ */
+int
+follow_poll(buffer *b)
+{
+	struct follow	*f    = b->follow;
+	struct stat	 st;
+	size_t		 got  = 0;
+	ssize_t		 nr   = 0;
+
+	if (f == NULL || buffer_loading(b)) {
+		return FOLLOW_IDLE;
+	}
+
+	if (!f->more && f->ifd != -1 && !changed(f)) {
+		return FOLLOW_IDLE;
+	}
+
+	if (fstat(f->fd, &st) == 0 && (size_t)st.st_size < f->off) {
+		return FOLLOW_REOPEN;
+	}
+
+	f->more = 0;
+	while (got < FOLLOW_MAX) {
+		nr = pread(f->fd, f->blk, FOLLOW_BLOCK, (off_t)f->off);
+		if (nr == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if (nr <= 0) {
+			break;
+		}
+
+		append(b, f, f->blk, (size_t)nr);
+		f->off += (size_t)nr;
+		got    += (size_t)nr;
+	}
+
+	if (got >= FOLLOW_MAX) {
+		f->more = 1;
+	} else if (replaced(f)) {
+		/* everything written to the old file has been read */
+		return FOLLOW_REOPEN;
+	}
+
+	return got > 0 ? FOLLOW_GREW : FOLLOW_IDLE;
+}
@@ -0,0 +1,28 @@
+/*
+ * follow.h - keeping a buffer attached to a growing file
+ */
+#ifndef KE_FOLLOW_H
+#define KE_FOLLOW_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+
+#define	FOLLOW_IDLE	0	/* nothing new */
+#define	FOLLOW_GREW	1	/* rows were added or the last one grew */
+#define	FOLLOW_REOPEN	2	/* the file was truncated or replaced */
+
+
+/*
+ * A followed buffer reads only the bytes appended to its file since
+ * it was loaded, adding them as rows. The buffer is read-only while it
+ * is followed.
+ */
+int		 follow_start(buffer *b, int fd, size_t off);
+void		 follow_stop(buffer *b);
+int		 follow_poll(buffer *b);
+int		 follow_active(const buffer *b);
+
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * guard.c - surviving a mapped file being cut short
+ *
+ * Rows of a file that was mapped are read straight out of the mapping,
+ * and so are the pages of a file in hex mode that haven't been changed.
+ * If another program truncates the file, touching a page past its new
+ * end raises SIGBUS, which used to take the editor and every unsaved
+ * change down with it.
+ *
+ * Mappings of files are registered here instead, and a SIGBUS inside
+ * one is handled by mapping a page of zeros over the page that faulted,
+ * with the mapping's protection, and going on. What was in that part of
+ * the file is gone either way; the zeros just show it, and what the
+ * buffer holds of its own can still be saved. A fault anywhere else is
+ * handed to the handler that was there before.
+ */
+#include <sys/mman.h>
+
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "guard.h"
+
+
+#define	GUARD_SLOTS	64		/* mappings watched at once */
+
+
+/*
+ * The handler can run on any thread at any moment, so a slot is
+ * filled in before its base is set and emptied by clearing the base.
+ */
+struct slot {
+	const char *volatile	 base;
+	volatile size_t		 len;
+	volatile int		 prot;
+};
+
+
+static struct slot		 slots[GUARD_SLOTS];
+static volatile sig_atomic_t	 tripped;
+static struct sigaction		 chained;
+static uintptr_t		 pagesz;
+
+
+static void
+fault(int sig, siginfo_t *si, void *ctx)
+{
+	uintptr_t	 a    = (uintptr_t)si->si_addr;
+	uintptr_t	 base = 0;
+	size_t		 i    = 0;
+
+	for (i = 0; i < GUARD_SLOTS; i++) {
+		base = (uintptr_t)slots[i].base;
+		if (base == 0 || a < base || a - base >= slots[i].len) {
+			continue;
+		}
+
+		if (mmap((void *)(a & ~(pagesz - 1)), (size_t)pagesz,
+		    slots[i].prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+		    -1, 0) != MAP_FAILED) {
+			tripped = 1;
+			return;
+		}
+		break;
+	}
+
+	if (chained.sa_flags & SA_SIGINFO) {
+		chained.sa_sigaction(sig, si, ctx);
+	} else if (chained.sa_handler != SIG_DFL &&
+	    chained.sa_handler != SIG_IGN) {
+		chained.sa_handler(sig);
+	} else {
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+}
+
+
+/*
+ * guard_init takes over SIGBUS, keeping whatever handler was set for
+ * faults that aren't in a registered mapping.
+ */
+void
+guard_init(void)
+{
+	struct sigaction	 sa;
+
+	pagesz = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = fault;
+	sa.sa_flags     = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, &chained);
+}
+
+
+/*
+ * guard_map registers the len bytes mapped at base with protection
+ * prot. Past GUARD_SLOTS mappings the rest go unguarded.
+ */
+void
+guard_map(const void *base, const size_t len, const int prot)
+{
+	size_t	 i = 0;
+
+	for (i = 0; i < GUARD_SLOTS; i++) {
+		if (slots[i].base == NULL) {
+			slots[i].len  = len;
+			slots[i].prot = prot;
+			slots[i].base = base;
+			return;
+		}
+	}
+}
+
+
+/* guard_unmap forgets the mapping at base; call it before munmap. */
+void
+guard_unmap(const void *base)
+{
+	size_t	 i = 0;
+
+	for (i = 0; i < GUARD_SLOTS; i++) {
+		if (slots[i].base == base) {
+			slots[i].base = NULL;
+			return;
+		}
+	}
+}
+
+
+/*
+ * guard_tripped reports whether a fault has been covered with zeros
+ * since it was last asked.
+ */
+int
+guard_tripped(void)
+{
+	int	 was = tripped;
+
+	tripped = 0;
+	return was;
+}
@@ -0,0 +1,16 @@
+/*
+ * guard.h - surviving a mapped file being cut short
+ */
+#ifndef KE_GUARD_H
+#define KE_GUARD_H
+
+#include <stddef.h>
+
+
+void		 guard_init(void);
+void		 guard_map(const void *base, size_t len, int prot);
+void		 guard_unmap(const void *base);
+int		 guard_tripped(void);
+
+
+#endif
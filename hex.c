@@ -0,0 +1,465 @@
+/*
+ * hex.c - hex view and byte overwrite for binary files
+ *
+ * Splitting a binary file into lines mangles it, and a file with no
+ * newlines at all becomes one enormous row. In hex mode the file is
+ * mapped privately as a flat run of bytes instead, and each screen
+ * line (offset, sixteen bytes in hex, the same bytes as text) is
+ * formatted from it as it is drawn, so a page costs the same at any
+ * file size. Edits overwrite bytes in the private mapping, and a save
+ * writes just the bytes that changed back into the file.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "core.h"
+#include "editor.h"
+#include "fileio.h"
+#include "guard.h"
+#include "hex.h"
+
+
+#define	CTRL_KEY(key)	((key)&0x1f)
+#define	HEX_WIDTH	16		/* bytes per line */
+#define	HEX_BLOCK	65536		/* read size for unmappable files */
+
+
+struct hex {
+	unsigned char	*data;
+	size_t		 len;
+	int		 mapped;
+	struct stat	 st;		/* the file as it was read or saved */
+	size_t		 cur;		/* byte under the cursor */
+	size_t		 top;		/* first line on screen */
+	int		 low;		/* cursor is on the low nibble */
+	int		 ascii;		/* cursor is in the text column */
+	size_t		 lo, hi;	/* bytes changed since the last save */
+};
+
+
+static const char	 digits[] = "0123456789abcdef";
+
+
+/*
+ * read_all reads a file that can't be mapped into memory.
+ */
+static int
+read_all(struct hex *h, const int fd)
+{
+	unsigned char	*p   = NULL;
+	size_t		 cap = 0;
+	ssize_t		 nr  = 0;
+
+	for (;;) {
+		if (cap - h->len < HEX_BLOCK) {
+			cap = cap ? cap * 2 : HEX_BLOCK;
+			p = realloc(h->data, cap);
+			if (p == NULL) {
+				return -1;
+			}
+			h->data = p;
+		}
+
+		nr = read(fd, h->data + h->len, cap - h->len);
+		if (nr == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		if (nr == 0) {
+			return 0;
+		}
+		h->len += (size_t)nr;
+	}
+}
+
+
+/*
+ * hex_open puts b in hex mode with the contents of fd. Regular files
+ * are mapped copy-on-write, so only the pages that are looked at are
+ * read and only the pages that are changed take memory.
+ */
+int
+hex_open(buffer *b, const int fd)
+{
+	struct hex	*h     = NULL;
+	void		*map   = NULL;
+	int		 flags = MAP_PRIVATE;
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL) {
+		return -1;
+	}
+
+	h->lo = SIZE_MAX;
+	if (fstat(fd, &h->st) == -1) {
+		free(h);
+		return -1;
+	}
+
+#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+#endif
+	if (S_ISREG(h->st.st_mode) && h->st.st_size > 0) {
+		map = mmap(NULL, (size_t)h->st.st_size, PROT_READ | PROT_WRITE,
+		    flags, fd, 0);
+		if (map != MAP_FAILED) {
+			h->data   = map;
+			h->len    = (size_t)h->st.st_size;
+			h->mapped = 1;
+			guard_map(map, h->len, PROT_READ | PROT_WRITE);
+		}
+	}
+
+	if (!h->mapped && read_all(h, fd) == -1) {
+		free(h->data);
+		free(h);
+		return -1;
+	}
+
+	b->hex = h;
+	return 0;
+}
+
+
+void
+hex_free(buffer *b)
+{
+	struct hex	*h = b->hex;
+
+	if (h == NULL) {
+		return;
+	}
+
+	if (h->mapped) {
+		guard_unmap(h->data);
+		munmap(h->data, h->len);
+	} else {
+		free(h->data);
+	}
+
+	free(h);
+	b->hex = NULL;
+}
+
+
+void
+hex_seek(buffer *b, size_t off)
+{
+	struct hex	*h = b->hex;
+
+	if (h->len == 0) {
+		off = 0;
+	} else if (off >= h->len) {
+		off = h->len - 1;
+	}
+
+	h->cur = off;
+	h->low = 0;
+}
+
+
+/*
+ * overwrite stores a byte typed at the cursor: a nibble in the hex
+ * column, a character in the text column.
+ */
+static void
+overwrite(buffer *b, const int16_t c)
+{
+	struct hex	*h = b->hex;
+	unsigned char	*p = NULL;
+	const char	*d = NULL;
+
+	if (b->readonly) {
+		editor_set_status("Buffer is read-only.");
+		return;
+	}
+
+	if (h->len == 0) {
+		editor_set_status("Can't add bytes in hex mode.");
+		return;
+	}
+
+	p = &h->data[h->cur];
+	if (h->ascii) {
+		*p = (unsigned char)c;
+	} else {
+		d = strchr(digits, tolower(c));
+		if (d == NULL) {
+			editor_set_status("Not a hex digit: %c", c);
+			return;
+		}
+
+		if (h->low) {
+			*p = (unsigned char)((*p & 0xf0) | (d - digits));
+		} else {
+			*p = (unsigned char)((*p & 0x0f) | ((d - digits) << 4));
+		}
+	}
+
+	if (h->cur < h->lo) {
+		h->lo = h->cur;
+	}
+	if (h->cur + 1 > h->hi) {
+		h->hi = h->cur + 1;
+	}
+	b->dirty++;
+
+	if (h->ascii || h->low) {
+		hex_seek(b, h->cur + 1);
+	} else {
+		h->low = 1;
+	}
+}
+
+
+/*
+ * hex_key handles a key typed in normal mode. It returns 0 for the
+ * keys that work the same in hex mode (C-k, ESC, C-l and C-g), and 1
+ * for everything it dealt with itself.
+ */
+int
+hex_key(buffer *b, const int16_t c, const size_t screen)
+{
+	struct hex	*h    = b->hex;
+	size_t		 page = screen * HEX_WIDTH;
+
+	switch (c) {
+	case CTRL_KEY('k'):
+	case ESC_KEY:
+	case CTRL_KEY('l'):
+	case CTRL_KEY('g'):
+		return 0;
+	case ARROW_LEFT:
+	case CTRL_KEY('b'):
+		if (h->low) {
+			h->low = 0;
+		} else if (h->cur > 0) {
+			hex_seek(b, h->cur - 1);
+		}
+		break;
+	case ARROW_RIGHT:
+	case CTRL_KEY('f'):
+		hex_seek(b, h->cur + 1);
+		break;
+	case ARROW_UP:
+	case CTRL_KEY('p'):
+		if (h->cur >= HEX_WIDTH) {
+			hex_seek(b, h->cur - HEX_WIDTH);
+		}
+		break;
+	case ARROW_DOWN:
+	case CTRL_KEY('n'):
+		if (h->cur + HEX_WIDTH < h->len) {
+			hex_seek(b, h->cur + HEX_WIDTH);
+		}
+		break;
+	case PG_UP:
+		hex_seek(b, h->cur > page ? h->cur - page : h->cur % HEX_WIDTH);
+		break;
+	case PG_DN:
+		if (h->cur + page < h->len) {
+			hex_seek(b, h->cur + page);
+		} else if (h->len > 0) {
+			/* the same column on the last line */
+			hex_seek(b, (h->len - 1) - (h->len - 1) % HEX_WIDTH +
+			    h->cur % HEX_WIDTH);
+		}
+		break;
+	case CTRL_KEY('a'):
+	case HOME_KEY:
+		hex_seek(b, h->cur - h->cur % HEX_WIDTH);
+		break;
+	case CTRL_KEY('e'):
+	case END_KEY:
+		hex_seek(b, h->cur - h->cur % HEX_WIDTH + HEX_WIDTH - 1);
+		break;
+	case TAB_KEY:
+		h->ascii = !h->ascii;
+		h->low   = 0;
+		break;
+	default:
+		if (c >= 0x20 && c < 0x7f) {
+			overwrite(b, c);
+		} else {
+			editor_set_status("Not in hex mode.");
+		}
+	}
+
+	return 1;
+}
+
+
+void
+hex_scroll(buffer *b, const size_t screen)
+{
+	struct hex	*h    = b->hex;
+	size_t		 line = h->cur / HEX_WIDTH;
+
+	if (line < h->top) {
+		h->top = line;
+	}
+
+	if (screen > 0 && line >= h->top + screen) {
+		h->top = line - screen + 1;
+	}
+}
+
+
+/*
+ * offset_width is the number of hex digits every offset is shown
+ * with: eight, or more for files past 4 GB.
+ */
+static int
+offset_width(const struct hex *h)
+{
+	int	 w = 8;
+
+	while (w < 16 && h->len > ((size_t)1 << (w * 4))) {
+		w++;
+	}
+
+	return w;
+}
+
+
+/*
+ * hex_draw formats the lines on screen straight from the bytes.
+ */
+void
+hex_draw(const buffer *b, abuf *ab, const size_t screen, const size_t cols)
+{
+	const struct hex	*h   = b->hex;
+	char			 line[128];
+	size_t			 off = 0;
+	size_t			 y   = 0;
+	size_t			 i   = 0;
+	size_t			 n   = 0;
+	int			 w   = offset_width(h);
+	int			 len = 0;
+	unsigned char		 c   = 0;
+
+	for (y = 0; y < screen; y++) {
+		off = (h->top + y) * HEX_WIDTH;
+		if (off >= h->len) {
+			ab_append(ab, "|", 1);
+			ab_append(ab, "\x1b[K\r\n", 5);
+			continue;
+		}
+
+		n = h->len - off;
+		if (n > HEX_WIDTH) {
+			n = HEX_WIDTH;
+		}
+
+		len = snprintf(line, sizeof(line), "%0*zx  ", w, off);
+		for (i = 0; i < HEX_WIDTH; i++) {
+			if (i < n) {
+				c = h->data[off + i];
+				line[len++] = digits[c >> 4];
+				line[len++] = digits[c & 0xf];
+			} else {
+				line[len++] = ' ';
+				line[len++] = ' ';
+			}
+			line[len++] = ' ';
+			if (i == HEX_WIDTH / 2 - 1) {
+				line[len++] = ' ';
+			}
+		}
+
+		line[len++] = ' ';
+		for (i = 0; i < n; i++) {
+			c = h->data[off + i];
+			line[len++] = (c >= 0x20 && c < 0x7f) ? (char)c : '.';
+		}
+
+		ab_append(ab, line, (size_t)len < cols ? (size_t)len : cols);
+		ab_append(ab, "\x1b[K\r\n", 5);
+	}
+}
+
+
+/*
+ * hex_cursor gives the screen position, from 0, of the byte under the
+ * cursor.
+ */
+void
+hex_cursor(const buffer *b, size_t *y, size_t *x)
+{
+	const struct hex	*h   = b->hex;
+	size_t			 col = h->cur % HEX_WIDTH;
+	size_t			 w   = (size_t)offset_width(h);
+
+	*y = h->cur / HEX_WIDTH - h->top;
+	if (h->ascii) {
+		*x = w + 2 + HEX_WIDTH * 3 + 2 + col;
+	} else {
+		*x = w + 2 + col * 3 + (col >= HEX_WIDTH / 2) + (size_t)h->low;
+	}
+}
+
+
+size_t
+hex_offset(const buffer *b)
+{
+	return b->hex->cur;
+}
+
+
+size_t
+hex_size(const buffer *b)
+{
+	return b->hex->len;
+}
+
+
+/*
+ * hex_save writes the changed bytes back into the file in place. If
+ * the file isn't the one that was read any more, all of it is written.
+ */
+int
+hex_save(buffer *b, const char *path, const sync_policy policy,
+    fileio_stats *stats)
+{
+	struct hex	*h  = b->hex;
+	struct stat	 st;
+	size_t		 lo = h->lo;
+	size_t		 hi = h->hi;
+
+	if (lo > hi) {
+		lo = 0;
+		hi = 0;
+	}
+
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_dev != h->st.st_dev || st.st_ino != h->st.st_ino ||
+	    (size_t)st.st_size != h->len || st.st_mtime != h->st.st_mtime) {
+		lo = 0;
+		hi = h->len;
+	}
+
+	if (fileio_patch(path, (const char *)h->data + lo, hi - lo, lo,
+	    h->len, policy, stats) == -1) {
+		return -1;
+	}
+
+	if (stat(path, &st) == 0) {
+		h->st = st;
+	}
+
+	h->lo = SIZE_MAX;
+	h->hi = 0;
+	return 0;
+}
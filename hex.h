@@ -0,0 +1,34 @@
+/*
+ * hex.h - hex view and byte overwrite for binary files
+ */
+#ifndef KE_HEX_H
+#define KE_HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "fileio.h"
+
+
+/*
+ * A buffer in hex mode has no rows: the file is kept as a flat run of
+ * bytes and each screen line is formatted from sixteen of them when
+ * it is drawn. Bytes can be overwritten but never inserted or deleted.
+ */
+int		 hex_open(buffer *b, int fd);
+void		 hex_free(buffer *b);
+int		 hex_key(buffer *b, int16_t c, size_t screen);
+void		 hex_seek(buffer *b, size_t off);
+void		 hex_scroll(buffer *b, size_t screen);
+void		 hex_draw(const buffer *b, abuf *ab, size_t screen,
+		    size_t cols);
+void		 hex_cursor(const buffer *b, size_t *y, size_t *x);
+size_t		 hex_offset(const buffer *b);
+size_t		 hex_size(const buffer *b);
+int		 hex_save(buffer *b, const char *path, sync_policy policy,
+		    fileio_stats *stats);
+
+
+#endif
@@ -0,0 +1,608 @@
+/*
+ * journal.c - crash recovery for unsaved edits
+ *
+ * Saving a big file after every few edits is too expensive to be a
+ * way of not losing them, so each edit is also appended to a journal
+ * as a small record: which row, which column, the bytes inserted or
+ * how many were deleted. A record costs the size of the edit, never
+ * the size of the file.
+ *
+ * Records collect in memory and are written when typing pauses, when
+ * a batch fills, or at least once a second; they are fdatasync'd at
+ * the same time. A crash loses at most the last batch.
+ *
+ * The journal starts with a header naming the file it applies to, as
+ * it was when the buffer was loaded or last saved: its device, inode,
+ * size and mtime to the nanosecond, so it is only replayed over that
+ * very version of the file. Every
+ * record carries a checksum, and replay stops at the first one that
+ * is cut short or doesn't fit the rows.
+ */
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "core.h"
+#include "editor.h"
+#include "journal.h"
+
+
+#define	JOURNAL_MAGIC	"KEJ2"
+#define	JOURNAL_HEADER	(4 + KSTAMP_LEN)	/* magic, the file's stamp */
+#define	JOURNAL_BATCH	65536		/* bytes of records held back */
+#define	JOURNAL_DELAY	1000		/* most ms between syncs */
+
+#define	J_ROW_INSERT	1		/* row, length, bytes */
+#define	J_ROW_DELETE	2		/* row */
+#define	J_INSERT	3		/* row, column, length, bytes */
+#define	J_DELETE	4		/* row, column, count */
+
+
+struct journal {
+	char		*path;
+	int		 fd;		/* -1 until the first edit */
+	int		 off;		/* journaling failed; don't retry */
+	abuf		 pend;		/* records not yet written */
+	int		 unsynced;	/* written but not yet synced */
+	struct timespec	 synced;	/* when it was last synced */
+	struct stat	 st;		/* the file the edits apply to */
+};
+
+
+static double
+since_ms(const struct timespec *then)
+{
+	struct timespec	 now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - then->tv_sec) * 1000.0 +
+	    (double)(now.tv_nsec - then->tv_nsec) / 1000000.0;
+}
+
+
+/*
+ * journal_path names the journal for a file: .name.ke-journal in the
+ * same directory.
+ */
+static char *
+journal_path(const char *file)
+{
+	const char	*slash = strrchr(file, '/');
+	char		*path  = NULL;
+	size_t		 dlen  = 0;
+	size_t		 size  = 0;
+
+	dlen = (slash == NULL) ? 0 : (size_t)(slash - file) + 1;
+	size = strlen(file) + sizeof(".ke-journal") + 1;
+	path = malloc(size);
+	if (path == NULL) {
+		return NULL;
+	}
+
+	snprintf(path, size, "%.*s.%s.ke-journal", (int)dlen, file,
+	    file + dlen);
+	return path;
+}
+
+
+/*
+ * header records which file the journal applies to; a file that
+ * doesn't exist yet is all zeroes.
+ */
+static void
+header(abuf *ab, const struct stat *st)
+{
+	ab_append(ab, JOURNAL_MAGIC, 4);
+	put_stamp(ab, st);
+}
+
+
+static struct journal *
+journal_get(buffer *b)
+{
+	struct journal	*j = b->journal;
+
+	if (j != NULL || b->filename == NULL) {
+		return j;
+	}
+
+	j = calloc(1, sizeof(*j));
+	if (j == NULL) {
+		return NULL;
+	}
+
+	j->path = journal_path(b->filename);
+	if (j->path == NULL) {
+		free(j);
+		return NULL;
+	}
+
+	j->fd = -1;
+	ab_init(&j->pend);
+	clock_gettime(CLOCK_MONOTONIC, &j->synced);
+	b->journal = j;
+	return j;
+}
+
+
+/*
+ * stop gives up on journaling a buffer after an error, so editing
+ * carries on without it.
+ */
+static void
+stop(struct journal *j, const char *what)
+{
+	editor_set_status("Journal %s: %s; edits aren't being journaled.",
+	    what, strerror(errno));
+	if (j->fd != -1) {
+		close(j->fd);
+		j->fd = -1;
+	}
+	j->pend.size = 0;
+	j->off = 1;
+}
+
+
+/*
+ * flush writes out the pending records, and syncs them if sync is set.
+ */
+static void
+flush(struct journal *j, const int sync)
+{
+	const char	*p  = j->pend.b;
+	size_t		 n  = j->pend.size;
+	ssize_t		 nw = 0;
+
+	if (j->fd == -1) {
+		return;
+	}
+
+	while (n > 0) {
+		nw = write(j->fd, p, n);
+		if (nw == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			stop(j, "write");
+			return;
+		}
+		p += nw;
+		n -= (size_t)nw;
+		j->unsynced = 1;
+	}
+	j->pend.size = 0;
+
+	if (sync && j->unsynced) {
+		if (fdatasync(j->fd) == -1) {
+			stop(j, "sync");
+			return;
+		}
+		j->unsynced = 0;
+		clock_gettime(CLOCK_MONOTONIC, &j->synced);
+	}
+}
+
+
+/*
+ * begin starts a record of the given type, creating the journal on the
+ * first edit. It returns NULL if the buffer isn't journaled.
+ */
+static struct journal *
+begin(buffer *b, const int type)
+{
+	struct journal	*j = journal_get(b);
+
+	if (j == NULL || j->off) {
+		return NULL;
+	}
+
+	if (j->fd == -1) {
+		j->fd = open(j->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+		    0600);
+		if (j->fd == -1) {
+			stop(j, "open");
+			return NULL;
+		}
+		header(&j->pend, &j->st);
+		j->unsynced = 1;
+	}
+
+	ab_appendch(&j->pend, (char)type);
+	return j;
+}
+
+
+/*
+ * end seals a record that started at start with its checksum, and
+ * writes out the batch if it is full or the last sync was too long
+ * ago.
+ */
+static void
+end(struct journal *j, const size_t start)
+{
+	unsigned char	 crc[4];
+	uint32_t	 h = 0;
+	int		 late = 0;
+
+	h = fnv1a((const unsigned char *)j->pend.b + start,
+	    j->pend.size - start);
+	crc[0] = (unsigned char)h;
+	crc[1] = (unsigned char)(h >> 8);
+	crc[2] = (unsigned char)(h >> 16);
+	crc[3] = (unsigned char)(h >> 24);
+	ab_append(&j->pend, (const char *)crc, sizeof(crc));
+
+	late = since_ms(&j->synced) >= JOURNAL_DELAY;
+	if (late || j->pend.size >= JOURNAL_BATCH) {
+		flush(j, late);
+	}
+}
+
+
+void
+journal_insert_row(buffer *b, const size_t at, const char *s,
+    const size_t len)
+{
+	struct journal	*j     = NULL;
+	size_t		 start = 0;
+
+	if ((j = begin(b, J_ROW_INSERT)) == NULL) {
+		return;
+	}
+
+	start = j->pend.size - 1;
+	put_varint(&j->pend, at);
+	put_varint(&j->pend, len);
+	ab_append(&j->pend, s, len);
+	end(j, start);
+}
+
+
+void
+journal_delete_row(buffer *b, const size_t at)
+{
+	struct journal	*j     = NULL;
+	size_t		 start = 0;
+
+	if ((j = begin(b, J_ROW_DELETE)) == NULL) {
+		return;
+	}
+
+	start = j->pend.size - 1;
+	put_varint(&j->pend, at);
+	end(j, start);
+}
+
+
+void
+journal_insert(buffer *b, const size_t row, const size_t col,
+    const char *s, const size_t len)
+{
+	struct journal	*j     = NULL;
+	size_t		 start = 0;
+
+	if ((j = begin(b, J_INSERT)) == NULL) {
+		return;
+	}
+
+	start = j->pend.size - 1;
+	put_varint(&j->pend, row);
+	put_varint(&j->pend, col);
+	put_varint(&j->pend, len);
+	ab_append(&j->pend, s, len);
+	end(j, start);
+}
+
+
+void
+journal_delete(buffer *b, const size_t row, const size_t col,
+    const size_t n)
+{
+	struct journal	*j     = NULL;
+	size_t		 start = 0;
+
+	if ((j = begin(b, J_DELETE)) == NULL) {
+		return;
+	}
+
+	start = j->pend.size - 1;
+	put_varint(&j->pend, row);
+	put_varint(&j->pend, col);
+	put_varint(&j->pend, n);
+	end(j, start);
+}
+
+
+/*
+ * journal_tick is called when the editor is idle: whatever has been
+ * typed since the last tick is written and synced.
+ */
+void
+journal_tick(buffer *b)
+{
+	struct journal	*j = b->journal;
+
+	if (j == NULL || j->fd == -1) {
+		return;
+	}
+
+	if (j->pend.size > 0 || j->unsynced) {
+		flush(j, 1);
+	}
+}
+
+
+/*
+ * Replay edits rows directly rather than through the editor, so that
+ * recovering doesn't journal the same edits a second time.
+ */
+static void
+row_insert(abuf *row, const size_t col, const unsigned char *s,
+    const size_t len)
+{
+	size_t	 size = row->size;
+
+	if (len == 0) {
+		return;
+	}
+
+	ab_own(row);
+	if (row->cap < size + len + 1) {
+		ab_resize(row, size + len + 1);
+	}
+
+	memmove(row->b + col + len, row->b + col, size - col);
+	memcpy(row->b + col, s, len);
+	row->size += len;
+	row->b[row->size] = '\0';
+}
+
+
+static void
+row_delete(abuf *row, const size_t col, const size_t n)
+{
+	if (n == 0) {
+		return;
+	}
+
+	ab_own(row);
+	memmove(row->b + col, row->b + col + n, row->size - col - n);
+	row->size -= n;
+	row->b[row->size] = '\0';
+}
+
+
+/*
+ * apply replays one record from p. It returns the end of the record,
+ * or NULL if the record is cut short, fails its checksum or doesn't
+ * fit the rows.
+ */
+static const unsigned char *
+apply(buffer *b, const unsigned char *p, const unsigned char *end)
+{
+	const unsigned char	*start = p;
+	const unsigned char	*data  = NULL;
+	uint64_t		 f[3]  = {0, 0, 0};
+	uint32_t		 h     = 0;
+	int			 type  = 0;
+	int			 nf    = 0;
+	int			 i     = 0;
+	abuf			*row   = NULL;
+	abuf			 line;
+
+	type = *p++;
+	switch (type) {
+	case J_ROW_INSERT:
+		nf = 2;
+		break;
+	case J_ROW_DELETE:
+		nf = 1;
+		break;
+	case J_INSERT:
+		nf = 3;
+		break;
+	case J_DELETE:
+		nf = 3;
+		break;
+	default:
+		return NULL;
+	}
+
+	for (i = 0; i < nf; i++) {
+		if ((p = get_varint(p, end, &f[i])) == NULL) {
+			return NULL;
+		}
+	}
+
+	data = p;
+	if (type == J_ROW_INSERT || type == J_INSERT) {
+		if (f[nf - 1] > (uint64_t)(end - p)) {
+			return NULL;
+		}
+		p += f[nf - 1];
+	}
+
+	if (end - p < 4) {
+		return NULL;
+	}
+	h = fnv1a(start, (size_t)(p - start));
+	if (p[0] != (unsigned char)h || p[1] != (unsigned char)(h >> 8) ||
+	    p[2] != (unsigned char)(h >> 16) ||
+	    p[3] != (unsigned char)(h >> 24)) {
+		return NULL;
+	}
+
+	switch (type) {
+	case J_ROW_INSERT:
+		if (f[0] > b->nrows) {
+			return NULL;
+		}
+		ab_init(&line);
+		ab_append(&line, (const char *)data, f[1]);
+		buffer_insert_rows(b, f[0], &line, 1);
+		break;
+	case J_ROW_DELETE:
+		if (f[0] >= b->nrows) {
+			return NULL;
+		}
+		buffer_delete_rows(b, f[0], 1);
+		break;
+	case J_INSERT:
+		row = (f[0] < b->nrows) ? buffer_row(b, f[0]) : NULL;
+		if (row == NULL || f[1] > row->size) {
+			return NULL;
+		}
+		row_insert(row, f[1], data, f[2]);
+		buffer_row_resized(b, f[0], row->size - f[2]);
+		break;
+	case J_DELETE:
+		row = (f[0] < b->nrows) ? buffer_row(b, f[0]) : NULL;
+		if (row == NULL || f[1] > row->size || f[2] > row->size - f[1]) {
+			return NULL;
+		}
+		row_delete(row, f[1], f[2]);
+		buffer_row_resized(b, f[0], row->size + f[2]);
+		break;
+	}
+
+	return p + 4;
+}
+
+
+/*
+ * journal_recover replays a journal left behind for b's file, if there
+ * is one, over the rows just loaded from the file st describes, and
+ * returns the number of edits it recovered. Later edits are journaled
+ * against st. A journal made against a different version of the file
+ * is left alone, and the buffer isn't journaled so it isn't lost.
+ */
+size_t
+journal_recover(buffer *b, const struct stat *st)
+{
+	struct journal		*j    = journal_get(b);
+	const unsigned char	*p    = NULL;
+	const unsigned char	*next = NULL;
+	unsigned char		*buf  = NULL;
+	size_t			 len  = 0;
+	size_t			 n    = 0;
+	size_t			 good = 0;
+	int			 fd   = -1;
+
+	if (j == NULL || j->fd != -1) {
+		return 0;
+	}
+
+	j->st = *st;
+	if ((fd = open(j->path, O_RDWR | O_APPEND)) == -1) {
+		return 0;
+	}
+
+	buf = kread_all(fd, &len);
+	if (buf == NULL || len < JOURNAL_HEADER ||
+	    memcmp(buf, JOURNAL_MAGIC, 4) != 0) {
+		/* nothing was ever recorded in it */
+		free(buf);
+		close(fd);
+		return 0;
+	}
+
+	if (!stamp_same(buf + 4, st)) {
+		editor_set_status("%s is for an older %s; not replayed or "
+		    "journaled.", j->path, b->filename);
+		free(buf);
+		close(fd);
+		j->off = 1;
+		return 0;
+	}
+
+	buffer_index_all(b);
+	good = JOURNAL_HEADER;
+	for (p = buf + good; p < buf + len; p = next) {
+		if ((next = apply(b, p, buf + len)) == NULL) {
+			break;
+		}
+		good = (size_t)(next - buf);
+		n++;
+	}
+	free(buf);
+
+	/* carry on from the last good record */
+	if (ftruncate(fd, (off_t)good) == -1) {
+		close(fd);
+		j->off = 1;
+		return n;
+	}
+
+	j->fd = fd;
+	if (n > 0) {
+		b->dirty++;
+	}
+
+	return n;
+}
+
+
+/*
+ * journal_discard removes b's journal, once its edits have been saved
+ * or deliberately thrown away, or the buffer has been reloaded. The
+ * buffer now holds the file as it is, and later edits are journaled
+ * against that.
+ */
+void
+journal_discard(buffer *b)
+{
+	struct journal	*j = journal_get(b);
+
+	if (j == NULL) {
+		return;
+	}
+
+	if (stat(b->filename, &j->st) == -1) {
+		memset(&j->st, 0, sizeof(j->st));
+	}
+
+	if (j->fd != -1) {
+		close(j->fd);
+		j->fd = -1;
+		unlink(j->path);
+	}
+
+	j->pend.size = 0;
+	j->unsynced  = 0;
+}
+
+
+/*
+ * journal_close writes out and syncs what is left of b's journal and
+ * lets go of it, leaving the file to be replayed later.
+ */
+void
+journal_close(buffer *b)
+{
+	struct journal	*j = b->journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	if (j->fd != -1) {
+		flush(j, 1);
+		if (j->fd != -1) {
+			close(j->fd);
+		}
+	}
+
+	ab_free(&j->pend);
+	free(j->path);
+	free(j);
+	b->journal = NULL;
+}
@@ -0,0 +1,32 @@
+/*
+ * journal.h - crash recovery for unsaved edits
+ */
+#ifndef KE_JOURNAL_H
+#define KE_JOURNAL_H
+
+#include <sys/stat.h>
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+
+/*
+ * Each edit to a buffer with a file is appended to a journal next to
+ * the file (.name.ke-journal) as it is made. A save or a deliberate
+ * discard removes the journal; if ke dies instead, the journal is
+ * replayed over the file the next time it is opened.
+ */
+void		 journal_insert_row(buffer *b, size_t at, const char *s,
+		    size_t len);
+void		 journal_delete_row(buffer *b, size_t at);
+void		 journal_insert(buffer *b, size_t row, size_t col,
+		    const char *s, size_t len);
+void		 journal_delete(buffer *b, size_t row, size_t col, size_t n);
+void		 journal_tick(buffer *b);
+size_t		 journal_recover(buffer *b, const struct stat *st);
+void		 journal_discard(buffer *b);
+void		 journal_close(buffer *b);
+
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * linecache.c - line indexes of big files kept between runs
+ *
+ * Indexing the lines of a file of several gigabytes means reading all
+ * of it, so jumping near the end of one is slow every time it is
+ * opened. Once the viewer has indexed a big file, its sparse index is
+ * saved in the cache directory; opening the same file again reads the
+ * index, which is a few bytes for every stride lines, instead.
+ *
+ * A cache file is named for the device and inode of the file it
+ * indexes and starts with its size and mtime; an index is only used
+ * when all four still match. After the header come the offsets of the
+ * index entries as LEB128 varints, each the distance from the one
+ * before, and then a checksum of everything before it. Cache files are
+ * written under a temporary name and renamed into place, so a reader
+ * never sees half of one.
+ */
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "core.h"
+#include "linecache.h"
+
+
+#define	LINECACHE_MAGIC		"KEL1"
+#define	LINECACHE_HEADER	76	/* magic, 5 stamp and 4 index fields */
+
+
+static uint32_t
+get_u32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/*
+ * cache_path names the cache file for st's file, creating the cache
+ * directory first if create is set. It returns NULL if there is no
+ * cache directory.
+ */
+static char *
+cache_path(const struct stat *st, const int create)
+{
+	const char	*base = getenv("XDG_CACHE_HOME");
+	const char	*sub  = "";
+	char		*path = NULL;
+	size_t		 size = 0;
+
+	/* relative paths in XDG_CACHE_HOME are to be ignored */
+	if (base == NULL || base[0] != '/') {
+		base = getenv("HOME");
+		sub  = "/.cache";
+	}
+
+	if (base == NULL || base[0] == '\0') {
+		return NULL;
+	}
+
+	size = strlen(base) + strlen(sub) + 64;
+	path = malloc(size);
+	if (path == NULL) {
+		return NULL;
+	}
+
+	if (create) {
+		snprintf(path, size, "%s%s", base, sub);
+		if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+			free(path);
+			return NULL;
+		}
+
+		snprintf(path, size, "%s%s/ke", base, sub);
+		if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+			free(path);
+			return NULL;
+		}
+	}
+
+	snprintf(path, size, "%s%s/ke/%jx-%jx.lines", base, sub,
+	    (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+	return path;
+}
+
+
+static unsigned char *
+read_cache(const char *path, size_t *len)
+{
+	unsigned char	*buf = NULL;
+	int		 fd  = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	buf = kread_all(fd, len);
+	close(fd);
+	return buf;
+}
+
+
+/*
+ * decode checks a cache file against st and reads its index into li.
+ * Entries past max are made room for the way the viewer does, by
+ * dropping every other one and doubling the stride.
+ */
+static int
+decode(const struct stat *st, const unsigned char *buf, const size_t len,
+    struct line_index *li, const size_t max)
+{
+	const unsigned char	*p      = buf + LINECACHE_HEADER;
+	const unsigned char	*end    = NULL;
+	uint64_t		 stride = 0;
+	uint64_t		 n      = 0;
+	uint64_t		 d      = 0;
+	uint64_t		 off    = 0;
+	uint64_t		 i      = 0;
+	size_t			 j      = 0;
+
+	if (len < LINECACHE_HEADER + 4 || max == 0) {
+		return -1;
+	}
+
+	end = buf + len - 4;
+	if (memcmp(buf, LINECACHE_MAGIC, 4) != 0 ||
+	    fnv1a(buf, len - 4) != get_u32(end)) {
+		return -1;
+	}
+
+	if (!stamp_same(buf + 4, st)) {
+		return -1;
+	}
+
+	stride    = get_u64(buf + 44);
+	li->nl    = (size_t)get_u64(buf + 52);
+	li->lines = (size_t)get_u64(buf + 60);
+	n         = get_u64(buf + 68);
+	if (stride == 0 || n != li->nl / stride + 1 ||
+	    li->lines < li->nl || li->lines > li->nl + 1) {
+		return -1;
+	}
+
+	li->stride = (size_t)stride;
+	li->nmarks = 0;
+	for (i = 0; i < n; i++) {
+		p = get_varint(p, end, &d);
+		if (p == NULL || (i > 0 && d == 0) ||
+		    d > (uint64_t)st->st_size - off) {
+			return -1;
+		}
+		off += d;
+
+		if ((i * stride) % li->stride != 0) {
+			continue;
+		}
+
+		if (li->nmarks == max) {
+			for (j = 0; 2 * j < li->nmarks; j++) {
+				li->marks[j] = li->marks[2 * j];
+			}
+			li->nmarks  = j;
+			li->stride *= 2;
+
+			if ((i * stride) % li->stride != 0) {
+				continue;
+			}
+		}
+
+		li->marks[li->nmarks++] = (size_t)off;
+	}
+
+	return p == end ? 0 : -1;
+}
+
+
+/*
+ * linecache_load reads the saved index for st's file into li. A cache
+ * file that doesn't match the file, or is damaged, is removed.
+ */
+int
+linecache_load(const struct stat *st, struct line_index *li,
+    const size_t max)
+{
+	unsigned char	*buf  = NULL;
+	char		*path = NULL;
+	size_t		 len  = 0;
+	int		 rv   = -1;
+
+	if ((size_t)st->st_size < LINECACHE_MIN ||
+	    (path = cache_path(st, 0)) == NULL) {
+		return -1;
+	}
+
+	buf = read_cache(path, &len);
+	if (buf != NULL) {
+		rv = decode(st, buf, len, li, max);
+		if (rv == -1) {
+			unlink(path);
+		}
+	}
+
+	free(buf);
+	free(path);
+	return rv;
+}
+
+
+/*
+ * linecache_store saves li, the whole index of st's file, replacing
+ * any index saved for an earlier file with the same inode. Failing to
+ * save it isn't an error; the file is just indexed again next time.
+ */
+void
+linecache_store(const struct stat *st, const struct line_index *li)
+{
+	abuf		 ab   = ABUF_INIT;
+	char		*path = NULL;
+	char		*tmp  = NULL;
+	const char	*p    = NULL;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+	size_t		 prev = 0;
+	ssize_t		 nw   = 0;
+	uint32_t	 sum  = 0;
+	int		 fd   = -1;
+
+	if ((size_t)st->st_size < LINECACHE_MIN ||
+	    (path = cache_path(st, 1)) == NULL) {
+		return;
+	}
+
+	ab_append(&ab, LINECACHE_MAGIC, 4);
+	put_stamp(&ab, st);
+	put_u64(&ab, (uint64_t)li->stride);
+	put_u64(&ab, (uint64_t)li->nl);
+	put_u64(&ab, (uint64_t)li->lines);
+	put_u64(&ab, (uint64_t)li->nmarks);
+	for (i = 0; i < li->nmarks; i++) {
+		put_varint(&ab, (uint64_t)(li->marks[i] - prev));
+		prev = li->marks[i];
+	}
+
+	sum = fnv1a((const unsigned char *)ab.b, ab.size);
+	for (i = 0; i < 4; i++) {
+		ab_appendch(&ab, (char)(sum >> (i * 8)));
+	}
+
+	n   = strlen(path) + sizeof(".XXXXXX");
+	tmp = malloc(n);
+	if (tmp == NULL) {
+		goto out;
+	}
+
+	snprintf(tmp, n, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		goto out;
+	}
+
+	p = ab.b;
+	n = ab.size;
+	while (n > 0) {
+		nw = write(fd, p, n);
+		if (nw == -1 && errno == EINTR) {
+			continue;
+		}
+		if (nw <= 0) {
+			break;
+		}
+		p += nw;
+		n -= (size_t)nw;
+	}
+
+	if (close(fd) == -1 || n > 0 || rename(tmp, path) == -1) {
+		unlink(tmp);
+	}
+
+out:
+	free(tmp);
+	free(path);
+	ab_free(&ab);
+}
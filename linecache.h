@@ -0,0 +1,39 @@
+/*
+ * linecache.h - line indexes of big files kept between runs
+ */
+#ifndef KE_LINECACHE_H
+#define KE_LINECACHE_H
+
+#include <sys/stat.h>
+
+#include <stddef.h>
+
+
+#define	LINECACHE_MIN	(64UL << 20)	/* smaller files aren't cached */
+
+
+struct line_index {
+	size_t		*marks;		/* marks[i]: offset of line i*stride */
+	size_t		 nmarks;
+	size_t		 stride;
+	size_t		 nl;		/* newlines in the file */
+	size_t		 lines;		/* counting an unterminated last one */
+};
+
+
+/*
+ * The sparse line index of a big file is saved under
+ * $XDG_CACHE_HOME/ke (or ~/.cache/ke), named for the file's device and
+ * inode and stamped with its size and mtime. Loading an index whose
+ * stamp doesn't match the file removes it instead.
+ *
+ * linecache_load fills li->marks, which has room for max entries,
+ * thinning the saved index out if it has more.
+ */
+int		 linecache_load(const struct stat *st, struct line_index *li,
+		    size_t max);
+void		 linecache_store(const struct stat *st,
+		    const struct line_index *li);
+
+
+#endif
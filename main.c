@@ -23,7 +23,6 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -33,17 +32,28 @@
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
-#include <wchar.h>
-#include <wctype.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <limits.h>
 
 #include "abuf.h"
 #include "buffer.h"
+#include "cols.h"
 #include "editor.h"
+#include "compress.h"
 #include "core.h"
+#include "fileio.h"
+#include "follow.h"
+#include "guard.h"
+#include "hex.h"
+#include "journal.h"
+#include "reload.h"
+#include "render.h"
+#include "scan.h"
+#include "screen.h"
 #include "term.h"
+#include "utf8.h"
+#include "view.h"
 
 
 #ifndef KE_VERSION
@@ -52,8 +62,11 @@
 
 #define ESCSEQ			"\x1b["
 #define	CTRL_KEY(key)		((key)&0x1f)
-#define TAB_STOP		8
 #define MSG_TIMEO		3
+#define LOAD_BLOCK		65536	/* read size for unmapped files */
+#define LOAD_LINES		1024
+#define FRAME_INLINE		16384	/* a frame this big needs no malloc */
+#define KILLRING_INLINE		128
 
 /*
  * define the keyboard input modes
@@ -66,7 +79,11 @@
 #define	MODE_ESCAPE		2
 
 
-#define	TAB_STOP		8
+/* how open_file_as picks between text and hex mode */
+#define	HEX_AUTO		0	/* hex if the file looks binary */
+#define	HEX_OFF			1
+#define	HEX_ON			2
+#define	BINARY_PROBE		8192	/* bytes checked for a NUL */
 
 
 #define KILLRING_NO_OP		0	/* don't touch the killring */
@@ -90,6 +107,7 @@ void		 indent_region(void);
 void		 delete_region(void);
 
 /* miscellaneous */
+int		 refuse_readonly(void);
 void		 jump_to_position(size_t col, size_t row);
 void		 goto_line(void);
 int	    	 cursor_at_eol(void);
@@ -99,13 +117,22 @@ void		 delete_next_word(void);
 void		 find_prev_word(void);
 void		 delete_prev_word(void);
 void		 delete_row(const size_t at);
-void		 row_insert_ch(abuf *row, int at, int16_t c);
-void		 row_delete_ch(abuf *row, int at);
+void		 row_insert_ch(size_t y, int at, int16_t c);
+void		 row_delete_ch(size_t y, int at);
 void		 insertch(int16_t c);
 void		 deletech(uint8_t op);
 void		 open_file(const char *filename);
-char		*rows_to_buffer(int *buflen);
+void		 open_file_as(const char *filename, int hex);
+void		 toggle_hex(void);
+void		 follow_file(void);
+void		 follow_reopen(void);
+void		 toggle_follow(void);
+int		 follow_tick(void);
+int		 reload_tick(void);
 int     	 save_file(void);
+void		 save_report(const buffer *b, const fileio_stats *stats);
+int		 save_collect(buffer *b, int wait);
+int		 save_poll(int wait);
 uint16_t	 is_arrow_key(int16_t c);
 int16_t		 get_keypress(void);
 void		 editor_find_callback(char *query, int16_t c);
@@ -352,127 +379,7 @@ file_open_prompt_cb(char *buf, const int16_t key)
 
 
 int
-erow_render_to_cursor(const abuf *row, const int cx)
-{
-	int		 rx = 0;
-	size_t		 j = 0;
-	wchar_t		 wc;
-	mbstate_t	 st;
-
-	memset(&st, 0, sizeof(st));
-
-	while (j < (size_t)cx && j < (size_t)row->size) {
-		unsigned char b = (unsigned char)row->b[j];
-		if (b == '\t') {
-			rx += (TAB_STOP - 1) - (rx % TAB_STOP);
-			rx++;
-			j++;
-			continue;
-		}
-		if (b < 0x20) {
-			/* render as \xx -> width 3 */
-			rx += 3;
-			j++;
-			continue;
-		}
-
-		if (b < 0x80) {
-			rx++;
-			j++;
-			continue;
-		}
-
-		size_t rem = (size_t)row->size - j;
-		size_t n = mbrtowc(&wc, &row->b[j], rem, &st);
-
-		if (n == (size_t)-2) {
-			/* incomplete sequence at end; treat one byte */
-			rx += 1;
-			j += 1;
-			memset(&st, 0, sizeof(st));
-		} else if (n == (size_t)-1) {
-			/* invalid byte; consume one and reset state */
-			rx += 1;
-			j += 1;
-			memset(&st, 0, sizeof(st));
-		} else if (n == 0) {
-			/* null character */
-			rx += 0;
-			j += 1;
-		} else {
-			int w = wcwidth(wc);
-			if (w < 0)
-				w = 1; /* non-printable -> treat as width 1 */
-			rx += w;
-			j += n;
-		}
-	}
-
-	return rx;
-}
-
-
-int
-erow_cursor_to_render(abuf *row, int rx)
-{
-	int		 cur_rx = 0;
-	size_t		 j = 0;
-	wchar_t		 wc;
-	mbstate_t	 st;
-
-	memset(&st, 0, sizeof(st));
-
-	while (j < (size_t)row->size) {
-		int w = 0;
-		size_t adv = 1;
-
-		unsigned char b = (unsigned char)row->b[j];
-		if (b == '\t') {
-			int add = (TAB_STOP - 1) - (cur_rx % TAB_STOP);
-			w = add + 1;
-			adv = 1;
-			/* tabs are single byte */
-		} else if (b < 0x20) {
-			w = 3; /* "\\xx" */
-			adv = 1;
-		} else if (b < 0x80) {
-			w = 1;
-			adv = 1;
-		} else {
-			size_t rem = (size_t)row->size - j;
-			size_t n = mbrtowc(&wc, &row->b[j], rem, &st);
-
-			if (n == (size_t)-2 || n == (size_t)-1) {
-				/* invalid/incomplete */
-				w = 1;
-				adv = 1;
-				memset(&st, 0, sizeof(st));
-			} else if (n == 0) {
-				w = 0;
-				adv = 1;
-			} else {
-				int ww = wcwidth(wc);
-				if (ww < 0)
-					ww = 1;
-				w = ww;
-				adv = n;
-			}
-		}
-
-		if (cur_rx + w > rx) {
-			break;
-		}
-
-		cur_rx += w;
-		j += adv;
-	}
-
-	return (int)j;
-}
-
-
-int
-erow_init(abuf *row, int len)
+erow_init(abuf *row, const size_t len)
 {
 	ab_init_cap(row, len);
 
@@ -481,21 +388,18 @@ erow_init(abuf *row, int len)
 
 
 void
-erow_insert(int at, char *s, int len)
+erow_insert(const size_t at, const char *s, const size_t len)
 {
-	abuf	*row = realloc(EROW, sizeof(abuf) * (ENROWS + 1));
+	abuf	 row;
 
-	assert(row != NULL);
-	EROW = row;
+	/* rows past the indexed part of a mapped file come after it */
+	buffer_index_rows(CURBUF, at);
+	buffer_gap_close(CURBUF);
+	journal_insert_row(CURBUF, at, s, len);
 
-	if ((size_t) at < ENROWS) {
-		memmove(&EROW[at + 1], &EROW[at],
-			sizeof(abuf) * (ENROWS - (size_t) at));
-	}
-
-	ab_init(&EROW[at]);
-	ab_append(&EROW[at], s, (size_t) len);
-    	ENROWS++;
+	ab_init(&row);
+	ab_append(&row, s, len);
+	buffer_insert_rows(CURBUF, at, &row, 1);
 }
 
 
@@ -521,7 +425,7 @@ killring_yank(void)
 	 * Interpret '\n' as an actual newline() rather than inserting a raw 0x0A
 	 * byte, so yanked content preserves lines correctly.
 	 */
-	for (int i = 0; i < (int)editor.killring->size; i++) {
+	for (size_t i = 0; i < editor.killring->size; i++) {
 		unsigned char ch = (unsigned char)editor.killring->b[i];
 		if (ch == '\n') {
 			newline();
@@ -543,18 +447,14 @@ killring_start_with_char(unsigned char ch)
 		editor.killring = NULL;
 	}
 
-	editor.killring = malloc(sizeof(abuf));
+	/* most kills are short enough to stay right behind the abuf */
+	editor.killring = malloc(sizeof(ABUF_INLINE(KILLRING_INLINE)));
 	assert(editor.killring != NULL);
-	assert(erow_init(editor.killring, 0) == 0);
+	ab_init_inline(editor.killring, KILLRING_INLINE);
 
 	/* append one char to empty killring without affecting editor.dirty */
 	row = editor.killring;
-
-	row->b = realloc(row->b, row->size + 2);
-	assert(row->b != NULL);
-	row->b[row->size] = ch;
-	row->size++;
-	row->b[row->size] = '\0';
+	ab_appendch(row, (char)ch);
 }
 
 
@@ -569,11 +469,7 @@ killring_append_char(unsigned char ch)
 	}
 
 	row = editor.killring;
-	row->b = realloc(row->b, row->size + 2);
-	assert(row->b != NULL);
-	row->b[row->size] = ch;
-	row->size++;
-	row->b[row->size] = '\0';
+	ab_appendch(row, (char)ch);
 }
 
 
@@ -588,11 +484,7 @@ killring_prepend_char(unsigned char ch)
 	}
 
 	row = editor.killring;
-	row->b = realloc(row->b, row->size + 2);
-	assert(row->b != NULL);
-	memmove(&row->b[1], &row->b[0], row->size + 1);
-	row->b[0] = ch;
-	row->size++;
+	ab_prependch(row, (char)ch);
 }
 
 
@@ -688,7 +580,7 @@ kill_region(void)
 
 	while (ECURY != cury) {
 		while (!cursor_at_eol()) {
-			killring_append_char(EROW[ECURY].b[ECURX]);
+			killring_append_char(EROW(ECURY).b[ECURX]);
 			move_cursor(ARROW_RIGHT, 0);
 		}
 		killring_append_char('\n');
@@ -696,7 +588,7 @@ kill_region(void)
 	}
 
 	while (ECURX != curx) {
-		killring_append_char(EROW[ECURY].b[ECURX]);
+		killring_append_char(EROW(ECURY).b[ECURX]);
 		move_cursor(ARROW_RIGHT, 0);
 	}
 
@@ -737,9 +629,11 @@ indent_region(void)
 	}
 
 	for (i = start_row; i <= end_row; i++) {
-		row_insert_ch(&EROW[i], 0, '\t');
+		row_insert_ch(i, 0, '\t');
 	}
 
+	/* the gap is only left open at the cursor */
+	buffer_gap_close(CURBUF);
 	ECURX = 0;
 	EDIRTY++;
 }
@@ -777,14 +671,14 @@ unindent_region(void)
 	}
 
 	for (i = start_row; i <= end_row; i++) {
-		row = &EROW[i];
+		row = &EROW(i);
 
 		if (row->size == 0) {
 			continue;
 		}
 
 		if (row->b[0] == '\t') {
-			row_delete_ch(row, 0);
+			row_delete_ch(i, 0);
 		} else if (row->b[0] == ' ') {
 			del = 0;
 
@@ -794,14 +688,18 @@ unindent_region(void)
 			}
 
 			if (del > 0) {
+				journal_delete(CURBUF, i, 0, del);
+				ab_own(row);
 				/* +1 for NUL */
 				memmove(row->b, row->b + del,
 					row->size - del + 1);
 				row->size -= del;
+				buffer_row_resized(CURBUF, i, row->size + del);
 			}
 		}
 	}
 
+	buffer_gap_close(CURBUF);
 	ECURX = 0;
 	ECURY = start_row;
 
@@ -846,9 +744,37 @@ delete_region(void)
 }
 
 
+/*
+ * refuse_readonly says so and returns 1 if the current buffer can't be
+ * edited.
+ */
+int
+refuse_readonly(void)
+{
+	if (fileio_saving(CURBUF)) {
+		editor_set_status("Buffer is being saved.");
+		return 1;
+	}
+
+	/* hex mode only overwrites bytes, and has no lines to edit */
+	if (CURBUF->hex != NULL) {
+		editor_set_status("Not in hex mode.");
+		return 1;
+	}
+
+	if (!CURBUF->readonly) {
+		return 0;
+	}
+
+	editor_set_status("Buffer is read-only.");
+	return 1;
+}
+
+
 void
 jump_to_position(size_t col, size_t row)
 {
+	buffer_index_rows(CURBUF, row);
 	if (ENROWS <= 0) {
 		ECURX = 0;
 		ECURY = 0;
@@ -860,8 +786,8 @@ jump_to_position(size_t col, size_t row)
 		row = ENROWS - 1;
 	}
 
-	if (col > EROW[row].size) {
-		col = EROW[row].size;
+	if (col > EROW(row).size) {
+		col = EROW(row).size;
 	}
 
 	ECURX = col;
@@ -875,21 +801,37 @@ void
 goto_line(void)
 {
 	size_t	 lineno = 0;
-	char	*query  = editor_prompt("Line: %s", NULL);
+	size_t	 nlines = 0;
+	char	*query  = NULL;
+
+	if (CURBUF->hex != NULL) {
+		query = editor_prompt("Offset: %s", NULL);
+		if (query != NULL) {
+			hex_seek(CURBUF, strtoull(query, NULL, 0));
+			free(query);
+		}
+		return;
+	}
 
+	query = editor_prompt("Line: %s", NULL);
 	if (query == NULL) {
 		return;
 	}
 
 	lineno = strtoul(query, NULL, 10);
-	if (lineno < 1 || lineno > ENROWS) {
-		editor_set_status("Line number must be between 1 and %d.",
-		                  ENROWS);
+	if (lineno > 0) {
+		buffer_index_rows(CURBUF, lineno - 1);
+	}
+	nlines = view_nlines(CURBUF, lineno > 0 ? lineno - 1 : 0);
+
+	if (lineno < 1 || lineno > nlines) {
+		editor_set_status("Line number must be between 1 and %zu.",
+		                  nlines);
 		free(query);
 		return;
 	}
 
-	jump_to_position(0, lineno - 1);
+	jump_to_position(0, view_row(CURBUF, lineno - 1));
 	free(query);
 }
 
@@ -898,9 +840,9 @@ int
 cursor_at_eol(void)
 {
 	assert(ECURY <= ENROWS);
-	assert(ECURX <= EROW[ECURY].size);
+	assert(ECURX <= EROW(ECURY).size);
 
-	return ECURX == EROW[ECURY].size;
+	return ECURX == EROW(ECURY).size;
 }
 
 
@@ -918,8 +860,8 @@ find_next_word(void)
 		move_cursor(ARROW_RIGHT, 1);
 	}
 
-	if (iswordchar(EROW[ECURY].b[ECURX])) {
-		while (!isspace(EROW[ECURY].b[ECURX]) && !
+	if (iswordchar(EROW(ECURY).b[ECURX])) {
+		while (!isspace(EROW(ECURY).b[ECURX]) && !
 		       cursor_at_eol()) {
 			move_cursor(ARROW_RIGHT, 1);
 		}
@@ -927,8 +869,8 @@ find_next_word(void)
 		return;
 	}
 
-	if (isspace(EROW[ECURY].b[ECURX])) {
-		while (isspace(EROW[ECURY].b[ECURX])) {
+	if (isspace(EROW(ECURY).b[ECURX])) {
+		while (isspace(EROW(ECURY).b[ECURX])) {
 			move_cursor(ARROW_RIGHT, 1);
 		}
 
@@ -945,8 +887,8 @@ delete_next_word(void)
 		deletech(KILLRING_APPEND);
 	}
 
-	if (iswordchar(EROW[ECURY].b[ECURX])) {
-		while (!isspace(EROW[ECURY].b[ECURX]) && !
+	if (iswordchar(EROW(ECURY).b[ECURX])) {
+		while (!isspace(EROW(ECURY).b[ECURX]) && !
 		       cursor_at_eol()) {
 			move_cursor(ARROW_RIGHT, 1);
 			deletech(KILLRING_APPEND);
@@ -955,8 +897,8 @@ delete_next_word(void)
 		return;
 	}
 
-	if (isspace(EROW[ECURY].b[ECURX])) {
-		while (isspace(EROW[ECURY].b[ECURX])) {
+	if (isspace(EROW(ECURY).b[ECURX])) {
+		while (isspace(EROW(ECURY).b[ECURX])) {
 			move_cursor(ARROW_RIGHT, 1);
 			deletech(KILLRING_APPEND);
 		}
@@ -975,7 +917,7 @@ find_prev_word(void)
 
 	move_cursor(ARROW_LEFT, 1);
 
-	while (cursor_at_eol() || isspace(EROW[ECURY].b[ECURX])) {
+	while (cursor_at_eol() || isspace(EROW(ECURY).b[ECURX])) {
 		if (ECURY == 0 && ECURX == 0) {
 			return;
 		}
@@ -983,7 +925,7 @@ find_prev_word(void)
 		move_cursor(ARROW_LEFT, 1);
 	}
 
-	while (ECURX > 0 && !isspace(EROW[ECURY].b[ECURX - 1])) {
+	while (ECURX > 0 && !isspace(EROW(ECURY).b[ECURX - 1])) {
 		move_cursor(ARROW_LEFT, 1);
 	}
 }
@@ -1004,7 +946,7 @@ delete_prev_word(void)
 			continue;
 		}
 
-		if (!isspace(EROW[ECURY].b[ECURX - 1])) {
+		if (!isspace(EROW(ECURY).b[ECURX - 1])) {
 			break;
 		}
 
@@ -1012,7 +954,7 @@ delete_prev_word(void)
 	}
 
 	while (ECURX > 0) {
-		if (isspace(EROW[ECURY].b[ECURX - 1])) {
+		if (isspace(EROW(ECURY).b[ECURX - 1])) {
 			break;
 		}
 		deletech(KILLRING_PREPEND);
@@ -1036,17 +978,17 @@ delete_row(const size_t at)
 	 * newline itself and we must NOT also push the entire row here.
 	 */
 	if (!editor.no_kill) {
-		row = &EROW[at];
+		row = &EROW(at);
 		if (row->size > 0) {
 			if (!editor.kill) {
 				killring_start_with_char(
 					(unsigned char) row->b[0]);
-				for (int i = 1; i < (int) row->size; i++) {
+				for (size_t i = 1; i < row->size; i++) {
 					killring_append_char(
 						(unsigned char) row->b[i]);
 				}
 			} else {
-				for (int i = 0; i < (int) row->size; i++) {
+				for (size_t i = 0; i < row->size; i++) {
 					killring_append_char(
 						(unsigned char) row->b[i]);
 				}
@@ -1063,52 +1005,83 @@ delete_row(const size_t at)
 		}
 	}
 
-	ab_free(&EROW[at]);
-	memmove(&EROW[at],
-		&EROW[at + 1],
-		sizeof(abuf) * (ENROWS - at - 1));
-	ENROWS--;
+	buffer_gap_close(CURBUF);
+	journal_delete_row(CURBUF, at);
+	buffer_delete_rows(CURBUF, at, 1);
 	EDIRTY++;
 }
 
 
 void
-row_append_row(abuf *row, const char *s, const int len)
+row_append_row(const size_t y, const char *s, const size_t len)
 {
+	abuf	*row = &EROW(y);
+
+	buffer_gap_close(CURBUF);
+	journal_insert(CURBUF, y, row->size, s, len);
 	ab_append(row, s, len);
+	buffer_row_resized(CURBUF, y, row->size - len);
 	EDIRTY++;
 }
 
 
 void
-row_insert_ch(abuf *row, int at, const int16_t c)
+row_insert_ch(const size_t y, int at, const int16_t c)
 {
+	abuf	*row   = &EROW(y);
+	size_t	 was   = buffer_row_gen(CURBUF, y);
+	int	 plain = buffer_row_plain(CURBUF, y);
+	char	 ch    = 0;
+
 	/*
 	 * row_insert_ch just concerns itself with how to update a row.
+	 * The character goes into the row's gap, which is left open
+	 * after it for the next one; see buffer_gap_move.
 	 */
 	if (at < 0 || at > (int)row->size) {
 		at = (int)row->size;
 	}
 	assert(c > 0);
 
-	ab_resize(row, row->size + 2);
-	memmove(&row->b[at + 1], &row->b[at], row->size - at + 1);
-	row->b[at] = c & 0xff;
+	ch = (char)(c & 0xff);
+	journal_insert(CURBUF, y, (size_t)at, &ch, 1);
+
+	buffer_gap_move(CURBUF, y, (size_t)at, 1);
+	row->b[at] = ch;
 	row->size++;
-	row->b[row->size] = 0;
+	CURBUF->gapat++;
+	CURBUF->gaplen--;
+	buffer_row_resized(CURBUF, y, row->size - 1);
+	if (plain && scan_plain(&ch, 1) == 1) {
+		buffer_row_set_plain(CURBUF, y);
+	}
+	cols_edited(was, buffer_row_gen(CURBUF, y), (size_t)at);
 }
 
 
 void
-row_delete_ch(abuf *row, const int at)
+row_delete_ch(const size_t y, const int at)
 {
+	abuf	*row   = &EROW(y);
+	size_t	 was   = buffer_row_gen(CURBUF, y);
+	int	 plain = buffer_row_plain(CURBUF, y);
+
 	if (at < 0 || at >= (int) row->size) {
 		return;
 	}
 
-	memmove(&row->b[at], &row->b[at + 1], row->size - at);
+	journal_delete(CURBUF, y, (size_t)at, 1);
+
+	/* the deleted byte joins the gap, which ends up just after it */
+	buffer_gap_move(CURBUF, y, (size_t)at + 1, 0);
 	row->size--;
-	row->b[row->size] = 0;
+	CURBUF->gapat--;
+	CURBUF->gaplen++;
+	buffer_row_resized(CURBUF, y, row->size + 1);
+	if (plain) {
+		buffer_row_set_plain(CURBUF, y);
+	}
+	cols_edited(was, buffer_row_gen(CURBUF, y), (size_t)at);
 	EDIRTY++;
 }
 
@@ -1128,7 +1101,7 @@ insertch(const int16_t c)
 	/* Inserting ends kill ring chaining. */
 	editor.kill = 0;
 
-	row_insert_ch(&EROW[ECURY],
+	row_insert_ch(ECURY,
 		      ECURX,
 		      (int16_t) (c & 0xff));
 	ECURX++;
@@ -1151,7 +1124,7 @@ deletech(uint8_t op)
 		return;
 	}
 
-	row = &EROW[ECURY];
+	row = &EROW(ECURY);
 	if (ECURX > 0) {
 		dch = (unsigned char) row->b[ECURX - 1];
 	} else {
@@ -1159,13 +1132,16 @@ deletech(uint8_t op)
 	}
 
 	if (ECURX > 0) {
-		row_delete_ch(row, ECURX - 1);
+		row_delete_ch(ECURY, ECURX - 1);
 		ECURX--;
+
+		/* deleting forward reads on past the cursor */
+		if (op != KILLRING_PREPEND) {
+			buffer_gap_close(CURBUF);
+		}
 	} else {
-		ECURX = (int) EROW[ECURY - 1].size;
-		row_append_row(&EROW[ECURY - 1],
-			       row->b,
-			       (int) row->size);
+		ECURX = (int) EROW(ECURY - 1).size;
+		row_append_row(ECURY - 1, row->b, row->size);
 
 		prev = editor.no_kill;
 		editor.no_kill = 1;
@@ -1202,15 +1178,167 @@ deletech(uint8_t op)
 }
 
 
+/*
+ * load_stream reads a file that can't be mapped, or has to be
+ * decompressed, splitting each block into rows. A partial line at the
+ * end of a block is carried over into the next read. It returns -1 if
+ * the data stopped short with an error; the rows read so far are kept.
+ */
+static int
+load_stream(zreader *zr)
+{
+	line_span	 lines[LOAD_LINES];
+	abuf		 row;
+	char		*blk  = NULL;
+	size_t		 cap  = LOAD_BLOCK;
+	size_t		 have = 0;
+	size_t		 used = 0;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+	ssize_t		 nr   = 0;
+	int		 eof  = 0;
+	int		 rv   = 0;
+
+	blk = malloc(cap);
+	assert(blk != NULL);
+
+	while (!eof) {
+		if (have == cap) {
+			/* a line longer than the block */
+			cap *= 2;
+			blk = realloc(blk, cap);
+			assert(blk != NULL);
+		}
+
+		nr = zread(zr, blk + have, cap - have);
+		if (nr == -1) {
+			/* keep what was read, including a last partial line */
+			rv = -1;
+			nr = 0;
+		}
+
+		eof   = (nr == 0);
+		have += (size_t)nr;
+
+		do {
+			n = scan_lines(blk, have, eof, lines, LOAD_LINES, &used);
+			for (i = 0; i < n; i++) {
+				/* loading isn't an edit, so it isn't journaled */
+				buffer_copy_row(CURBUF, &row, blk + lines[i].off,
+				    lines[i].len);
+				buffer_insert_rows(CURBUF, ENROWS, &row, 1);
+			}
+
+			memmove(blk, blk + used, have - used);
+			have -= used;
+		} while (n == LOAD_LINES);
+	}
+
+	free(blk);
+	return rv;
+}
+
+
+/*
+ * open_compressed reads a compressed file through its decompressor.
+ * Files in a format this build can't read are shown as they are, and
+ * can't be edited; so are files that turn out to be corrupt, since
+ * saving them would lose whatever couldn't be read.
+ */
+static void
+open_compressed(buffer *cur, const int fd)
+{
+	struct timespec	 start;
+	struct timespec	 now;
+	zreader		*zr  = NULL;
+	size_t		 raw = 0;
+	double		 ms  = 0;
+	int		 err = 0;
+
+	if (!compress_supported(cur->compress)) {
+		editor_set_status("%s is %s compressed, which this ke can't "
+		    "read; opened read-only.", cur->filename,
+		    compress_name(cur->compress));
+		cur->compress = COMPRESS_NONE;
+		cur->readonly = 1;
+	}
+
+	zr = zread_open(fd, cur->compress);
+	if (zr == NULL) {
+		die("zread_open");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (load_stream(zr) == -1) {
+		err = errno;
+		cur->readonly = 1;
+	}
+	zread_close(zr);
+
+	if (cur->compress == COMPRESS_NONE) {
+		return;
+	}
+
+	if (err != 0) {
+		editor_set_status("%s: %s data stops short (%s); opened "
+		    "read-only.", cur->filename, compress_name(cur->compress),
+		    strerror(err));
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (double)(now.tv_sec - start.tv_sec) * 1000.0 +
+	    (double)(now.tv_nsec - start.tv_nsec) / 1000000.0;
+	raw = buffer_offset(cur, cur->nrows);
+
+	editor_set_status("Read %zu bytes of %s in %.1f s, %.0f MB/s.", raw,
+	    compress_name(cur->compress), ms / 1000.0,
+	    ms > 0 ? (double)raw / ms / 1000.0 : 0.0);
+}
+
+
 void
 open_file(const char *filename)
 {
-	char	*line    = NULL;
-	size_t	 linecap = 0;
-	ssize_t	 linelen = 0;
-	size_t	 i       = 0;
-	FILE	*fp      = NULL;
-	buffer	*cur     = NULL;
+	open_file_as(filename, editor.hex ? HEX_ON : HEX_AUTO);
+}
+
+
+/*
+ * recover replays the edits that a session which died left in the
+ * journal for the file just loaded, which was st when it was opened.
+ */
+static void
+recover(buffer *b, const struct stat *st)
+{
+	size_t	 n = 0;
+
+	if (b->readonly) {
+		return;
+	}
+
+	n = journal_recover(b, st);
+	if (n > 0) {
+		editor_set_status("Recovered %zu unsaved edit%s to %s.", n,
+		    n == 1 ? "" : "s", b->filename);
+	}
+}
+
+
+/*
+ * open_file_as loads filename into the current buffer, in hex mode if
+ * hex is HEX_ON, or if it is HEX_AUTO and the file looks binary.
+ */
+void
+open_file_as(const char *filename, const int hex)
+{
+	unsigned char	 probe[BINARY_PROBE];
+	ssize_t		 nr      = 0;
+	int		 fd      = -1;
+	int		 isreg   = 0;
+	buffer		*cur     = NULL;
+	zreader		*zr      = NULL;
+	struct stat	 st;
 
 	cur = buffer_current();
 	if (cur == NULL) {
@@ -1221,14 +1349,7 @@ open_file(const char *filename)
 	 * fresh data instead of appending to any previous rows. */
 	reset_editor();
 
-	if (EROW != NULL && ENROWS > 0) {
-		for (i = 0; i < ENROWS; i++) {
-			ab_free(&EROW[i]);
-		}
-		free(EROW);
-		EROW   = NULL;
-		ENROWS = 0;
-	}
+	buffer_drop_rows(cur);
 
 	/* Reset cursor/scroll positions for the buffer */
 	ECURX    = ECURY = 0;
@@ -1243,73 +1364,260 @@ open_file(const char *filename)
 	assert(EFILENAME != NULL);
 
 	EDIRTY = 0;
-	fp = fopen(EFILENAME, "r");
-	if (fp == NULL) {
+	cur->readonly = editor.viewer;
+	cur->compress = COMPRESS_NONE;
+	memset(&st, 0, sizeof(st));
+	fd = open(EFILENAME, O_RDONLY);
+	if (fd == -1) {
 		if (errno == ENOENT) {
+			cur->compress = compress_by_name(EFILENAME);
 			editor_set_status("[new file]");
+			recover(cur, &st);
 			return;
 		}
-		die("fopen");
+		die("open");
 	}
 
-	while ((linelen = getline(&line, &linecap, fp)) != -1) {
-		if (linelen != -1) {
-			while (linelen > 0 && (line[linelen - 1] == '\r' ||
-			                       line[linelen - 1] == '\n')) {
-				linelen--;
-			}
+	/*
+	 * Compressed files are recognised by their first bytes, read
+	 * through a decompressor, and compressed again when saved.
+	 */
+	if (fstat(fd, &st) == -1) {
+		memset(&st, 0, sizeof(st));
+	}
+	isreg = S_ISREG(st.st_mode);
+	if (isreg && hex != HEX_ON) {
+		nr = pread(fd, probe, sizeof(probe), 0);
+		if (nr > 0) {
+			cur->compress = compress_detect(probe, (size_t)nr);
+		}
+	}
+
+	/*
+	 * Anything with a NUL near the start is taken to be binary and
+	 * shown in hex, since splitting it into lines would mangle it.
+	 */
+	if (hex == HEX_ON || (hex == HEX_AUTO &&
+	    cur->compress == COMPRESS_NONE && nr > 0 &&
+	    memchr(probe, '\0', (size_t)nr) != NULL)) {
+		if (hex_open(cur, fd) == -1) {
+			die("hex_open");
+		}
+		close(fd);
 
-			erow_insert(ENROWS, line, (int)linelen);
+		if (hex == HEX_AUTO) {
+			editor_set_status("%s looks binary; C-k h for text.",
+			    EFILENAME);
 		}
+		return;
+	}
+
+	if (cur->compress != COMPRESS_NONE) {
+		open_compressed(cur, fd);
+		close(fd);
+		recover(cur, &st);
+		return;
 	}
 
-	free(line);
-	line = NULL;
-	fclose(fp);
+	/*
+	 * In the viewer, regular files are only ever read a window at a
+	 * time, and the view keeps the descriptor.
+	 */
+	if (editor.viewer &&
+	    view_open(cur, fd, editor.viewmem, editor.linecache) == 0) {
+		return;
+	}
+
+	/*
+	 * Regular files are mapped and split into rows on a loader
+	 * thread, so the first screen comes up as soon as its rows are
+	 * found; if the thread can't be started, rows are indexed lazily
+	 * as they are looked at. Everything else (pipes, empty or
+	 * unmappable files) is read a block at a time.
+	 */
+	if (isreg && st.st_size > 0 &&
+	    buffer_map_file(cur, fd, (size_t)st.st_size) == 0) {
+		close(fd);
+		buffer_load_async(cur);
+		buffer_index_rows(cur, editor.rows);
+		recover(cur, &st);
+		reload_watch(cur);
+		return;
+	}
+
+	zr = zread_open(fd, COMPRESS_NONE);
+	if (zr == NULL || load_stream(zr) == -1) {
+		die("read");
+	}
+	zread_close(zr);
+	close(fd);
+	recover(cur, &st);
+	reload_watch(cur);
 }
 
 
 /*
- * convert our rows to a buffer; caller must free it.
+ * toggle_hex reloads the current file in hex mode, or back out of it.
  */
-char
-*rows_to_buffer(int *buflen)
+void
+toggle_hex(void)
 {
-	size_t	 len = 0;
-	size_t	 j   = 0;
-	char	*buf = NULL;
-	char	*p   = NULL;
+	char	*name = NULL;
+	int	 hex  = (CURBUF->hex == NULL) ? HEX_ON : HEX_OFF;
 
-	for (j = 0; j < ENROWS; j++) {
-		len += EROW[j].size + 1;
+	if (EFILENAME == NULL) {
+		editor_set_status("Buffer has no file.");
+		return;
 	}
 
-	if (len == 0) {
-		return NULL;
+	if (EDIRTY) {
+		editor_set_status("Save the buffer first.");
+		return;
+	}
+
+	if (fileio_saving(CURBUF)) {
+		editor_set_status("Buffer is being saved.");
+		return;
+	}
+
+	name = strdup(EFILENAME);
+	assert(name != NULL);
+	open_file_as(name, hex);
+	free(name);
+}
+
+
+/*
+ * follow_file starts following the current buffer's file from where
+ * its contents end, and moves to the last line.
+ */
+void
+follow_file(void)
+{
+	buffer		*b  = CURBUF;
+	struct stat	 st;
+	int		 fd = -1;
+
+	if (b->filename == NULL || b->hex != NULL || b->view != NULL ||
+	    b->compress != COMPRESS_NONE) {
+		editor_set_status("Only plain text files can be followed.");
+		return;
+	}
+
+	if (b->dirty) {
+		editor_set_status("Save the buffer first.");
+		return;
+	}
+
+	fd = open(b->filename, O_RDONLY);
+	if (fd == -1) {
+		editor_set_status("Can't follow %s: %s", b->filename,
+		    strerror(errno));
+		return;
+	}
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		editor_set_status("Can't follow %s: not a regular file.",
+		    b->filename);
+		close(fd);
+		return;
+	}
+
+	/* the buffer has to hold the start of the file that is followed */
+	if (b->map != NULL && (st.st_dev != b->mapst.st_dev ||
+	    st.st_ino != b->mapst.st_ino)) {
+		close(fd);
+		follow_reopen();
+		return;
+	}
+
+	if (follow_start(b, fd,
+	    b->map != NULL ? b->maplen : (size_t)st.st_size) == -1) {
+		editor_set_status("Can't follow %s.", b->filename);
+		close(fd);
+		return;
 	}
 
-	*buflen = len;
-	buf     = malloc(len);
-	assert(buf != NULL);
-	p = buf;
+	b->readonly = 1;
+	buffer_index_all(b);
+	ECURY = ENROWS > 0 ? ENROWS - 1 : 0;
+	ECURX = 0;
+	editor_set_status("Following %s; C-k t to stop.", b->filename);
+}
+
 
-	for (j = 0; j < ENROWS; j++) {
-		memcpy(p, EROW[j].b, EROW[j].size);
-		p += EROW[j].size;
-		*p++ = '\n';
+/*
+ * follow_reopen loads the current file again from the start and
+ * follows the new one.
+ */
+void
+follow_reopen(void)
+{
+	char	*name = NULL;
+
+	name = strdup(EFILENAME);
+	assert(name != NULL);
+	open_file(name);
+	free(name);
+
+	follow_file();
+}
+
+
+void
+toggle_follow(void)
+{
+	if (!follow_active(CURBUF)) {
+		follow_file();
+		return;
 	}
 
-	return buf;
+	follow_stop(CURBUF);
+	CURBUF->readonly = editor.viewer;
+	editor_set_status("Stopped following %s.", EFILENAME);
+}
+
+
+/*
+ * follow_tick picks up whatever has been appended to a followed file,
+ * keeping the cursor on the last line if it was there.
+ */
+int
+follow_tick(void)
+{
+	const int	 at_end = (ECURY + 1 >= ENROWS);
+
+	switch (follow_poll(CURBUF)) {
+	case FOLLOW_GREW:
+		if (at_end && ENROWS > 0) {
+			ECURY = ENROWS - 1;
+			ECURX = 0;
+		}
+		return 1;
+	case FOLLOW_REOPEN:
+		follow_reopen();
+		editor_set_status("%s was truncated or replaced; reopened.",
+		    EFILENAME);
+		return 1;
+	default:
+		return 0;
+	}
 }
 
 
+/*
+ * save_file saves the current buffer. Compressed files are saved on a
+ * worker thread, and save_poll reports when they are done.
+ */
 int
 save_file(void)
 {
-	int	 fd     = -1;
-	int	 len    = 0;
-	int	 status = 1;
-	char	*buf    = NULL;
+	fileio_stats	 stats;
+
+	if (fileio_saving(CURBUF)) {
+		editor_set_status("Still saving %s.", EFILENAME);
+		return 0;
+	}
 
 	if (!EDIRTY) {
 		editor_set_status("No changes to save.");
@@ -1322,48 +1630,197 @@ save_file(void)
 			editor_set_status("Save aborted.");
 			return 0;
 		}
+		CURBUF->compress = compress_by_name(EFILENAME);
 	}
 
-	buf = rows_to_buffer(&len);
-	fd = open(EFILENAME, O_RDWR | O_CREAT, 0644);
-	if (fd == -1) {
-		goto save_exit;
-	}
+	if (CURBUF->hex != NULL) {
+		if (hex_save(CURBUF, EFILENAME, editor.sync, &stats) == -1) {
+			editor_set_status("Error writing %s: %s", EFILENAME,
+			    strerror(errno));
+			return 1;
+		}
 
-	if (-1 == ftruncate(fd, len)) {
-		goto save_exit;
+		save_report(CURBUF, &stats);
+		EDIRTY = 0;
+		return 0;
 	}
 
-	if (len == 0) {
-		status = 0;
-		goto save_exit;
+	if (CURBUF->compress != COMPRESS_NONE) {
+		if (fileio_save_async(EFILENAME, CURBUF, editor.sync,
+		    editor.incremental) == -1) {
+			editor_set_status("Error writing %s: %s", EFILENAME,
+			    strerror(errno));
+			return 1;
+		}
+
+		editor_set_status("Saving %s...", EFILENAME);
+		return 0;
 	}
 
-	if ((ssize_t) len != write(fd, buf, len)) {
-		goto save_exit;
+	if (fileio_save(EFILENAME, CURBUF, editor.sync, editor.incremental,
+	    &stats) == -1) {
+		editor_set_status("Error writing %s: %s", EFILENAME,
+		    strerror(errno));
+		return 1;
 	}
 
-	status = 0;
+	save_report(CURBUF, &stats);
+	journal_discard(CURBUF);
+	reload_watch(CURBUF);
+	EDIRTY = 0;
+
+	return 0;
+}
 
-	save_exit:
-	if (fd) {
-		close(fd);
+
+void
+save_report(const buffer *b, const fileio_stats *stats)
+{
+	char	 of[32] = {0};
+
+	if (b->compress != COMPRESS_NONE) {
+		editor_set_status("Wrote %zu bytes to %s (%s, %zu), %.0f MB/s.",
+		    stats->raw, b->filename, compress_name(b->compress),
+		    stats->written,
+		    stats->ms > 0 ? (double)stats->raw / stats->ms / 1000.0 : 0);
+		return;
 	}
 
-	if (buf) {
-		free(buf);
-		buf = NULL;
+	/* in place, only part of the file may have been written */
+	if (!stats->atomic) {
+		snprintf(of, sizeof(of), " of %zu", stats->size);
 	}
 
-	if (status != 0) {
-		buf = strerror(errno);
-		editor_set_status("Error writing %s: %s", EFILENAME, buf);
+	if (editor.sync == SYNC_NONE) {
+		editor_set_status("Wrote %zu%s bytes to %s%s.", stats->written,
+		    of, b->filename, stats->atomic ? "" : " in place");
 	} else {
-		editor_set_status("Wrote %d bytes to %s.", len, EFILENAME);
-		EDIRTY = 0;
+		editor_set_status("Wrote %zu%s bytes to %s%s, sync %.1f ms.",
+		    stats->written, of, b->filename,
+		    stats->atomic ? "" : " in place", stats->sync_ms);
+	}
+}
+
+
+/*
+ * reload_tick brings clean buffers up to date when another program
+ * changes their files; a buffer with unsaved changes is only warned
+ * about. It returns 1 if there was anything to show.
+ */
+int
+reload_tick(void)
+{
+	buffer	*b       = NULL;
+	size_t	 changed = 0;
+	size_t	 i       = 0;
+	int	 shown   = 0;
+
+	for (i = 0; i < editor.bufcount; i++) {
+		b = editor.buffers[i];
+		if (reload_poll(b) != RELOAD_CHANGED) {
+			continue;
+		}
+
+		if (b->dirty) {
+			reload_own(b);
+		}
+
+		shown = 1;
+		if (b->dirty || reload_file(b, &changed) == -1) {
+			editor_set_status("%s changed on disk; C-k C-r reloads it.",
+			    b->filename);
+			continue;
+		}
+
+		/* later edits are journaled against the file as reloaded */
+		journal_discard(b);
+		if (changed > 0) {
+			editor_set_status("%s changed on disk; %zu line%s reloaded.",
+			    b->filename, changed, changed == 1 ? "" : "s");
+		}
+	}
+
+	if (guard_tripped()) {
+		editor_set_status("A file was cut short on disk; "
+		    "what it lost shows as zeros.");
+		shown = 1;
+	}
+
+	return shown;
+}
+
+
+/*
+ * save_collect reports a save of b that ran on the worker, if it has
+ * finished or wait is set. It returns what fileio_save_finish does.
+ */
+int
+save_collect(buffer *b, const int wait)
+{
+	fileio_stats	 stats;
+	int		 rv = 0;
+
+	rv = fileio_save_finish(b, wait, &stats);
+	if (rv == -1) {
+		editor_set_status("Error writing %s: %s", b->filename,
+		    strerror(errno));
+	} else if (rv == 1) {
+		save_report(b, &stats);
+		journal_discard(b);
+		b->dirty = 0;
+	}
+
+	return rv;
+}
+
+
+/*
+ * save_poll collects the saves that have finished in every buffer,
+ * returning 1 if there were any.
+ */
+int
+save_poll(const int wait)
+{
+	size_t	 i    = 0;
+	int	 done = 0;
+
+	for (i = 0; i < editor.bufcount; i++) {
+		if (save_collect(editor.buffers[i], wait) != 0) {
+			done = 1;
+		}
 	}
 
-	return status;
+	return done;
+}
+
+
+/*
+ * journal_idle writes out and syncs the edits made in every buffer
+ * since the editor was last idle.
+ */
+static void
+journal_idle(void)
+{
+	size_t	 i = 0;
+
+	for (i = 0; i < editor.bufcount; i++) {
+		journal_tick(editor.buffers[i]);
+	}
+}
+
+
+/*
+ * discard_journals throws away every buffer's journal on the way out,
+ * since quitting without saving is deliberate.
+ */
+static void
+discard_journals(void)
+{
+	size_t	 i = 0;
+
+	for (i = 0; i < editor.bufcount; i++) {
+		journal_discard(editor.buffers[i]);
+	}
 }
 
 
@@ -1612,7 +2069,7 @@ editor_find_callback(char* query, int16_t c)
 			}
 		}
 
-		row = &EROW[current];
+		row = &EROW(current);
 
 		/* Determine match based on direction. For forward searches, start just
 		 * after the current cursor when on the same row. For backward searches,
@@ -1688,6 +2145,11 @@ editor_find(void)
 	int	 sco   = ECOLOFFS;
 	int	 sro   = EROWOFFS;
 
+	/* While the file is still loading, search what is there so far. */
+	if (!buffer_loading(CURBUF)) {
+		buffer_index_all(CURBUF);
+	}
+
 	query = editor_prompt("Search (ESC to cancel): %s",
 	                      editor_find_callback);
 	if (query) {
@@ -1735,16 +2197,14 @@ int
 first_nonwhitespace(abuf *row)
 {
 	int		 pos;
-	wchar_t		 wc;
-	mbstate_t	 state;
+	uint32_t	 cp;
 	size_t		 len;
 
 	if (row == NULL) {
 		return 0;
 	}
 
-	memset(&state, 0, sizeof(state));
- pos = ECURX;
+	pos = ECURX;
 	if (pos > (int)row->size) {
 		pos = row->size;
 	}
@@ -1758,16 +2218,8 @@ first_nonwhitespace(abuf *row)
 			continue;
 		}
 
-		len = mbrtowc(&wc, &row->b[pos], row->size - pos, &state);
-		if (len == (size_t)-1 || len == (size_t)-2) {
-			break;
-		}
-
-		if (len == 0) {
-			break;
-		}
-
-		if (!iswspace(wc)) {
+		len = utf8_decode(&row->b[pos], row->size - pos, &cp);
+		if (len == 0 || !utf8_isspace(cp)) {
 			break;
 		}
 
@@ -1784,14 +2236,17 @@ move_cursor_once(const int16_t c, int interactive)
     abuf    *row  = NULL;
     int      reps = 0;
 
-	row = (ECURY >= ENROWS) ? NULL : &EROW[ECURY];
+	/* make sure there's a screenful of rows past the cursor */
+	buffer_index_rows(CURBUF, ECURY + editor.rows + 1);
+	buffer_gap_close(CURBUF);
+	row = (ECURY >= ENROWS) ? NULL : &EROW(ECURY);
 
 	switch (c) {
 		case ARROW_UP:
 		case CTRL_KEY('p'):
 			if (ECURY > 0) {
 				ECURY--;
-				row = (ECURY >= ENROWS) ? NULL : &EROW[ECURY];
+				row = (ECURY >= ENROWS) ? NULL : &EROW(ECURY);
 				if (interactive) {
 					ECURX = first_nonwhitespace(row);
 				} else if (row) {
@@ -1805,7 +2260,7 @@ move_cursor_once(const int16_t c, int interactive)
 		case CTRL_KEY('n'):
 			if (ECURY < ENROWS - 1) {
 				ECURY++;
-				row = (ECURY >= ENROWS) ? NULL : &EROW[ECURY];
+				row = (ECURY >= ENROWS) ? NULL : &EROW(ECURY);
 
 				if (interactive) {
 					ECURX = first_nonwhitespace(row);
@@ -1846,9 +2301,9 @@ move_cursor_once(const int16_t c, int interactive)
 				}
 			} else if (ECURY > 0) {
 				ECURY--;
-				ECURX = (int) EROW[ECURY].size;
+				ECURX = (int) EROW(ECURY).size;
 
-				row = &EROW[ECURY];
+				row = &EROW(ECURY);
 				while (ECURX > 0 &&
 				       ((unsigned char) row->b[ECURX] &
 					0xC0) == 0x80) {
@@ -1883,7 +2338,7 @@ move_cursor_once(const int16_t c, int interactive)
 			if (ECURY >= ENROWS) {
 				break;
 			}
-			ECURX = (int) EROW[ECURY].size;
+			ECURX = (int) EROW(ECURY).size;
 			break;
 		default:
 			break;
@@ -1908,6 +2363,7 @@ newline(void)
 	size_t	 rhs_len = 0;
 	char	*tmp     = NULL;
 
+	buffer_gap_close(CURBUF);
 	if (ECURY >= ENROWS) {
 		erow_insert(ECURY, "", 0);
 		ECURY++;
@@ -1918,28 +2374,30 @@ newline(void)
 		ECURX = 0;
 	} else {
 		/*
-		 * IMPORTANT: Do not keep a pointer to EROW[ECURY] across erow_insert(),
+		 * IMPORTANT: Do not keep a pointer to EROW(ECURY) across erow_insert(),
 		 * as erow_insert() may realloc the rows array and invalidate it.
 		 */
-		rhs_len = EROW[ECURY].size - (size_t)ECURX;
+		rhs_len = EROW(ECURY).size - (size_t)ECURX;
 		if (rhs_len > 0) {
 			tmp = malloc(rhs_len);
 			assert(tmp != NULL);
-			memcpy(tmp, &EROW[ECURY].b[ECURX], rhs_len);
+			memcpy(tmp, &EROW(ECURY).b[ECURX], rhs_len);
 		}
 
 		/* Insert the right-hand side as a new row first (may realloc rows). */
-		erow_insert(ECURY + 1, tmp ? tmp : "", (int)rhs_len);
+		erow_insert(ECURY + 1, tmp ? tmp : "", rhs_len);
 		if (tmp) {
 			free(tmp);
 		}
 
 		/* Now safely shrink the original row (re-fetch by index). */
-		EROW[ECURY].size = ECURX;
-		if (EROW[ECURY].cap <= EROW[ECURY].size) {
-			ab_resize(&EROW[ECURY], EROW[ECURY].size + 1);
+		journal_delete(CURBUF, ECURY, ECURX, rhs_len);
+		EROW(ECURY).size = ECURX;
+		if (EROW(ECURY).cap <= EROW(ECURY).size) {
+			ab_resize(&EROW(ECURY), EROW(ECURY).size + 1);
 		}
-		EROW[ECURY].b[EROW[ECURY].size] = '\0';
+		EROW(ECURY).b[EROW(ECURY).size] = '\0';
+		buffer_row_resized(CURBUF, ECURY, ECURX + rhs_len);
 
 		ECURY++;
 		ECURX = 0;
@@ -2006,23 +2464,35 @@ process_kcommand(const int16_t c)
 	size_t	 len   = 0;
 	int	 jumpx = 0;
 	int	 jumpy = 0;
+	size_t	 changed = 0;
 	int	 reps  = 0;
+	int	 hex   = 0;
+	size_t	 frames = 0;
+	size_t	 bytes  = 0;
 
 	switch (c) {
 		case BACKSPACE:
+			if (refuse_readonly()) {
+				break;
+			}
+
 			while (ECURX > 0) {
 				process_normal(BACKSPACE);
 			}
 			break;
 		case '=':
-			if (EMARK_SET) {
+			if (refuse_readonly()) {
+				break;
+			} else if (EMARK_SET) {
 				indent_region();
 			} else {
 				editor_set_status("Mark not set.");
 			}
 			break;
 		case '-':
-			if (EMARK_SET) {
+			if (refuse_readonly()) {
+				break;
+			} else if (EMARK_SET) {
 				unindent_region();
 			} else {
 				editor_set_status("Mark not set.");
@@ -2039,7 +2509,10 @@ process_kcommand(const int16_t c)
 			/* FALLTHRU */
 		case '!':
 			/* useful for debugging */
-			editor_set_status("PID: %ld", (long) getpid());
+			screen_stats(&frames, &bytes, &len);
+			editor_set_status("PID: %ld; %zu frames, %zu bytes, "
+			    "%zu in the last", (long) getpid(), frames, bytes,
+			    len);
 			break;
 		case ' ':
 			toggle_markset();
@@ -2057,6 +2530,10 @@ process_kcommand(const int16_t c)
 			buffer_close_current();
 			break;
 		case 'd':
+			if (refuse_readonly()) {
+				break;
+			}
+
 			if (ECURX == 0 && cursor_at_eol()) {
 				delete_row(ECURY);
 				return;
@@ -2064,7 +2541,7 @@ process_kcommand(const int16_t c)
 
 			reps = uarg_get();
 			while (reps--) {
-				while ((EROW[ECURY].size - ECURX) > 0) {
+				while ((EROW(ECURY).size - ECURX) > 0) {
 					process_normal(DEL_KEY);
 				}
 				if (reps) {
@@ -2077,7 +2554,7 @@ process_kcommand(const int16_t c)
 		case CTRL_KEY('d'):
 			reps = uarg_get();
 
-			while (reps--) {
+			while (reps-- && !refuse_readonly()) {
 				delete_row(ECURY);
 			}
 			break;
@@ -2113,6 +2590,12 @@ process_kcommand(const int16_t c)
 		case 'g':
 			goto_line();
 			break;
+		case 'h':
+			toggle_hex();
+			break;
+		case 't':
+			toggle_follow();
+			break;
 		case 'j':
 			if (!EMARK_SET) {
 				editor_set_status("Mark not set.");
@@ -2135,6 +2618,7 @@ process_kcommand(const int16_t c)
 			break;
 		case 'm':
 			/* todo: fix the process failed: success issue */
+			screen_invalidate();
 			if (system("make") != 0) {
 				editor_set_status(
 					"process failed: %s",
@@ -2150,8 +2634,10 @@ process_kcommand(const int16_t c)
 				editor.dirtyex = 0;
 				return;
 			}
+			discard_journals();
 			exit(0);
 		case CTRL_KEY('q'):
+			discard_journals();
 			exit(0);
 		case CTRL_KEY('r'):
 			if (EDIRTY && editor.dirtyex) {
@@ -2160,16 +2646,25 @@ process_kcommand(const int16_t c)
 				return;
 			}
 
+			/* patch in just the lines that changed if possible */
+			journal_discard(CURBUF);
+			if (reload_file(CURBUF, &changed) == 0) {
+				editor_set_status("Reloaded %s, %zu line%s changed.",
+				    EFILENAME, changed, changed == 1 ? "" : "s");
+				break;
+			}
+
 			jumpx = ECURX;
-			jumpy = ECURY;
+			jumpy = view_line(CURBUF, ECURY);
 			buf = strdup(EFILENAME);
+			hex = (CURBUF->hex != NULL) ? HEX_ON : HEX_AUTO;
 
 			reset_editor();
-			open_file(buf);
+			open_file_as(buf, hex);
 			display_refresh();
 			free(buf);
 
-			jump_to_position(jumpx, jumpy);
+			jump_to_position(jumpx, view_row(CURBUF, jumpy));
 			editor_set_status("file reloaded");
 			break;
 		case CTRL_KEY('s'):
@@ -2178,7 +2673,8 @@ process_kcommand(const int16_t c)
 			break;
 		case CTRL_KEY('x'):
 		case 'x':
-			exit(save_file());
+			/* a compressed file is still being written */
+			exit(save_file() || save_collect(CURBUF, 1) == -1);
 		case 'u':
 			reps = uarg_get();
 
@@ -2194,7 +2690,7 @@ process_kcommand(const int16_t c)
 		case 'y':
 			reps = uarg_get();
 
-			while (reps--) {
+			while (reps-- && !refuse_readonly()) {
 				killring_yank();
 			}
 			break;
@@ -2243,7 +2739,9 @@ process_normal(int16_t c)
 
 	switch (c) {
 	case '\r':
-		newline();
+		if (!refuse_readonly()) {
+			newline();
+		}
 		break;
 	case CTRL_KEY('k'):
 		editor.mode = MODE_KCOMMAND;
@@ -2252,7 +2750,9 @@ process_normal(int16_t c)
 	case CTRL_KEY('h'):
 	case CTRL_KEY('d'):
 	case DEL_KEY:
-		if (c == DEL_KEY || c == CTRL_KEY('d')) {
+		if (refuse_readonly()) {
+			break;
+		} else if (c == DEL_KEY || c == CTRL_KEY('d')) {
 			reps = uarg_get();
 			while (reps-- > 0) {
 				move_cursor(ARROW_RIGHT, 1);
@@ -2276,8 +2776,9 @@ process_normal(int16_t c)
 	case CTRL_KEY('g'):
 		break;
 	case CTRL_KEY('l'):
+		screen_invalidate();
 		if (get_winsz(&rows, &cols) == 0) {
-			editor.rows = rows;
+			editor.rows = rows - 2;	/* status bar, message line */
 			editor.cols = cols;
 		} else {
 			editor_set_status("Couldn't update window size.");
@@ -2288,6 +2789,10 @@ process_normal(int16_t c)
 		editor_find();
 		break;
 	case CTRL_KEY('w'):
+		if (refuse_readonly()) {
+			break;
+		}
+
 		kill_region();
 		delete_region();
 		toggle_markset();
@@ -2295,7 +2800,7 @@ process_normal(int16_t c)
 	case CTRL_KEY('y'):
 		reps = uarg_get();
 
-		while (reps-- > 0) {
+		while (reps-- > 0 && !refuse_readonly()) {
 			killring_yank();
 		}
 		break;
@@ -2303,6 +2808,11 @@ process_normal(int16_t c)
 		editor.mode = MODE_ESCAPE;
 		break;
 	default:
+		if ((c == TAB_KEY || (c >= 0x20 && c != 0x7f)) &&
+		    refuse_readonly()) {
+			break;
+		}
+
 		if (c == TAB_KEY) {
 			reps = uarg_get();
 
@@ -2332,11 +2842,19 @@ process_escape(const int16_t c)
 
 	switch (c) {
 		case '>':
-			ECURY = ENROWS;
+			if (CURBUF->hex != NULL) {
+				hex_seek(CURBUF, SIZE_MAX);
+				break;
+			}
+			ECURY = view_row(CURBUF, SIZE_MAX);
 			ECURX = 0;
 			break;
 		case '<':
-			ECURY = 0;
+			if (CURBUF->hex != NULL) {
+				hex_seek(CURBUF, 0);
+				break;
+			}
+			ECURY = view_row(CURBUF, 0);
 			ECURX = 0;
 			break;
 		case 'b':
@@ -2349,7 +2867,7 @@ process_escape(const int16_t c)
 		case 'd':
 			reps = uarg_get();
 
-			while (reps--) {
+			while (reps-- && !refuse_readonly()) {
 				delete_next_word();
 			}
 			break;
@@ -2374,7 +2892,7 @@ process_escape(const int16_t c)
 		case BACKSPACE:
 			reps = uarg_get();
 
-			while (reps--) {
+			while (reps-- && !refuse_readonly()) {
 				delete_prev_word();
 			}
 			break;
@@ -2398,13 +2916,24 @@ process_keypress(void)
 		return 0;
 	}
 
+	/* keep the cursor well inside a view's window for this key */
+	view_settle(CURBUF, editor.rows);
+
+	/* only typing and backspacing leave a row's gap open */
+	if (editor.mode != MODE_NORMAL || !(c == TAB_KEY || c == BACKSPACE ||
+	    c == CTRL_KEY('h') || (c >= 0x20 && c <= 0xff))) {
+		buffer_gap_close(CURBUF);
+	}
+
 	switch (editor.mode) {
 	case MODE_KCOMMAND:
 		process_kcommand(c);
 		editor.mode = MODE_NORMAL;
 		break;
 	case MODE_NORMAL:
-		process_normal(c);
+		if (CURBUF->hex == NULL || !hex_key(CURBUF, c, editor.rows)) {
+			process_normal(c);
+		}
 		break;
 	case MODE_ESCAPE:
 		process_escape(c);
@@ -2505,17 +3034,18 @@ dump_pidfile(void)
 void
 draw_rows(abuf *ab)
 {
-	abuf	*row              = NULL;
 	char	 buf[editor.cols];
-	char	 c                = 0;
-	size_t	 j                = 0;
 	size_t	 filerow          = 0;
 	size_t	 y                = 0;
 	size_t	 len              = 0;
 	size_t	 padding          = 0;
-	size_t	 printed          = 0;
-	size_t	 rx               = 0;
 
+	if (CURBUF->hex != NULL) {
+		hex_draw(CURBUF, ab, editor.rows, editor.cols);
+		return;
+	}
+
+	render_frame(editor.rows);
 	for (y = 0; y < editor.rows; y++) {
 		filerow = y + EROWOFFS;
 		if (filerow >= ENROWS) {
@@ -2538,42 +3068,7 @@ draw_rows(abuf *ab)
 				ab_append(ab, "|", 1);
 			}
 		} else {
-			row = &EROW[filerow];
-			j = 0;
-			rx = printed = 0;
-
-			while (j < row->size && printed < editor.cols) {
-				c = row->b[j];
-
-				if (rx < ECOLOFFS) {
-					if (c == '\t') rx += (TAB_STOP - (rx % TAB_STOP));
-					else if (c < 0x20) rx += 3;
-					else rx++;
-					j++;
-					continue;
-				}
-
-				if (c == '\t') {
-					int sp = TAB_STOP - (rx % TAB_STOP);
-					for (int k = 0; k < sp && printed < editor.cols; k++) {
-						ab_appendch(ab, ' ');
-						printed++;
-						rx++;
-					}
-				} else if (c < 0x20) {
-					char seq[4];
-					snprintf(seq, sizeof(seq), "\\%02x", c);
-					ab_append(ab, seq, 3);
-					printed += 3;
-					rx += 3;
-				} else {
-					ab_appendch(ab, c);
-					printed++;
-					rx++;
-				}
-				j++;
-			}
-			len = printed;
+			render_row(ab, CURBUF, filerow, ECOLOFFS, editor.cols);
 		}
 		ab_append(ab, ESCSEQ "K", 3);
 		ab_append(ab, "\r\n", 2);
@@ -2605,32 +3100,51 @@ draw_status_bar(abuf *ab)
 	char	 mstatus[editor.cols];
 	size_t	 len                   = 0;
 	size_t	 rlen                  = 0;
-
-	len = snprintf(status,
-		       sizeof(status),
-		       "%c%cke: %.20s - %lu lines",
-		       status_mode_char(),
-		       EDIRTY ? '!' : '-',
-		       EFILENAME ? EFILENAME : "[no file]",
-                ENROWS);
-
-	if (EMARK_SET) {
-		snprintf(mstatus,
-		         sizeof(mstatus),
-		         " | M: %lu, %lu ",
-		         EMARK_CURX + 1,
-		         EMARK_CURY + 1);
+	size_t	 nlines                = 0;
+
+	if (CURBUF->hex != NULL) {
+		len = snprintf(status,
+			       sizeof(status),
+			       "%c%cke: %.20s - hex, %zu bytes",
+			       status_mode_char(),
+			       EDIRTY ? '!' : '-',
+			       EFILENAME ? EFILENAME : "[no file]",
+			       hex_size(CURBUF));
+		rlen = snprintf(rstatus,
+		                sizeof(rstatus),
+		                "0x%zx ",
+		                hex_offset(CURBUF));
 	} else {
-		snprintf(mstatus, sizeof(mstatus), " | M:clear ");
-	}
+		nlines = view_nlines(CURBUF, 0);
+		len = snprintf(status,
+			       sizeof(status),
+			       "%c%cke: %.20s - %s%s%lu%s lines",
+			       status_mode_char(),
+			       EDIRTY ? '!' : '-',
+			       EFILENAME ? EFILENAME : "[no file]",
+			       buffer_loading(CURBUF) ? "loading... " : "",
+			       follow_active(CURBUF) ? "following, " : "",
+			       nlines,
+			       view_indexed(CURBUF) ? "" : "+");
+
+		if (EMARK_SET) {
+			snprintf(mstatus,
+			         sizeof(mstatus),
+			         " | M: %lu, %lu ",
+			         EMARK_CURX + 1,
+			         view_line(CURBUF, EMARK_CURY) + 1);
+		} else {
+			snprintf(mstatus, sizeof(mstatus), " | M:clear ");
+		}
 
-	rlen = snprintf(rstatus,
-	                sizeof(rstatus),
-	                "L%lu/%lu C%lu %s",
-	                ECURY + 1,
-	                ENROWS,
-	                ECURX + 1,
-	                mstatus);
+		rlen = snprintf(rstatus,
+		                sizeof(rstatus),
+		                "L%lu/%lu C%lu %s",
+		                view_line(CURBUF, ECURY) + 1,
+		                nlines,
+		                ECURX + 1,
+		                mstatus);
+	}
 
 	ab_append(ab, ESCSEQ "7m", 4);
 	ab_append(ab, status, len);
@@ -2667,12 +3181,17 @@ draw_message_line(abuf *ab)
 void
 scroll(void)
 {
-	const abuf	*row = NULL;
+	if (CURBUF->hex != NULL) {
+		hex_scroll(CURBUF, editor.rows);
+		return;
+	}
+
+	buffer_index_rows(CURBUF, ECURY + editor.rows);
+	view_settle(CURBUF, editor.rows);
 
 	ERX = 0;
 	if (ECURY < ENROWS) {
-		row = &EROW[ECURY];
-		ERX = erow_render_to_cursor(row, ECURX);
+		ERX = cols_at(CURBUF, ECURY, ECURX);
 	}
 
 	if (ECURY < EROWOFFS) {
@@ -2696,30 +3215,29 @@ scroll(void)
 void
 display_refresh(void)
 {
-	char	 buf[32] = {0};
-	abuf	 ab      = ABUF_INIT;
+	ABUF_INLINE(FRAME_INLINE)	 frame;
+	abuf	*ab      = &frame.ab;
+	size_t	 y       = 0;
+	size_t	 x       = 0;
 
 	scroll();
 
-	ab_append(&ab, ESCSEQ "?25l", 6);
-	ab_append(&ab, ESCSEQ "H", 3);
-	display_clear(&ab);
+	ab_init_inline(ab, sizeof(frame.store));
 
-	draw_rows(&ab);
-	draw_status_bar(&ab);
-	draw_message_line(&ab);
+	draw_rows(ab);
+	draw_status_bar(ab);
+	draw_message_line(ab);
 
-	snprintf(buf,
-	         sizeof(buf),
-	         ESCSEQ "%lu;%luH",
-	         (ECURY - EROWOFFS) + 1,
-	         (ERX - ECOLOFFS) + 1);
-	ab_append(&ab, buf, kstrnlen(buf, 32));
-	/* ab_append(&ab, ESCSEQ "1;2H", 7); */
-	ab_append(&ab, ESCSEQ "?25h", 6);
+	if (CURBUF->hex != NULL) {
+		hex_cursor(CURBUF, &y, &x);
+	} else {
+		y = ECURY - EROWOFFS;
+		x = ERX - ECOLOFFS;
+	}
 
-	kwrite(STDOUT_FILENO, ab.b, (int)ab.size);
-	ab_free(&ab);
+	/* only what changed since the last frame is sent */
+	screen_update(ab, y, x);
+	ab_free(ab);
 }
 
 
@@ -2762,6 +3280,14 @@ loop(void)
 			while (kbhit()) {
 				process_keypress();
 			}
+			continue;
+		}
+
+		/* Keypresses time out, so this ticks while loading. */
+		journal_idle();
+		if (buffer_poll(CURBUF) || view_poll(CURBUF) ||
+		    save_poll(0) || follow_tick() || reload_tick()) {
+			up = 1;
 		}
 	}
 }
@@ -2777,6 +3303,8 @@ enable_debugging(void)
 void
 deathknell(void)
 {
+	size_t	 i = 0;
+
 	fflush(stderr);
 
 	if (editor.killring != NULL) {
@@ -2785,19 +3313,37 @@ deathknell(void)
 		editor.killring = NULL;
 	}
 
+	/* let saves on the worker finish rather than leave temp files */
+	(void)save_poll(1);
+
+	/* whatever wasn't saved stays in the journals */
+	for (i = 0; i < editor.bufcount; i++) {
+		journal_close(editor.buffers[i]);
+	}
 	reset_editor();
 	disable_termraw();
 }
 
 
+/*
+ * signal_handler only puts the terminal back before dying. Nothing
+ * else is safe here: the signal may have come from the loader or a
+ * save on a worker thread, or while the allocator's lock was held.
+ * The journals keep what was written out at the last idle moment.
+ */
 static void
 signal_handler(int sig)
 {
-	signal(sig, SIG_DFL);
+	char	 msg[] = "caught signal   \n";
+	ssize_t	 nw    = 0;
 
-	fprintf(stderr, "caught signal %d\n", sig);
+	signal(sig, SIG_DFL);
 
-	deathknell();
+	restore_term();
+	msg[14] = (char)('0' + sig / 10 % 10);
+	msg[15] = (char)('0' + sig % 10);
+	nw = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	(void)nw;
 
 	raise(sig);
 	_exit(127 + sig);
@@ -2845,12 +3391,32 @@ main(int argc, char *argv[])
 	int		 first_loaded = 0;   /* has a filed been loaded already? */
 
 	install_signal_handlers();
+	guard_init();
 
-	while ((opt = getopt(argc, argv, "df:")) != -1) {
-		if (opt == 'd') {
+	while ((opt = getopt(argc, argv, "Cdf:FIm:Rs:x")) != -1) {
+		if (opt == 'C') {
+			editor.linecache = 0;
+		} else if (opt == 'd') {
 			debug = 1;
+		} else if (opt == 'F') {
+			editor.follow = 1;
+		} else if (opt == 'I') {
+			editor.incremental = 1;
+		} else if (opt == 'R') {
+			editor.viewer = 1;
+		} else if (opt == 'x') {
+			editor.hex = 1;
+		} else if (opt == 'm' && strtoul(optarg, NULL, 10) > 0) {
+			editor.viewmem = strtoul(optarg, NULL, 10) << 20;
+		} else if (opt == 's' && strcmp(optarg, "none") == 0) {
+			editor.sync = SYNC_NONE;
+		} else if (opt == 's' && strcmp(optarg, "data") == 0) {
+			editor.sync = SYNC_DATA;
+		} else if (opt == 's' && strcmp(optarg, "full") == 0) {
+			editor.sync = SYNC_FULL;
 		} else {
-			fprintf(stderr, "Usage: ke [-d] [-f logfile] [ +N ] [file ...]\n");
+			fprintf(stderr, "Usage: ke [-CdFIRx] [-f logfile] [-m megabytes] "
+			    "[-s none|data|full] [ +N ] [file ...]\n");
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -2858,7 +3424,6 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	setlocale(LC_ALL, "");
 	if (debug) {
 		enable_debugging();
 	}
@@ -2886,8 +3451,12 @@ main(int argc, char *argv[])
 
 		if (!first_loaded) {
 			open_file(arg);
+			if (editor.follow) {
+				follow_file();
+			}
 			if (pending_line > 0) {
-				jump_to_position(0, pending_line - 1);
+				jump_to_position(0,
+				    view_row(CURBUF, pending_line - 1));
 				pending_line = 0;
 			}
 
@@ -2897,8 +3466,12 @@ main(int argc, char *argv[])
 			nb = buffer_add_empty();
 			buffer_switch(nb);
 			open_file(arg);
+			if (editor.follow) {
+				follow_file();
+			}
 			if (pending_line > 0) {
-				jump_to_position(0, pending_line - 1);
+				jump_to_position(0,
+				    view_row(CURBUF, pending_line - 1));
 				pending_line = 0;
 			}
 
@@ -2906,7 +3479,10 @@ main(int argc, char *argv[])
 		}
 	}
 
-	editor_set_status("C-k q to exit / C-k d to dump core");
+	/* don't hide what opening the files had to say */
+	if (editor.msg[0] == '\0') {
+		editor_set_status("C-k q to exit / C-k d to dump core");
+	}
 
 	display_clear(NULL);
 	loop();
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""
+mkwidths.py - write widths.h, the column widths utf8.c looks up
+
+Each code point gets 0, 1 or 2 columns, packed four to a byte in
+blocks of 256 code points; identical blocks are stored once, and a
+first-level table picks the block for each 256. The widths come from
+the Unicode data Python was built with:
+
+  - nonspacing and enclosing marks, format characters other than the
+    soft hyphen and the prepended marks, and the Hangul medial and
+    final jamo take none;
+  - East Asian wide and fullwidth characters take two, as do the
+    unassigned code points of the CJK planes;
+  - everything else takes one, including other unassigned code points,
+    the way ke has always shown a character it can't place.
+
+Run it with "make widths" and check in the result; building ke doesn't
+need Python.
+"""
+
+import sys
+import unicodedata
+
+BLOCK = 256
+NCODES = 0x110000
+
+
+# format characters that show, ahead of the digits they go with
+PREPENDED = set(range(0x600, 0x606)) | {0x6DD, 0x70F, 0x890, 0x891, 0x8E2,
+                                         0x110BD, 0x110CD}
+
+
+def width(cp):
+    if cp == 0xAD or cp in PREPENDED:
+        return 1
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF or cp == 0x200B:
+        return 0
+
+    c = chr(cp)
+    cat = unicodedata.category(c)
+    if cat == "Cn":
+        # Python has no width for these; the CJK planes default to wide
+        return 2 if 0x20000 <= cp <= 0x3FFFD else 1
+    if cat in ("Mn", "Me", "Cf"):
+        return 0
+    if unicodedata.east_asian_width(c) in ("W", "F"):
+        return 2
+    return 1
+
+
+def main():
+    blocks = []
+    index = {}
+    first = []
+
+    for start in range(0, NCODES, BLOCK):
+        packed = bytearray(BLOCK // 4)
+        for i in range(BLOCK):
+            packed[i // 4] |= width(start + i) << (2 * (i % 4))
+        packed = bytes(packed)
+        if packed not in index:
+            index[packed] = len(blocks)
+            blocks.append(packed)
+        first.append(index[packed])
+
+    assert len(blocks) <= 256
+
+    out = sys.stdout
+    out.write("/*\n")
+    out.write(" * widths.h - generated by mkwidths.py from Unicode %s;"
+              " don't edit\n" % unicodedata.unidata_version)
+    out.write(" */\n\n")
+    out.write("#define\tWIDTHS_UNICODE\t\"%s\"\n\n\n"
+              % unicodedata.unidata_version)
+
+    out.write("static const uint8_t widths_first[%d] = {\n" % len(first))
+    for i in range(0, len(first), 16):
+        out.write("\t" + ", ".join("%3d" % b for b in first[i:i + 16])
+                  + ",\n")
+    out.write("};\n\n\n")
+
+    out.write("static const uint8_t widths_block[%d][%d] = {\n"
+              % (len(blocks), BLOCK // 4))
+    for packed in blocks:
+        out.write("\t{\n")
+        for i in range(0, len(packed), 8):
+            out.write("\t\t" + ", ".join("0x%02x" % b
+                                         for b in packed[i:i + 8]) + ",\n")
+        out.write("\t},\n")
+    out.write("};\n")
+
+
+if __name__ == "__main__":
+    main()
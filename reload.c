@@ -0,0 +1,809 @@
+/*
+ * reload.c - picking up changes made to a buffer's file on disk
+ *
+ * Reading a changed file in again from scratch loses the cursor and
+ * the mark, and costs a full load however little changed. Instead,
+ * the lines the buffer and the file still share at the start and at
+ * the end are matched straight against the new file, the lines left
+ * between them are hashed and diffed, and only the runs of rows that
+ * differ are replaced.
+ *
+ * On Linux the file's directory is watched with inotify, which sees
+ * both a file rewritten in place and one replaced by a rename;
+ * elsewhere the file is checked with stat(2) each time the editor is
+ * idle.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "core.h"
+#include "follow.h"
+#include "guard.h"
+#include "reload.h"
+#include "scan.h"
+
+
+#define	RELOAD_LINES	4096		/* lines split out per scan */
+#define	DIFF_MAXD	1024		/* most edits the diff looks for */
+
+
+struct reload {
+	char		*path;
+	const char	*name;		/* the file's name in its directory */
+	int		 ifd;		/* inotify descriptor, or -1 */
+	struct stat	 st;		/* the file as it was read or saved */
+};
+
+
+/* a row or a line of the new file, as the diff sees it */
+struct line {
+	const char	*p;		/* NULL if the row can't be read */
+	size_t		 len;
+	uint64_t	 h;
+};
+
+
+/* old rows o..o+on replaced by new lines n..n+nn */
+struct hunk {
+	size_t	 o, on;
+	size_t	 n, nn;
+};
+
+
+#ifdef __linux__
+/*
+ * watch sets up inotify on the file's directory, which hears about
+ * the file being written in place as well as about a new file being
+ * renamed over it.
+ */
+static void
+watch(struct reload *r)
+{
+	char	 dir[PATH_MAX];
+
+	r->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (r->ifd == -1) {
+		return;
+	}
+
+	if (r->name == r->path) {
+		strcpy(dir, ".");
+	} else if (r->name == r->path + 1) {
+		strcpy(dir, "/");
+	} else if ((size_t)(r->name - r->path) <= sizeof(dir)) {
+		memcpy(dir, r->path, (size_t)(r->name - r->path) - 1);
+		dir[r->name - r->path - 1] = '\0';
+	} else {
+		dir[0] = '\0';
+	}
+
+	if (dir[0] == '\0' || inotify_add_watch(r->ifd, dir,
+	    IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		close(r->ifd);
+		r->ifd = -1;
+	}
+}
+
+
+/*
+ * changed empties the inotify queue, returning 1 if any of it was
+ * about the file.
+ */
+static int
+changed(struct reload *r)
+{
+	union {
+		struct inotify_event	 ev;
+		char			 buf[4096];
+	} u;
+	const struct inotify_event	*ev  = NULL;
+	ssize_t				 nr  = 0;
+	size_t				 off = 0;
+	int				 any = 0;
+
+	while ((nr = read(r->ifd, u.buf, sizeof(u.buf))) > 0) {
+		for (off = 0; off < (size_t)nr;
+		    off += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)(u.buf + off);
+			if ((ev->mask & IN_Q_OVERFLOW) ||
+			    (ev->len > 0 && strcmp(ev->name, r->name) == 0)) {
+				any = 1;
+			}
+		}
+	}
+
+	return any;
+}
+#else
+static void
+watch(struct reload *r)
+{
+	r->ifd = -1;
+}
+
+
+static int
+changed(struct reload *r)
+{
+	(void)r;
+	return 1;
+}
+#endif
+
+
+/*
+ * reload_watch starts watching b's file, or notes that it has just
+ * been saved. Only plain text buffers are watched.
+ */
+void
+reload_watch(buffer *b)
+{
+	struct reload	*r     = b->reload;
+	char		*slash = NULL;
+
+	if (b->filename == NULL || b->hex != NULL || b->view != NULL ||
+	    b->compress != COMPRESS_NONE) {
+		return;
+	}
+
+	if (r == NULL) {
+		r = calloc(1, sizeof(*r));
+		if (r == NULL) {
+			return;
+		}
+
+		r->path = strdup(b->filename);
+		if (r->path == NULL) {
+			free(r);
+			return;
+		}
+
+		slash   = strrchr(r->path, '/');
+		r->name = (slash == NULL) ? r->path : slash + 1;
+		watch(r);
+		b->reload = r;
+	}
+
+	if (stat(r->path, &r->st) == -1) {
+		memset(&r->st, 0, sizeof(r->st));
+	}
+}
+
+
+void
+reload_stop(buffer *b)
+{
+	struct reload	*r = b->reload;
+
+	if (r == NULL) {
+		return;
+	}
+
+	if (r->ifd != -1) {
+		close(r->ifd);
+	}
+
+	free(r->path);
+	free(r);
+	b->reload = NULL;
+}
+
+
+/*
+ * reload_poll reports whether b's file has changed since it was read
+ * or saved; each change is reported once. Nothing is looked at while
+ * the buffer is loading or being followed.
+ */
+int
+reload_poll(buffer *b)
+{
+	struct reload	*r = b->reload;
+	struct stat	 st;
+
+	if (r == NULL || buffer_loading(b) || follow_active(b)) {
+		return RELOAD_IDLE;
+	}
+
+	if (r->ifd != -1 && !changed(r)) {
+		return RELOAD_IDLE;
+	}
+
+	/* a file being replaced may be missing for a moment */
+	if (stat(r->path, &st) == -1 || kstat_same(&st, &r->st, 0)) {
+		return RELOAD_IDLE;
+	}
+
+	r->st = st;
+	return RELOAD_CHANGED;
+}
+
+
+/*
+ * readable reports whether a row can be looked at. A row still in the
+ * mapping of a file that has since been cut short in place may lie
+ * past its new end, where reading it would fault.
+ */
+static int
+readable(const buffer *b, const abuf *row, const size_t lim)
+{
+	return !ab_borrowed(row) || b->map == NULL ||
+	    row->b < b->map || row->b >= b->map + b->maplen ||
+	    (size_t)(row->b - b->map) + row->size <= lim;
+}
+
+
+/*
+ * reload_own copies the rows of b that are still read from its mapping
+ * into memory of b's own, once the file has been changed in place by
+ * something else. A buffer with unsaved changes keeps its rows through
+ * whatever is done to the file after that; those already past the new
+ * end read as zeros, which guard.c puts there rather than faulting.
+ */
+void
+reload_own(buffer *b)
+{
+	struct reload	*r   = b->reload;
+	abuf		*row = NULL;
+	size_t		 lim = 0;
+	size_t		 i   = 0;
+	size_t		 j   = 0;
+	size_t		 n   = 0;
+
+	/* a file that was replaced leaves the old one whole under the map */
+	if (r == NULL || b->map == NULL || r->st.st_dev != b->mapst.st_dev ||
+	    r->st.st_ino != b->mapst.st_ino) {
+		return;
+	}
+
+	lim = (size_t)r->st.st_size;
+	for (i = 0; i < b->nrows; i += n) {
+		row = buffer_rows_at(b, i, &n);
+		for (j = 0; j < n; j++) {
+			if (ab_borrowed(&row[j]) && row[j].b >= b->map &&
+			    row[j].b < b->map + b->maplen &&
+			    readable(b, &row[j], lim)) {
+				buffer_copy_row(b, &row[j], row[j].b,
+				    row[j].size);
+			}
+		}
+	}
+}
+
+
+/*
+ * head_match reports whether row is the line at off in the new file,
+ * and sets next to where the line after it starts.
+ */
+static int
+head_match(const abuf *row, const char *map, const size_t len,
+    const size_t off, size_t *next)
+{
+	size_t	 e = 0;
+
+	if (row->size > len - off ||
+	    memcmp(map + off, row->b, row->size) != 0) {
+		return 0;
+	}
+
+	e = off + row->size;
+	while (e < len && map[e] == '\r') {
+		e++;
+	}
+
+	if (e < len && map[e] != '\n') {
+		return 0;
+	}
+
+	*next = (e < len) ? e + 1 : len;
+	return 1;
+}
+
+
+/*
+ * tail_match reports whether row is the last line in the part of the
+ * new file from off to end, and sets start to where that line starts.
+ */
+static int
+tail_match(const abuf *row, const char *map, const size_t off,
+    const size_t end, size_t *start)
+{
+	size_t	 e = end;
+
+	if (map[e - 1] == '\n') {
+		e--;
+	}
+
+	while (e > off && map[e - 1] == '\r') {
+		e--;
+	}
+
+	if (row->size > e - off ||
+	    memcmp(map + e - row->size, row->b, row->size) != 0) {
+		return 0;
+	}
+
+	e -= row->size;
+	if (e > off && map[e - 1] != '\n') {
+		return 0;
+	}
+
+	*start = e;
+	return 1;
+}
+
+
+static uint64_t
+hash(const char *p, size_t len)
+{
+	uint64_t	 h = 14695981039346656037ULL;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*p++;
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+
+static int
+same(const struct line *a, const struct line *b)
+{
+	return a->p != NULL && a->h == b->h && a->len == b->len &&
+	    memcmp(a->p, b->p, a->len) == 0;
+}
+
+
+/*
+ * diff finds a shortest edit script turning a into b (Myers' greedy
+ * algorithm) and marks the lines it keeps in ka and kb. It gives up,
+ * returning -1, if that takes more than DIFF_MAXD edits.
+ */
+static int
+diff(const struct line *a, const long n, const struct line *b,
+    const long m, char *ka, char *kb)
+{
+	long	**trace = NULL;
+	long	 *v     = NULL;
+	long	 *t     = NULL;
+	long	  lim   = n + m < DIFF_MAXD ? n + m : DIFF_MAXD;
+	long	  off   = lim + 1;
+	long	  d     = 0;
+	long	  k     = 0;
+	long	  pk    = 0;
+	long	  x     = 0;
+	long	  y     = 0;
+	long	  px    = 0;
+	long	  py    = 0;
+	int	  rv    = -1;
+
+	v     = calloc((size_t)(2 * lim + 3), sizeof(*v));
+	trace = calloc((size_t)(lim + 1), sizeof(*trace));
+	if (v == NULL || trace == NULL) {
+		goto diff_done;
+	}
+
+	for (d = 0; d <= lim; d++) {
+		/* v as this round starts, for diagonals -d-1 to d+1 */
+		trace[d] = malloc((size_t)(2 * d + 3) * sizeof(**trace));
+		if (trace[d] == NULL) {
+			goto diff_done;
+		}
+		memcpy(trace[d], &v[off - d - 1],
+		    (size_t)(2 * d + 3) * sizeof(**trace));
+
+		for (k = -d; k <= d; k += 2) {
+			if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1])) {
+				x = v[off + k + 1];
+			} else {
+				x = v[off + k - 1] + 1;
+			}
+
+			y = x - k;
+			while (x < n && y < m && same(&a[x], &b[y])) {
+				x++;
+				y++;
+			}
+			v[off + k] = x;
+
+			if (x >= n && y >= m) {
+				goto diff_found;
+			}
+		}
+	}
+	goto diff_done;
+
+diff_found:
+	/* walk back through the rounds, marking the diagonals */
+	x = n;
+	y = m;
+	for (; d >= 0; d--) {
+		t = trace[d] + d + 1;
+		k = x - y;
+		if (k == -d || (k != d && t[k - 1] < t[k + 1])) {
+			pk = k + 1;
+		} else {
+			pk = k - 1;
+		}
+
+		px = t[pk];
+		py = px - pk;
+		while (x > px && y > py) {
+			x--;
+			y--;
+			ka[x] = 1;
+			kb[y] = 1;
+		}
+
+		x = px;
+		y = py;
+	}
+	rv = 0;
+
+diff_done:
+	if (trace != NULL) {
+		for (d = 0; d <= lim; d++) {
+			free(trace[d]);
+		}
+	}
+	free(trace);
+	free(v);
+	return rv;
+}
+
+
+/*
+ * follow_row maps a row number from before the patch to after it: rows in
+ * a replaced run keep their place in it, as far as the run reaches.
+ */
+static size_t
+follow_row(const struct hunk *h, const size_t nh, const size_t r)
+{
+	size_t	 i     = 0;
+	size_t	 shift = 0;
+	int	 up    = 0;
+
+	for (i = 0; i < nh && r >= h[i].o; i++) {
+		if (r < h[i].o + h[i].on) {
+			if (h[i].nn == 0) {
+				return h[i].n;
+			}
+			return h[i].n + (r - h[i].o < h[i].nn ?
+			    r - h[i].o : h[i].nn - 1);
+		}
+	}
+
+	/* everything before r moved by the same amount */
+	if (i == 0) {
+		return r;
+	}
+
+	i--;
+	if (h[i].n + h[i].nn >= h[i].o + h[i].on) {
+		shift = (h[i].n + h[i].nn) - (h[i].o + h[i].on);
+	} else {
+		shift = (h[i].o + h[i].on) - (h[i].n + h[i].nn);
+		up    = 1;
+	}
+
+	return up ? r - shift : r + shift;
+}
+
+
+static void
+clamp_x(const buffer *b, const size_t y, size_t *x)
+{
+	if (y < b->nrows && *x > buffer_row(b, y)->size) {
+		*x = buffer_row(b, y)->size;
+	} else if (y >= b->nrows) {
+		*x = 0;
+	}
+}
+
+
+/*
+ * patch replaces the rows of b from p, n of them, with the lines in
+ * new, m of them, keeping the rows marked in ka, which match the
+ * lines marked in kb. It moves the cursor and the mark along, and
+ * returns the number of lines changed, or -1 if it runs out of memory.
+ */
+static long
+patch(buffer *b, const size_t p, const size_t n, const line_span *new,
+    const size_t m, const char *map, const char *ka, const char *kb)
+{
+	struct hunk	*h    = NULL;
+	struct hunk	*nh   = NULL;
+	abuf		*add  = NULL;
+	size_t		 hcap = 0;
+	size_t		 hn   = 0;
+	size_t		 most = 0;
+	size_t		 i    = 0;
+	size_t		 j    = 0;
+	long		 nch  = 0;
+
+	/* collect the runs that differ */
+	while (i < n || j < m) {
+		if (i < n && j < m && ka[i] && kb[j]) {
+			i++;
+			j++;
+			continue;
+		}
+
+		if (hn == hcap) {
+			hcap = hcap ? hcap * 2 : 16;
+			nh = realloc(h, hcap * sizeof(*h));
+			if (nh == NULL) {
+				free(h);
+				return -1;
+			}
+			h = nh;
+		}
+
+		h[hn].o = p + i;
+		h[hn].n = p + j;
+		while (i < n && !ka[i]) {
+			i++;
+		}
+		while (j < m && !kb[j]) {
+			j++;
+		}
+		h[hn].on = p + i - h[hn].o;
+		h[hn].nn = p + j - h[hn].n;
+		if (h[hn].nn > most) {
+			most = h[hn].nn;
+		}
+		nch += (long)(h[hn].on > h[hn].nn ? h[hn].on : h[hn].nn);
+		hn++;
+	}
+
+	if (hn == 0) {
+		return 0;
+	}
+
+	add = malloc((most ? most : 1) * sizeof(*add));
+	if (add == NULL) {
+		free(h);
+		return -1;
+	}
+
+	/* from the last run back, so the runs before keep their rows */
+	for (i = hn; i-- > 0;) {
+		for (j = 0; j < h[i].nn; j++) {
+			buffer_copy_row(b, &add[j],
+			    map + new[h[i].n - p + j].off,
+			    new[h[i].n - p + j].len);
+		}
+		buffer_delete_rows(b, h[i].o, h[i].on);
+		buffer_insert_rows(b, h[i].o, add, h[i].nn);
+	}
+	free(add);
+
+	b->cury    = follow_row(h, hn, b->cury);
+	b->rowoffs = follow_row(h, hn, b->rowoffs);
+	clamp_x(b, b->cury, &b->curx);
+	if (b->mark_set) {
+		b->mark_cury = follow_row(h, hn, b->mark_cury);
+		clamp_x(b, b->mark_cury, &b->mark_curx);
+	}
+
+	free(h);
+	return nch;
+}
+
+
+/*
+ * lines fills in the diff's view of the n rows starting at from, and
+ * of the m lines of the new file.
+ */
+static void
+lines(const buffer *b, const size_t from, const size_t n, const size_t lim,
+    struct line *a, const char *map, const line_span *new, const size_t m,
+    struct line *l)
+{
+	const abuf	*row = NULL;
+	size_t		 i   = 0;
+
+	for (i = 0; i < n; i++) {
+		row      = buffer_row(b, from + i);
+		a[i].p   = readable(b, row, lim) ? row->b : NULL;
+		a[i].len = row->size;
+		a[i].h   = a[i].p ? hash(row->b, row->size) : 0;
+	}
+
+	for (i = 0; i < m; i++) {
+		l[i].p   = map + new[i].off;
+		l[i].len = new[i].len;
+		l[i].h   = hash(l[i].p, l[i].len);
+	}
+}
+
+
+/*
+ * split finds the lines in the new file from off to end.
+ */
+static line_span *
+split(const char *map, const size_t off, const size_t end, size_t *m)
+{
+	line_span	*new  = NULL;
+	line_span	*grow = NULL;
+	size_t		 cap  = 0;
+	size_t		 pos  = off;
+	size_t		 used = 0;
+	size_t		 n    = 0;
+	size_t		 i    = 0;
+
+	*m = 0;
+	while (pos < end) {
+		if (cap - *m < RELOAD_LINES) {
+			cap  = cap ? cap * 2 : RELOAD_LINES;
+			grow = realloc(new, cap * sizeof(*new));
+			if (grow == NULL) {
+				free(new);
+				return NULL;
+			}
+			new = grow;
+		}
+
+		n = scan_lines(map + pos, end - pos, 1, new + *m,
+		    RELOAD_LINES, &used);
+		for (i = 0; i < n; i++) {
+			new[*m + i].off += pos;
+		}
+		*m  += n;
+		pos += used;
+		if (n == 0) {
+			break;
+		}
+	}
+
+	/* an empty region still needs somewhere to point */
+	if (new == NULL) {
+		new = malloc(sizeof(*new));
+	}
+
+	return new;
+}
+
+
+/*
+ * reload_file brings b up to date with its file and sets changed to
+ * the number of lines that were different. It returns -1 if b can't
+ * be reloaded this way (it isn't plain text, or its file is gone), in
+ * which case it is left alone and should be opened again instead.
+ */
+int
+reload_file(buffer *b, size_t *changed)
+{
+	struct stat	 st;
+	struct line	*ol   = NULL;
+	struct line	*nl   = NULL;
+	line_span	*new  = NULL;
+	char		*ka   = NULL;
+	char		*kb   = NULL;
+	char		*map  = NULL;
+	size_t		 len  = 0;
+	size_t		 lim  = SIZE_MAX;
+	size_t		 off  = 0;
+	size_t		 end  = 0;
+	size_t		 next = 0;
+	size_t		 p    = 0;
+	size_t		 s    = 0;
+	size_t		 n    = 0;
+	size_t		 m    = 0;
+	long		 nch  = 0;
+	int		 fd   = -1;
+	int		 rv   = -1;
+
+	*changed = 0;
+	if (b->filename == NULL || b->hex != NULL || b->view != NULL ||
+	    b->compress != COMPRESS_NONE || follow_active(b) ||
+	    b->saver != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = open(b->filename, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		goto reload_done;
+	}
+
+	/* the mapping shows the file as it is now if it was written in place */
+	len = (size_t)st.st_size;
+	if (b->map != NULL && st.st_dev == b->mapst.st_dev &&
+	    st.st_ino == b->mapst.st_ino) {
+		lim = len;
+		if (len < b->maplen && !buffer_indexed(b)) {
+			/* indexing the rest would read past the end */
+			goto reload_done;
+		}
+	}
+
+	if (len > 0) {
+		map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+			goto reload_done;
+		}
+		guard_map(map, len, PROT_READ);
+	}
+	buffer_index_all(b);
+
+	/* the lines at the start and the end that haven't changed */
+	while (p < b->nrows && off < len &&
+	    readable(b, buffer_row(b, p), lim) &&
+	    head_match(buffer_row(b, p), map, len, off, &next)) {
+		off = next;
+		p++;
+	}
+
+	end = len;
+	while (s < b->nrows - p && end > off &&
+	    readable(b, buffer_row(b, b->nrows - s - 1), lim) &&
+	    tail_match(buffer_row(b, b->nrows - s - 1), map, off, end,
+	    &next)) {
+		end = next;
+		s++;
+	}
+
+	/* and a diff of what is left between them */
+	n   = b->nrows - p - s;
+	new = split(map, off, end, &m);
+	ol  = malloc((n ? n : 1) * sizeof(*ol));
+	nl  = malloc((m ? m : 1) * sizeof(*nl));
+	ka  = calloc(n ? n : 1, 1);
+	kb  = calloc(m ? m : 1, 1);
+	if (new == NULL || ol == NULL || nl == NULL || ka == NULL ||
+	    kb == NULL) {
+		goto reload_done;
+	}
+
+	lines(b, p, n, lim, ol, map, new, m, nl);
+	if (diff(ol, (long)n, nl, (long)m, ka, kb) == -1) {
+		/* too different to be worth matching up: replace it all */
+		memset(ka, 0, n);
+		memset(kb, 0, m);
+	}
+
+	nch = patch(b, p, n, new, m, map, ka, kb);
+	if (nch == -1) {
+		goto reload_done;
+	}
+
+	*changed = (size_t)nch;
+	b->dirty = 0;
+	buffer_rebase(b, fd);
+	if (b->reload != NULL) {
+		b->reload->st = st;
+	}
+	rv = 0;
+
+reload_done:
+	if (map != NULL) {
+		guard_unmap(map);
+		munmap(map, len);
+	}
+	free(new);
+	free(ol);
+	free(nl);
+	free(ka);
+	free(kb);
+	close(fd);
+	return rv;
+}
@@ -0,0 +1,29 @@
+/*
+ * reload.h - picking up changes made to a buffer's file on disk
+ */
+#ifndef KE_RELOAD_H
+#define KE_RELOAD_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+
+#define	RELOAD_IDLE	0	/* the file is as it was read or saved */
+#define	RELOAD_CHANGED	1	/* something else has changed the file */
+
+
+/*
+ * A watched buffer notices when another program changes its file.
+ * Reloading compares the rows with the file's lines and replaces only
+ * the runs of rows that differ, so the cursor and the mark stay on
+ * their text.
+ */
+void		 reload_watch(buffer *b);
+void		 reload_stop(buffer *b);
+int		 reload_poll(buffer *b);
+void		 reload_own(buffer *b);
+int		 reload_file(buffer *b, size_t *changed);
+
+
+#endif
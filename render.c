@@ -0,0 +1,298 @@
+/*
+ * render.c - rows as they are shown, cached between frames
+ *
+ * Drawing a row means expanding its tabs, control characters and
+ * multibyte characters into what goes on screen, and doing that for
+ * every row on every key costs more than anything else in a frame.
+ * The expansion of each row drawn is kept here instead, along with the
+ * generation the row had (see buffer_row_gen), and a later frame that
+ * finds the same generation copies the columns it wants straight out
+ * of it. Rows get their generation from the buffer, not from where
+ * they are, so inserting a line above doesn't make those below it
+ * stale.
+ *
+ * An expansion whose every column is one byte, which is most of them,
+ * needs nothing else; the others also keep where each column starts.
+ * A very long row is only expanded across the columns on screen, from
+ * the character cols_seek finds at the left edge. The row being typed
+ * into is read around its gap. Only a couple of screenfuls of rows are
+ * kept, and the one drawn longest ago makes way for a new one.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "cols.h"
+#include "core.h"
+#include "render.h"
+#include "scan.h"
+#include "utf8.h"
+
+
+#define	RENDER_SPARE	8		/* rows kept past two screenfuls */
+#define	RENDER_KEEP	65536		/* a longer expansion isn't reused */
+#define	RENDER_WHOLE	16384		/* a longer row is done a screen at a time */
+
+
+struct line {
+	size_t	 gen;		/* of the row, or 0 if the slot is free */
+	size_t	 drawn;		/* the frame it was last drawn in */
+	abuf	 text;
+	size_t	 first;		/* the column text starts at */
+	size_t	 ncols;
+	int	 end;		/* text goes to the end of the row */
+	size_t	*col;		/* where column i starts in text, or NULL */
+	size_t	 colcap;
+};
+
+
+static struct line	*cache;
+static size_t		 ncache;
+static size_t		 frame;
+
+
+static void
+forget(struct line *l)
+{
+	ab_free(&l->text);
+	free(l->col);
+	memset(l, 0, sizeof(*l));
+}
+
+
+void
+render_frame(const size_t rows)
+{
+	size_t	 want = 2 * rows + RENDER_SPARE;
+	size_t	 i    = 0;
+
+	frame++;
+	if (want == ncache) {
+		return;
+	}
+
+	for (i = want; i < ncache; i++) {
+		forget(&cache[i]);
+	}
+
+	cache = realloc(cache, want * sizeof(*cache));
+	assert(cache != NULL);
+	for (i = ncache; i < want; i++) {
+		memset(&cache[i], 0, sizeof(cache[i]));
+	}
+	ncache = want;
+}
+
+
+/* at returns where column c starts in l's text, or its end past the last. */
+static size_t
+at(const struct line *l, const size_t c)
+{
+	if (c >= l->ncols) {
+		return l->text.size;
+	}
+
+	return l->col != NULL ? l->col[c] : c;
+}
+
+
+/*
+ * put adds a character of len bytes that takes up w columns. The
+ * columns only have to be written down once one of them isn't a byte.
+ */
+static void
+put(struct line *l, const char *s, const size_t len, const size_t w)
+{
+	size_t	 start = l->text.size;
+	size_t	 i     = 0;
+
+	if (l->col == NULL && len != w) {
+		l->colcap = cap_growth(0, l->ncols + w);
+		l->col    = malloc(l->colcap * sizeof(size_t));
+		assert(l->col != NULL);
+		for (i = 0; i < l->ncols; i++) {
+			l->col[i] = i;
+		}
+	}
+
+	if (l->col != NULL) {
+		if (l->colcap < l->ncols + w) {
+			l->colcap = cap_growth(l->colcap, l->ncols + w);
+			l->col    = realloc(l->col, l->colcap * sizeof(size_t));
+			assert(l->col != NULL);
+		}
+
+		/* a wide character's columns all start at its first byte */
+		for (i = 0; i < w; i++) {
+			l->col[l->ncols + i] = start + (len == w ? i : 0);
+		}
+	}
+
+	ab_append(&l->text, s, len);
+	l->ncols += w;
+}
+
+
+/*
+ * expand works out row y as it shows from column from to from + cols,
+ * or all of it if it isn't too long.
+ */
+static void
+expand(struct line *l, const buffer *b, const size_t y, const size_t from,
+    const size_t cols)
+{
+	const char	*s    = NULL;
+	rowtext		 row;
+	cols_pos	 p;
+	uint32_t	 cp;
+	char		 seq[4];
+	size_t		 stop = (size_t)-1;
+	size_t		 j    = 0;
+	size_t		 n    = 0;
+	unsigned char	 c    = 0;
+
+	buffer_row_text(b, y, &row);
+	memset(&p, 0, sizeof(p));
+	if (row.size > RENDER_WHOLE) {
+		cols_seek(b, y, from, &p);
+		stop = from + cols;
+	}
+
+	l->text.size = 0;
+	l->first     = p.col;
+	l->ncols     = 0;
+	free(l->col);
+	l->col    = NULL;
+	l->colcap = 0;
+
+	for (j = p.off; j < row.size && l->first + l->ncols < stop;) {
+		n = rowtext_span(&row, j, &s);
+		c = (unsigned char)s[0];
+
+		if (c == '\t') {
+			n = TAB_STOP - (l->first + l->ncols) % TAB_STOP;
+			for (; n > 0; n--) {
+				put(l, " ", 1, 1);
+			}
+			j++;
+			continue;
+		} else if (c < 0x20) {
+			snprintf(seq, sizeof(seq), "\\%02x", c);
+			put(l, seq, 3, 3);
+			j++;
+			continue;
+		} else if (c < 0x80) {
+			/* a run of printable ASCII goes in as it is */
+			if (n > stop - (l->first + l->ncols)) {
+				n = stop - (l->first + l->ncols);
+			}
+			n = scan_plain(s, n);
+			put(l, s, n, n);
+			j += n;
+			continue;
+		}
+
+		/* a character the gap cuts in two is put back together */
+		if (n < sizeof(seq)) {
+			n = rowtext_read(&row, j, seq, sizeof(seq));
+			s = seq;
+		}
+
+		n = utf8_decode(s, n, &cp);
+		if (n == 0) {
+			/* not a character; it takes a column on its own */
+			put(l, "?", 1, 1);
+			j++;
+			continue;
+		}
+
+		if (cp < 0xa0) {
+			/* the C1 controls aren't for the terminal either */
+			put(l, "?", 1, 1);
+		} else {
+			put(l, s, n, (size_t)utf8_width(cp));
+		}
+		j += n;
+	}
+
+	l->end = j >= row.size;
+}
+
+
+/*
+ * lookup returns an expansion of row y with columns from to from +
+ * cols in it, working it out again in the row's slot if the columns
+ * aren't there, or in the slot drawn longest ago if the row has none.
+ */
+static struct line *
+lookup(const buffer *b, const size_t y, const size_t from,
+    const size_t cols)
+{
+	struct line	*l   = NULL;
+	size_t		 gen = buffer_row_gen(b, y);
+	size_t		 i   = 0;
+
+	for (i = 0; i < ncache; i++) {
+		if (cache[i].gen == gen) {
+			l = &cache[i];
+			break;
+		}
+
+		if (l == NULL || cache[i].drawn < l->drawn) {
+			l = &cache[i];
+		}
+	}
+
+	assert(l != NULL);
+	l->drawn = frame;
+	if (l->gen == gen && l->first <= from &&
+	    (l->end || l->first + l->ncols >= from + cols)) {
+		return l;
+	}
+
+	if (l->text.cap > RENDER_KEEP) {
+		forget(l);
+		l->drawn = frame;
+	}
+
+	expand(l, b, y, from, cols);
+	l->gen = gen;
+	return l;
+}
+
+
+void
+render_row(abuf *ab, const buffer *b, const size_t y, const size_t from,
+    const size_t cols)
+{
+	struct line	*l  = lookup(b, y, from, cols);
+	size_t		 c  = from - l->first;
+	size_t		 to = c + cols;
+	size_t		 e  = 0;
+
+	if (to > l->ncols) {
+		to = l->ncols;
+	}
+
+	/* the rest of a wide character cut by the left edge */
+	while (c < to && c > 0 && at(l, c) == at(l, c - 1)) {
+		ab_appendch(ab, ' ');
+		c++;
+	}
+
+	/* and one cut by the right edge */
+	for (e = to; e > c && at(l, e) == at(l, e - 1); e--) {
+		;
+	}
+
+	if (e > c) {
+		ab_append(ab, l->text.b + at(l, c), at(l, e) - at(l, c));
+	}
+	for (; e < to; e++) {
+		ab_appendch(ab, ' ');
+	}
+}
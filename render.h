@@ -0,0 +1,30 @@
+/*
+ * render.h - rows as they are shown, cached between frames
+ */
+#ifndef KE_RENDER_H
+#define KE_RENDER_H
+
+#include <stddef.h>
+
+#include "abuf.h"
+#include "buffer.h"
+
+
+/*
+ * render_row adds the columns from to from + cols of row y of b, as
+ * they show on screen, to ab: tabs as spaces, control characters as
+ * \xx, and any byte that isn't part of a character as a '?'. A wide
+ * character cut by either edge is shown as spaces.
+ *
+ * Each row's expansion is kept, with the row's generation, for as long
+ * as the row is on screen or was not long ago, so a row that hasn't
+ * changed since the last frame is copied from it rather than worked
+ * out again. render_frame starts a frame for a window of rows lines,
+ * which sets how many rows are kept.
+ */
+void		 render_frame(size_t rows);
+void		 render_row(abuf *ab, const buffer *b, size_t y, size_t from,
+		    size_t cols);
+
+
+#endif
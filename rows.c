@@ -0,0 +1,748 @@
+/*
+ * rows.c - the rows of a buffer
+ *
+ * A buffer's rows are kept in blocks of up to ROWBLOCK of them, and two
+ * Fenwick trees over the blocks count the rows and the bytes in each.
+ * Finding row y, or the offset it starts at in the file a save would
+ * write, walks the tree in O(log n) steps; inserting or deleting a row
+ * moves at most the rest of its block, wherever it is in the buffer. A
+ * flat array of rows had to move every row after it instead.
+ *
+ * A block that fills up is split in two and one that is nearly empty
+ * is merged with a neighbour, which rebuilds the trees, but that
+ * happens only once every so many rows. Rows appended at the end, as
+ * a file is read, fill one block after another and touch only the
+ * last entries of the trees.
+ *
+ * Text that isn't in a file the buffer has mapped, such as that of a
+ * decompressed file or of lines appended to a followed one, is copied
+ * into slabs a megabyte at a time, and its rows borrow from those the
+ * way rows of a mapped file borrow from the mapping. A row gets its own
+ * storage only when it is changed; the slabs are freed whole, with the
+ * rows, rather than a line at a time.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "scan.h"
+
+
+#define	ROWBLOCK	512
+#define	SLAB_SIZE	(1024 * 1024)
+
+#define	ROW_UNKNOWN	0		/* plain[] values */
+#define	ROW_PLAIN	1
+#define	ROW_MIXED	2
+
+
+struct rowblock {
+	size_t	 n;
+	size_t	 bytes;		/* in the rows, with a newline after each */
+	abuf	 row[ROWBLOCK];
+	size_t	 gen[ROWBLOCK];	/* of each row; see buffer_row_gen */
+	char	 plain[ROWBLOCK]; /* see buffer_row_plain */
+};
+
+
+struct slab {
+	struct slab	*next;
+	size_t		 used;
+	size_t		 cap;
+	char		 text[];
+};
+
+
+static size_t	 lastgen;	/* the last generation given to a row */
+
+
+static size_t
+lowbit(const size_t i)
+{
+	return i & (~i + 1);
+}
+
+
+static void
+tree_add(size_t *tree, const size_t n, size_t k, const size_t d)
+{
+	for (k++; k <= n; k += lowbit(k)) {
+		tree[k] += d;
+	}
+}
+
+
+/* tree_sum adds up the first k blocks. */
+static size_t
+tree_sum(const size_t *tree, size_t k)
+{
+	size_t	 sum = 0;
+
+	for (; k > 0; k -= lowbit(k)) {
+		sum += tree[k];
+	}
+
+	return sum;
+}
+
+
+/*
+ * rebuild makes the trees again from the blocks, after blocks have
+ * been added or taken away.
+ */
+static void
+rebuild(rowtree *t)
+{
+	size_t	 i = 0;
+	size_t	 j = 0;
+
+	for (i = 1; i <= t->nblk; i++) {
+		t->rows[i]  = t->blk[i - 1]->n;
+		t->bytes[i] = t->blk[i - 1]->bytes;
+	}
+
+	for (i = 1; i <= t->nblk; i++) {
+		j = i + lowbit(i);
+		if (j <= t->nblk) {
+			t->rows[j]  += t->rows[i];
+			t->bytes[j] += t->bytes[i];
+		}
+	}
+}
+
+
+/*
+ * locate finds the block holding row *y and sets *y to the row's place
+ * in it. Past the last row, it returns the number of blocks.
+ */
+static size_t
+locate(const rowtree *t, size_t *y)
+{
+	size_t	 pos  = 0;
+	size_t	 step = 1;
+
+	while (step * 2 <= t->nblk) {
+		step *= 2;
+	}
+
+	for (; step > 0 && t->nblk > 0; step /= 2) {
+		if (pos + step <= t->nblk && t->rows[pos + step] <= *y) {
+			pos += step;
+			*y  -= t->rows[pos];
+		}
+	}
+
+	return pos;
+}
+
+
+static void
+reserve_blocks(rowtree *t, const size_t n)
+{
+	size_t	 cap = t->cap ? t->cap : 16;
+
+	if (n <= t->cap) {
+		return;
+	}
+
+	while (cap < n) {
+		cap *= 2;
+	}
+
+	t->blk   = realloc(t->blk, cap * sizeof(*t->blk));
+	t->rows  = realloc(t->rows, (cap + 1) * sizeof(*t->rows));
+	t->bytes = realloc(t->bytes, (cap + 1) * sizeof(*t->bytes));
+	assert(t->blk != NULL && t->rows != NULL && t->bytes != NULL);
+	t->cap = cap;
+}
+
+
+/*
+ * add_blocks puts n empty blocks in at k; the caller fills them and
+ * rebuilds the trees.
+ */
+static void
+add_blocks(rowtree *t, const size_t k, const size_t n)
+{
+	size_t	 i = 0;
+
+	reserve_blocks(t, t->nblk + n);
+	memmove(&t->blk[k + n], &t->blk[k], (t->nblk - k) * sizeof(*t->blk));
+	for (i = 0; i < n; i++) {
+		t->blk[k + i] = malloc(sizeof(struct rowblock));
+		assert(t->blk[k + i] != NULL);
+		t->blk[k + i]->n     = 0;
+		t->blk[k + i]->bytes = 0;
+	}
+	t->nblk += n;
+}
+
+
+static void
+remove_block(rowtree *t, const size_t k)
+{
+	free(t->blk[k]);
+	memmove(&t->blk[k], &t->blk[k + 1],
+	    (t->nblk - k - 1) * sizeof(*t->blk));
+	t->nblk--;
+}
+
+
+/*
+ * append_block adds an empty block at the end. Only the tree entry of
+ * the new block has to be worked out, from the sums before it.
+ */
+static void
+append_block(rowtree *t)
+{
+	size_t	 k = 0;
+
+	add_blocks(t, t->nblk, 1);
+	k = t->nblk;
+	t->rows[k]  = tree_sum(t->rows, k - 1) -
+	    tree_sum(t->rows, k - lowbit(k));
+	t->bytes[k] = tree_sum(t->bytes, k - 1) -
+	    tree_sum(t->bytes, k - lowbit(k));
+}
+
+
+static size_t
+span_bytes(const abuf *row, const size_t n)
+{
+	size_t	 bytes = 0;
+	size_t	 i     = 0;
+
+	for (i = 0; i < n; i++) {
+		bytes += row[i].size + 1;
+	}
+
+	return bytes;
+}
+
+
+/*
+ * split moves the rows of block k from o on into a new block after it;
+ * the caller rebuilds the trees.
+ */
+static void
+split(rowtree *t, const size_t k, const size_t o)
+{
+	struct rowblock	*blk = NULL;
+	struct rowblock	*nb  = NULL;
+
+	add_blocks(t, k + 1, 1);
+	blk = t->blk[k];
+	nb  = t->blk[k + 1];
+
+	nb->n     = blk->n - o;
+	nb->bytes = span_bytes(&blk->row[o], nb->n);
+	memcpy(nb->row, &blk->row[o], nb->n * sizeof(abuf));
+	memcpy(nb->gen, &blk->gen[o], nb->n * sizeof(size_t));
+	memcpy(nb->plain, &blk->plain[o], nb->n);
+	blk->n     = o;
+	blk->bytes -= nb->bytes;
+}
+
+
+/*
+ * merge folds a block left with few rows into a neighbour that has
+ * room for them.
+ */
+static void
+merge(rowtree *t, size_t k)
+{
+	struct rowblock	*blk = NULL;
+	struct rowblock	*nb  = NULL;
+
+	if (t->blk[k]->n >= ROWBLOCK / 4) {
+		return;
+	}
+
+	if (k + 1 < t->nblk &&
+	    t->blk[k]->n + t->blk[k + 1]->n <= ROWBLOCK / 2) {
+		/* fold the next block into this one */
+	} else if (k > 0 &&
+	    t->blk[k - 1]->n + t->blk[k]->n <= ROWBLOCK / 2) {
+		k--;
+	} else {
+		return;
+	}
+
+	blk = t->blk[k];
+	nb  = t->blk[k + 1];
+	memcpy(&blk->row[blk->n], nb->row, nb->n * sizeof(abuf));
+	memcpy(&blk->gen[blk->n], nb->gen, nb->n * sizeof(size_t));
+	memcpy(&blk->plain[blk->n], nb->plain, nb->n);
+	blk->n     += nb->n;
+	blk->bytes += nb->bytes;
+	remove_block(t, k + 1);
+	rebuild(t);
+}
+
+
+static void
+insert_row(buffer *b, const size_t at, const abuf *row)
+{
+	rowtree		*t   = &b->rows;
+	struct rowblock	*blk = NULL;
+	size_t		 o   = at;
+	size_t		 k   = 0;
+
+	if (at == b->nrows) {
+		if (t->nblk == 0 || t->blk[t->nblk - 1]->n == ROWBLOCK) {
+			append_block(t);
+		}
+		k = t->nblk - 1;
+		o = t->blk[k]->n;
+	} else {
+		k = locate(t, &o);
+		if (t->blk[k]->n == ROWBLOCK) {
+			split(t, k, ROWBLOCK / 2);
+			rebuild(t);
+			if (o >= ROWBLOCK / 2) {
+				k++;
+				o -= ROWBLOCK / 2;
+			}
+		}
+	}
+
+	blk = t->blk[k];
+	memmove(&blk->row[o + 1], &blk->row[o], (blk->n - o) * sizeof(abuf));
+	memmove(&blk->gen[o + 1], &blk->gen[o], (blk->n - o) * sizeof(size_t));
+	memmove(&blk->plain[o + 1], &blk->plain[o], blk->n - o);
+	blk->row[o]   = *row;
+	blk->gen[o]   = ++lastgen;
+	blk->plain[o] = ROW_UNKNOWN;
+	blk->n++;
+	blk->bytes += row->size + 1;
+	tree_add(t->rows, t->nblk, k, 1);
+	tree_add(t->bytes, t->nblk, k, row->size + 1);
+	b->nrows++;
+}
+
+
+/*
+ * buffer_row returns row y. Past the last row there is only an empty
+ * one, which is not to be changed.
+ */
+abuf *
+buffer_row(const buffer *b, const size_t y)
+{
+	static abuf	 none;
+	size_t		 o = y;
+	size_t		 k = 0;
+
+	if (y >= b->nrows) {
+		ab_init(&none);
+		return &none;
+	}
+
+	k = locate(&b->rows, &o);
+	return &b->rows.blk[k]->row[o];
+}
+
+
+/*
+ * buffer_rows_at returns row y and sets n to the number of rows from
+ * it on that follow it in memory, for walking many rows in order.
+ */
+abuf *
+buffer_rows_at(const buffer *b, const size_t y, size_t *n)
+{
+	size_t	 o = y;
+	size_t	 k = 0;
+
+	assert(y < b->nrows);
+	k  = locate(&b->rows, &o);
+	*n = b->rows.blk[k]->n - o;
+	return &b->rows.blk[k]->row[o];
+}
+
+
+/*
+ * buffer_insert_rows puts the n rows in rows into the buffer before
+ * row at, which takes them over. Many rows at once are put in whole
+ * blocks of their own.
+ */
+void
+buffer_insert_rows(buffer *b, const size_t at, const abuf *rows,
+    const size_t n)
+{
+	rowtree		*t   = &b->rows;
+	struct rowblock	*blk = NULL;
+	size_t		 nb  = 0;
+	size_t		 k   = t->nblk;
+	size_t		 o   = at;
+	size_t		 i   = 0;
+	size_t		 j   = 0;
+
+	assert(at <= b->nrows);
+	if (n < ROWBLOCK) {
+		for (i = 0; i < n; i++) {
+			insert_row(b, at + i, &rows[i]);
+		}
+		return;
+	}
+
+	if (at < b->nrows) {
+		k = locate(t, &o);
+		if (o > 0) {
+			split(t, k, o);
+			k++;
+		}
+	}
+
+	nb = (n + ROWBLOCK - 1) / ROWBLOCK;
+	add_blocks(t, k, nb);
+	for (i = 0; i < nb; i++) {
+		blk        = t->blk[k + i];
+		blk->n     = (i + 1 < nb) ? ROWBLOCK : n - i * ROWBLOCK;
+		memcpy(blk->row, &rows[i * ROWBLOCK], blk->n * sizeof(abuf));
+		blk->bytes = span_bytes(blk->row, blk->n);
+		for (j = 0; j < blk->n; j++) {
+			blk->gen[j] = ++lastgen;
+		}
+		memset(blk->plain, ROW_UNKNOWN, blk->n);
+	}
+
+	b->nrows += n;
+	rebuild(t);
+}
+
+
+/*
+ * buffer_delete_rows frees n rows from row at on and takes them out.
+ */
+void
+buffer_delete_rows(buffer *b, const size_t at, size_t n)
+{
+	rowtree		*t    = &b->rows;
+	struct rowblock	*blk  = NULL;
+	size_t		 o    = at;
+	size_t		 k    = 0;
+	size_t		 take = 0;
+	size_t		 i    = 0;
+
+	assert(at + n <= b->nrows);
+	if (n == 0) {
+		return;
+	}
+
+	k = locate(t, &o);
+	if (n == 1) {
+		blk = t->blk[k];
+		take = blk->row[o].size + 1;
+		ab_free(&blk->row[o]);
+		memmove(&blk->row[o], &blk->row[o + 1],
+		    (blk->n - o - 1) * sizeof(abuf));
+		memmove(&blk->gen[o], &blk->gen[o + 1],
+		    (blk->n - o - 1) * sizeof(size_t));
+		memmove(&blk->plain[o], &blk->plain[o + 1], blk->n - o - 1);
+		blk->n--;
+		blk->bytes -= take;
+		tree_add(t->rows, t->nblk, k, (size_t)-1);
+		tree_add(t->bytes, t->nblk, k, 0 - take);
+		b->nrows--;
+
+		if (blk->n == 0) {
+			remove_block(t, k);
+			rebuild(t);
+		} else {
+			merge(t, k);
+		}
+		return;
+	}
+
+	while (n > 0) {
+		blk  = t->blk[k];
+		take = blk->n - o < n ? blk->n - o : n;
+		for (i = o; i < o + take; i++) {
+			blk->bytes -= blk->row[i].size + 1;
+			ab_free(&blk->row[i]);
+		}
+		memmove(&blk->row[o], &blk->row[o + take],
+		    (blk->n - o - take) * sizeof(abuf));
+		memmove(&blk->gen[o], &blk->gen[o + take],
+		    (blk->n - o - take) * sizeof(size_t));
+		memmove(&blk->plain[o], &blk->plain[o + take],
+		    blk->n - o - take);
+		blk->n   -= take;
+		b->nrows -= take;
+		n        -= take;
+
+		if (blk->n == 0) {
+			remove_block(t, k);
+		} else {
+			k++;
+		}
+		o = 0;
+	}
+
+	rebuild(t);
+
+	/* the block the rows were cut from may be left with few */
+	if (b->nrows > 0) {
+		o = (at < b->nrows) ? at : b->nrows - 1;
+		merge(t, locate(t, &o));
+	}
+}
+
+
+/*
+ * buffer_row_resized is told of every change to the length of row y,
+ * which was was long before it, to keep the byte counts right. The row
+ * gets a new generation, too.
+ */
+void
+buffer_row_resized(buffer *b, const size_t y, const size_t was)
+{
+	rowtree	*t = &b->rows;
+	size_t	 o = y;
+	size_t	 k = 0;
+	size_t	 d = 0;
+
+	k = locate(t, &o);
+	d = t->blk[k]->row[o].size - was;
+	t->blk[k]->bytes += d;
+	t->blk[k]->gen[o]   = ++lastgen;
+	t->blk[k]->plain[o] = ROW_UNKNOWN;
+	tree_add(t->bytes, t->nblk, k, d);
+}
+
+
+/*
+ * buffer_row_gen returns row y's generation: a number no other row has
+ * had, which it gets when it is put in a buffer and again whenever it
+ * is changed. Something worked out from a row is still good for as
+ * long as the row's generation is the same. Past the last row it is 0.
+ */
+size_t
+buffer_row_gen(const buffer *b, const size_t y)
+{
+	size_t	 o = y;
+	size_t	 k = 0;
+
+	if (y >= b->nrows) {
+		return 0;
+	}
+
+	k = locate(&b->rows, &o);
+	return b->rows.blk[k]->gen[o];
+}
+
+
+/*
+ * buffer_row_plain returns whether row y is all printable ASCII, so
+ * each byte shows as itself in a column of its own. It is worked out
+ * the first time it is asked after the row changes.
+ */
+int
+buffer_row_plain(const buffer *b, const size_t y)
+{
+	struct rowblock	*blk = NULL;
+	rowtext		 t;
+	const char	*s   = NULL;
+	size_t		 o   = y;
+	size_t		 off = 0;
+	size_t		 n   = 0;
+
+	if (y >= b->nrows) {
+		return 1;
+	}
+
+	blk = b->rows.blk[locate(&b->rows, &o)];
+	if (blk->plain[o] == ROW_UNKNOWN) {
+		buffer_row_text(b, y, &t);
+		while ((n = rowtext_span(&t, off, &s)) > 0 &&
+		    scan_plain(s, n) == n) {
+			off += n;
+		}
+		blk->plain[o] = n == 0 ? ROW_PLAIN : ROW_MIXED;
+	}
+
+	return blk->plain[o] == ROW_PLAIN;
+}
+
+
+/*
+ * buffer_row_set_plain is told that row y, just changed, is still all
+ * printable ASCII, which saves looking through it again.
+ */
+void
+buffer_row_set_plain(buffer *b, const size_t y)
+{
+	size_t	 o = y;
+	size_t	 k = 0;
+
+	k = locate(&b->rows, &o);
+	b->rows.blk[k]->plain[o] = ROW_PLAIN;
+}
+
+
+/*
+ * buffer_row_text sets t up to read row y around its gap, if it has
+ * one open.
+ */
+void
+buffer_row_text(const buffer *b, const size_t y, rowtext *t)
+{
+	const abuf	*row = buffer_row(b, y);
+
+	t->b      = row->b;
+	t->size   = row->size;
+	t->gapat  = row->size;
+	t->gaplen = 0;
+	if (b->gaplen > 0 && b->gaprow == y) {
+		t->gapat  = b->gapat;
+		t->gaplen = b->gaplen;
+	}
+}
+
+
+/*
+ * rowtext_span points s at byte off of t and returns how many bytes
+ * from there on sit together: up to the gap if off is before it, or
+ * to the end of the row.
+ */
+size_t
+rowtext_span(const rowtext *t, const size_t off, const char **s)
+{
+	if (off < t->gapat) {
+		*s = t->b + off;
+		return t->gapat - off;
+	}
+
+	*s = t->b + t->gaplen + off;
+	return off < t->size ? t->size - off : 0;
+}
+
+
+/*
+ * rowtext_read copies up to len bytes of t from off on into dst, past
+ * the gap if need be, and returns how many there were. It puts back
+ * together a character the gap cuts in two.
+ */
+size_t
+rowtext_read(const rowtext *t, size_t off, char *dst, const size_t len)
+{
+	const char	*s   = NULL;
+	size_t		 got = 0;
+	size_t		 n   = 0;
+
+	while (got < len && (n = rowtext_span(t, off, &s)) > 0) {
+		if (n > len - got) {
+			n = len - got;
+		}
+		memcpy(dst + got, s, n);
+		got += n;
+		off += n;
+	}
+
+	return got;
+}
+
+
+/*
+ * buffer_offset returns where row y would start in the file, each row
+ * followed by a newline; for y past the last row, the file's size.
+ */
+size_t
+buffer_offset(const buffer *b, const size_t y)
+{
+	const rowtree	*t = &b->rows;
+	size_t		 o = y;
+	size_t		 k = 0;
+
+	if (y >= b->nrows) {
+		return tree_sum(t->bytes, t->nblk);
+	}
+
+	k = locate(t, &o);
+	return tree_sum(t->bytes, k) + span_bytes(t->blk[k]->row, o);
+}
+
+
+/*
+ * buffer_drop_rows frees every row and the blocks they were in.
+ */
+void
+buffer_drop_rows(buffer *b)
+{
+	rowtree	*t = &b->rows;
+	size_t	 i = 0;
+	size_t	 j = 0;
+
+	for (i = 0; i < t->nblk; i++) {
+		for (j = 0; j < t->blk[i]->n; j++) {
+			ab_free(&t->blk[i]->row[j]);
+		}
+		free(t->blk[i]);
+	}
+	buffer_free_slabs(b);
+
+	free(t->blk);
+	free(t->rows);
+	free(t->bytes);
+	t->blk   = NULL;
+	t->rows  = NULL;
+	t->bytes = NULL;
+	t->nblk   = 0;
+	t->cap    = 0;
+	b->nrows  = 0;
+	b->gaplen = 0;
+}
+
+
+/*
+ * buffer_copy_row makes row borrow a copy of the len bytes at s, kept
+ * NUL-terminated in the buffer's slabs. A line too long to share a
+ * slab gets one of its own, behind the one being filled.
+ */
+void
+buffer_copy_row(buffer *b, abuf *row, const char *s, const size_t len)
+{
+	struct slab	*sl   = b->slabs;
+	size_t		 size = SLAB_SIZE;
+
+	if (sl == NULL || sl->cap - sl->used < len + 1) {
+		if (len + 1 > SLAB_SIZE / 4) {
+			size = len + 1;
+		}
+
+		sl = malloc(sizeof(*sl) + size);
+		assert(sl != NULL);
+		sl->used = 0;
+		sl->cap  = size;
+
+		if (size != SLAB_SIZE && b->slabs != NULL) {
+			sl->next = b->slabs->next;
+			b->slabs->next = sl;
+		} else {
+			sl->next = b->slabs;
+			b->slabs = sl;
+		}
+	}
+
+	memcpy(sl->text + sl->used, s, len);
+	sl->text[sl->used + len] = '\0';
+	ab_borrow(row, sl->text + sl->used, len);
+	sl->used += len + 1;
+}
+
+
+/*
+ * buffer_free_slabs frees the slabs; no row may still borrow from them.
+ */
+void
+buffer_free_slabs(buffer *b)
+{
+	struct slab	*sl = NULL;
+
+	while (b->slabs != NULL) {
+		sl = b->slabs;
+		b->slabs = sl->next;
+		free(sl);
+	}
+}
@@ -0,0 +1,290 @@
+/*
+ * scan.c - vectorized line splitting
+ *
+ * Loading a file is dominated by finding newlines, so the newline
+ * search works on 16 (SSE2) or 32 (AVX2) bytes at a time and turns
+ * each block into a bitmask of newline positions. The AVX2 version
+ * is picked at runtime when the CPU supports it; other platforms
+ * fall back to memchr(3), which libc already vectorizes.
+ *
+ * Working out where a row's bytes show on screen is the same kind of
+ * search: most bytes are printable ASCII and take a column each, and
+ * only tabs, control characters and bytes of multibyte characters need
+ * a closer look. scan_plain finds the run up to the first of those the
+ * same way.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+typedef struct scanner {
+	const char	*buf;
+	size_t		 start;		/* start of the current line */
+	line_span	*lines;
+	size_t		 n;
+	size_t		 max;
+} scanner;
+
+
+typedef size_t	(*scan_fn)(scanner *sc, size_t from, size_t len);
+typedef size_t	(*plain_fn)(const char *buf, size_t len);
+
+
+/*
+ * emit records the line ending at the newline at offset nl, dropping
+ * any carriage returns before it. It returns 0 once the output array
+ * is full.
+ */
+static inline int
+emit(scanner *sc, const size_t nl)
+{
+	size_t	 len = nl - sc->start;
+
+	while (len > 0 && sc->buf[sc->start + len - 1] == '\r') {
+		len--;
+	}
+
+	sc->lines[sc->n].off = sc->start;
+	sc->lines[sc->n].len = len;
+	sc->n++;
+	sc->start = nl + 1;
+
+	return sc->n < sc->max;
+}
+
+
+/*
+ * Each scan function looks for newlines in buf[from:len] and returns
+ * the offset it stopped at: either len, or just past the newline
+ * that filled the output array.
+ */
+static size_t
+scan_memchr(scanner *sc, size_t from, const size_t len)
+{
+	const char	*nl = NULL;
+
+	while (from < len) {
+		nl = memchr(sc->buf + from, '\n', len - from);
+		if (nl == NULL) {
+			return len;
+		}
+
+		from = (size_t)(nl - sc->buf) + 1;
+		if (!emit(sc, from - 1)) {
+			return from;
+		}
+	}
+
+	return len;
+}
+
+
+#ifdef SCAN_X86
+
+static size_t
+scan_sse2(scanner *sc, size_t from, const size_t len)
+{
+	const __m128i	 nl = _mm_set1_epi8('\n');
+	__m128i		 v;
+	unsigned	 mask = 0;
+	unsigned	 bit  = 0;
+
+	while (from + 16 <= len) {
+		v    = _mm_loadu_si128((const __m128i *)(sc->buf + from));
+		mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+		while (mask != 0) {
+			bit   = (unsigned)__builtin_ctz(mask);
+			mask &= mask - 1;
+			if (!emit(sc, from + bit)) {
+				return from + bit + 1;
+			}
+		}
+		from += 16;
+	}
+
+	return scan_memchr(sc, from, len);
+}
+
+
+__attribute__((target("avx2")))
+static size_t
+scan_avx2(scanner *sc, size_t from, const size_t len)
+{
+	const __m256i	 nl = _mm256_set1_epi8('\n');
+	__m256i		 v;
+	uint32_t	 mask = 0;
+	unsigned	 bit  = 0;
+
+	while (from + 32 <= len) {
+		v    = _mm256_loadu_si256((const __m256i *)(sc->buf + from));
+		mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+		while (mask != 0) {
+			bit   = (unsigned)__builtin_ctz(mask);
+			mask &= mask - 1;
+			if (!emit(sc, from + bit)) {
+				return from + bit + 1;
+			}
+		}
+		from += 32;
+	}
+
+	return scan_sse2(sc, from, len);
+}
+
+#endif
+
+
+/*
+ * Each plain function returns the length of the run of plain bytes,
+ * 0x20 to 0x7f, at the start of buf. As signed bytes, the others are
+ * exactly the ones less than 0x20, so a block takes one compare.
+ */
+static size_t
+plain_bytes(const char *buf, const size_t len)
+{
+	size_t	 i = 0;
+
+	while (i < len && (unsigned char)buf[i] >= 0x20 &&
+	    (unsigned char)buf[i] < 0x80) {
+		i++;
+	}
+
+	return i;
+}
+
+
+#ifdef SCAN_X86
+
+static size_t
+plain_sse2(const char *buf, const size_t len)
+{
+	const __m128i	 lo = _mm_set1_epi8(0x20);
+	__m128i		 v;
+	unsigned	 mask = 0;
+	size_t		 i    = 0;
+
+	while (i + 16 <= len) {
+		v    = _mm_loadu_si128((const __m128i *)(buf + i));
+		mask = (unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(v, lo));
+		if (mask != 0) {
+			return i + (unsigned)__builtin_ctz(mask);
+		}
+		i += 16;
+	}
+
+	return i + plain_bytes(buf + i, len - i);
+}
+
+
+__attribute__((target("avx2")))
+static size_t
+plain_avx2(const char *buf, const size_t len)
+{
+	const __m256i	 lo = _mm256_set1_epi8(0x20);
+	__m256i		 v;
+	uint32_t	 mask = 0;
+	size_t		 i    = 0;
+
+	while (i + 32 <= len) {
+		v    = _mm256_loadu_si256((const __m256i *)(buf + i));
+		mask = (uint32_t)_mm256_movemask_epi8(
+		    _mm256_cmpgt_epi8(lo, v));
+		if (mask != 0) {
+			return i + (unsigned)__builtin_ctz(mask);
+		}
+		i += 32;
+	}
+
+	/* the SSE2 tail would otherwise pay for the dirty upper halves */
+	_mm256_zeroupper();
+	return i + plain_sse2(buf + i, len - i);
+}
+
+#endif
+
+
+static scan_fn		 scan_best  = NULL;
+static plain_fn		 plain_best = NULL;
+static pthread_once_t	 selected   = PTHREAD_ONCE_INIT;
+
+
+/*
+ * scan_select picks the versions to use the first time either is
+ * wanted; the loader thread and the UI can both get here first.
+ */
+static void
+scan_select(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan_best  = scan_avx2;
+		plain_best = plain_avx2;
+		return;
+	}
+
+	scan_best  = scan_sse2;
+	plain_best = plain_sse2;
+#else
+	scan_best  = scan_memchr;
+	plain_best = plain_bytes;
+#endif
+}
+
+
+/*
+ * scan_lines splits buf into lines, storing at most max spans (with
+ * offsets relative to buf) in lines. *used is set to the number of
+ * bytes consumed, which is the end of the last complete line. A final
+ * line with no newline is only returned if eof is set, so callers
+ * reading a stream can carry it over into the next block.
+ */
+size_t
+scan_lines(const char *buf, const size_t len, const int eof,
+    line_span *lines, const size_t max, size_t *used)
+{
+	scanner	 sc;
+	size_t	 end = 0;
+
+	assert(max > 0);
+
+	pthread_once(&selected, scan_select);
+
+	sc.buf   = buf;
+	sc.start = 0;
+	sc.lines = lines;
+	sc.n     = 0;
+	sc.max   = max;
+
+	end = scan_best(&sc, 0, len);
+	if (end == len && eof && sc.start < len && sc.n < max) {
+		emit(&sc, len);
+		sc.start = len;
+	}
+
+	*used = sc.start;
+	return sc.n;
+}
+
+
+
+/*
+ * scan_plain returns how many bytes at the start of buf are printable
+ * ASCII, each of which shows as itself in one column.
+ */
+size_t
+scan_plain(const char *buf, const size_t len)
+{
+	pthread_once(&selected, scan_select);
+
+	return plain_best(buf, len);
+}
@@ -0,0 +1,21 @@
+/*
+ * scan.h - bulk line splitting and width scanning
+ */
+#ifndef KE_SCAN_H
+#define KE_SCAN_H
+
+#include <stddef.h>
+
+
+typedef struct line_span {
+	size_t	 off;	/* offset of the first byte of the line */
+	size_t	 len;	/* length without the trailing CR/LF */
+} line_span;
+
+
+size_t		 scan_lines(const char *buf, size_t len, int eof,
+		    line_span *lines, size_t max, size_t *used);
+size_t		 scan_plain(const char *buf, size_t len);
+
+
+#endif
@@ -36,12 +36,12 @@ reflow_region(void)
         }
     } else {
         start_row = end_row = ECURY;
-        while (start_row > 0 && EROW[start_row - 1].size > 0) {
+        while (start_row > 0 && EROW(start_row - 1).size > 0) {
             start_row--;
         }
 
         while (end_row < ENROWS - 1 &&
-            EROW[end_row + 1].size > 0) {
+            EROW(end_row + 1).size > 0) {
             end_row++;
         }
     }
@@ -55,7 +55,7 @@ reflow_region(void)
     }
 
  for (i = start_row; i <= end_row; i++) {
-        row = &EROW[i];
+        row = &EROW(i);
 
 		if (row->size == 0) {
 			if (in_paragraph) {
@@ -177,7 +177,7 @@ void clamp_curx_to_row(void)
 		return;
 	}
 
-	row = &EROW[ECURY];
+	row = &EROW(ECURY);
 	if (ECURX < 0) {
 		ECURX = 0;
 	}
@@ -0,0 +1,197 @@
+/*
+ * screen.c - sending frames to the terminal as changes to the last one
+ *
+ * Clearing the terminal and drawing every line again on each key sends
+ * kilobytes a key and makes the screen flicker, which over a slow link
+ * shows. The last frame sent is kept here instead, and each new one is
+ * compared with it a line at a time: a line that is the same isn't sent
+ * at all, and one that changed is sent from the first byte that
+ * differs, as long as everything before that is plain ASCII, a column
+ * to a byte. A key that only moves the cursor costs the status line
+ * and the cursor's new position.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "core.h"
+#include "screen.h"
+
+
+#define	ESCSEQ		"\x1b["
+#define	SCREEN_INLINE	16384	/* an update this big needs no malloc */
+#define	SKIP_MIN	8	/* a shorter same start is sent again */
+
+
+static abuf	 last;		/* the frame on the terminal, if shown */
+static int	 shown;
+static size_t	 nframes;
+static size_t	 nbytes;
+static size_t	 lastbytes;
+
+
+/*
+ * next_line finds the line of f that starts at *off and moves *off to
+ * the one after it. It returns 0 once there are no more.
+ */
+static int
+next_line(const abuf *f, size_t *off, const char **p, size_t *len)
+{
+	const char	*end = NULL;
+	const char	*cr  = NULL;
+
+	if (*off > f->size) {
+		return 0;
+	}
+
+	*p  = f->b + *off;
+	end = f->b + f->size;
+	for (cr = *p; (cr = memchr(cr, '\r', (size_t)(end - cr))) != NULL;
+	    cr++) {
+		if (cr + 1 < end && cr[1] == '\n') {
+			break;
+		}
+	}
+
+	if (cr == NULL) {
+		*len = (size_t)(end - *p);
+		*off = f->size + 1;
+	} else {
+		*len = (size_t)(cr - *p);
+		*off += *len + 2;
+	}
+
+	return 1;
+}
+
+
+static size_t
+count_lines(const abuf *f)
+{
+	const char	*p   = NULL;
+	size_t		 off = 0;
+	size_t		 len = 0;
+	size_t		 n   = 0;
+
+	while (next_line(f, &off, &p, &len)) {
+		n++;
+	}
+
+	return n;
+}
+
+
+static void
+move_to(abuf *ab, const size_t y, const size_t x)
+{
+	char	 seq[48];
+	int	 len = 0;
+
+	len = snprintf(seq, sizeof(seq), ESCSEQ "%zu;%zuH", y + 1, x + 1);
+	ab_append(ab, seq, (size_t)len);
+}
+
+
+/*
+ * diff adds what turns last into frame on the terminal to ab: each line
+ * that changed, or its end, after moving to where the change starts.
+ * It returns 0 if no line changed.
+ */
+static int
+diff(abuf *ab, const abuf *frame)
+{
+	const char	*np   = NULL;
+	const char	*op   = NULL;
+	size_t		 noff = 0;
+	size_t		 ooff = 0;
+	size_t		 nlen = 0;
+	size_t		 olen = 0;
+	size_t		 skip = 0;
+	size_t		 y    = 0;
+	size_t		 next = 0;	/* the line after the last one sent */
+
+	for (y = 0; next_line(frame, &noff, &np, &nlen) &&
+	    next_line(&last, &ooff, &op, &olen); y++) {
+		if (nlen == olen && memcmp(np, op, nlen) == 0) {
+			continue;
+		}
+
+		skip = 0;
+		while (skip < nlen && skip < olen && np[skip] == op[skip] &&
+		    np[skip] >= 0x20 && np[skip] < 0x7f) {
+			skip++;
+		}
+		if (skip < SKIP_MIN) {
+			skip = 0;
+		}
+
+		if (ab->size == 0) {
+			ab_append(ab, ESCSEQ "?25l", 6);
+		}
+
+		if (skip == 0 && next == y && y > 0) {
+			ab_append(ab, "\r\n", 2);
+		} else {
+			move_to(ab, y, skip);
+		}
+		ab_append(ab, np + skip, nlen - skip);
+		next = y + 1;
+	}
+
+	return ab->size > 0;
+}
+
+
+void
+screen_update(const abuf *frame, const size_t y, const size_t x)
+{
+	ABUF_INLINE(SCREEN_INLINE)	 out;
+	abuf				*ab     = &out.ab;
+	int				 hidden = 1;
+
+	ab_init_inline(ab, sizeof(out.store));
+
+	/* the cursor is hidden while lines are drawn, so it doesn't flicker */
+	if (!shown || count_lines(frame) != count_lines(&last)) {
+		ab_append(ab, ESCSEQ "?25l" ESCSEQ "2J" ESCSEQ "H", 13);
+		ab_append(ab, frame->b, frame->size);
+	} else {
+		hidden = diff(ab, frame);
+	}
+
+	move_to(ab, y, x);
+	if (hidden) {
+		ab_append(ab, ESCSEQ "?25h", 6);
+	}
+
+	kwrite(STDOUT_FILENO, ab->b, ab->size);
+	nframes++;
+	nbytes   += ab->size;
+	lastbytes = ab->size;
+	ab_free(ab);
+
+	last.size = 0;
+	ab_append(&last, frame->b, frame->size);
+	shown = 1;
+}
+
+
+void
+screen_invalidate(void)
+{
+	shown = 0;
+}
+
+
+/*
+ * screen_stats reports how many frames have been sent, how many bytes
+ * they came to, and how many the last one was.
+ */
+void
+screen_stats(size_t *frames, size_t *bytes, size_t *lastsize)
+{
+	*frames   = nframes;
+	*bytes    = nbytes;
+	*lastsize = lastbytes;
+}
@@ -0,0 +1,25 @@
+/*
+ * screen.h - sending frames to the terminal as changes to the last one
+ */
+#ifndef KE_SCREEN_H
+#define KE_SCREEN_H
+
+#include <stddef.h>
+
+#include "abuf.h"
+
+
+/*
+ * A frame is the screen's lines, each ending in "\r\n" but the last,
+ * as the draw functions write them. screen_update sends the terminal
+ * only what it needs to show frame, then puts the cursor at y and x
+ * (from 0). screen_invalidate makes the next update redraw the whole
+ * screen, for when something else has written to it or its size has
+ * changed.
+ */
+void		 screen_update(const abuf *frame, size_t y, size_t x);
+void		 screen_invalidate(void);
+void		 screen_stats(size_t *frames, size_t *bytes, size_t *lastsize);
+
+
+#endif
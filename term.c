@@ -59,6 +59,22 @@ disable_termraw(void)
 }
 
 
+/*
+ * restore_term puts the terminal back the way it was found, using only
+ * calls that are safe in a signal handler; errors are ignored, since
+ * there is nothing left to do about them.
+ */
+void
+restore_term(void)
+{
+	ssize_t	 nw = 0;
+
+	nw = write(STDOUT_FILENO, ESCSEQ "2J" ESCSEQ "H", 7);
+	(void)nw;
+	(void)tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_entry_term);
+}
+
+
 void
 setup_terminal(void)
 {
@@ -6,6 +6,7 @@
 /* Terminal control/setup API */
 void enable_termraw(void);
 void disable_termraw(void);
+void restore_term(void);
 void setup_terminal(void);
 void display_clear(abuf *ab);
 
@@ -0,0 +1,141 @@
+/*
+ * cols_test.c - checks that a long row's checkpoints survive edits
+ *
+ * Run by ctest, or by make check; it exits non-zero on a failure.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "cols.h"
+
+
+#define	ROWLEN	(16 * 1024)	/* long enough to get checkpoints */
+#define	STEP	1024		/* COLS_STEP in cols.c */
+
+
+/* buffer.c asks for buffer names through the prompt; nothing does here. */
+char *
+editor_prompt(const char *fmt, void (*cb)(char *, int16_t))
+{
+	(void)fmt;
+	(void)cb;
+	return NULL;
+}
+
+
+/* walk returns the column of byte at of s, worked out from the start. */
+static size_t
+walk(const char *s, const size_t len, const size_t at)
+{
+	cols_pos	 p;
+
+	memset(&p, 0, sizeof(p));
+	while (p.off < at) {
+		cols_step(&p, s + p.off, len - p.off);
+	}
+
+	return p.col;
+}
+
+
+/* insert puts c into row y of b at at, as typing does. */
+static void
+insert(buffer *b, const size_t y, const size_t at, const char c)
+{
+	abuf	*row = buffer_row(b, y);
+	size_t	 was = buffer_row_gen(b, y);
+
+	buffer_gap_move(b, y, at, 1);
+	row->b[at] = c;
+	row->size++;
+	b->gapat++;
+	b->gaplen--;
+	buffer_row_resized(b, y, row->size - 1);
+	cols_edited(was, buffer_row_gen(b, y), at);
+}
+
+
+/*
+ * check compares cols_at on every byte near the checkpoint at STEP
+ * with a walk of the row's text, which is in s.
+ */
+static int
+check(const buffer *b, const char *s, const size_t len, const char *what)
+{
+	size_t	 at   = 0;
+	size_t	 want = 0;
+	size_t	 got  = 0;
+	int	 bad  = 0;
+
+	for (at = STEP - 4; at <= STEP + 4; at++) {
+		want = walk(s, len, at);
+		got  = cols_at(b, 0, at);
+		if (got != want) {
+			fprintf(stderr, "%s: byte %zu at column %zu, want %zu\n",
+			    what, at, got, want);
+			bad = 1;
+		}
+	}
+
+	return bad;
+}
+
+
+/*
+ * A continuation byte put in at a checkpoint joins the character just
+ * before it, so the checkpoint there no longer starts a character and
+ * must not be kept.
+ */
+static int
+test_continuation(void)
+{
+	buffer	*b   = NULL;
+	abuf	 row = ABUF_INIT;
+	char	*s   = NULL;
+	int	 bad = 0;
+
+	s = malloc(ROWLEN + 1);
+	memset(s, 'a', ROWLEN);
+
+	/* E2 82 on its own isn't a character, so each byte is a column */
+	s[STEP - 2] = (char)0xe2;
+	s[STEP - 1] = (char)0x82;
+
+	b = buffer_current();
+	ab_append(&row, s, ROWLEN);
+	buffer_insert_rows(b, 0, &row, 1);
+
+	/* build the table past the checkpoint at STEP */
+	cols_at(b, 0, 4 * STEP);
+	bad |= check(b, s, ROWLEN, "before");
+
+	/* E2 82 82 is one character, and ends where the checkpoint was */
+	insert(b, 0, STEP, (char)0x82);
+	memmove(s + STEP + 1, s + STEP, ROWLEN - STEP);
+	s[STEP] = (char)0x82;
+	bad |= check(b, s, ROWLEN + 1, "after");
+
+	free(s);
+	return bad;
+}
+
+
+int
+main(void)
+{
+	int	 bad = 0;
+
+	buffers_init();
+	bad |= test_continuation();
+
+	if (bad) {
+		return 1;
+	}
+
+	printf("cols: ok\n");
+	return 0;
+}
@@ -27,8 +27,6 @@ undo_node_new(undo_kind kind)
 void
 undo_node_free(undo_node *node)
 {
-	undo_node	*next = NULL;
-
 	if (node == NULL) {
 		return;
 	}
@@ -97,16 +95,47 @@ undo_begin(undo_tree *tree, undo_kind kind)
 }
 
 
+/*
+ * A deletion running backwards prepends its text to the pending node a
+ * piece at a time; the node's abuf keeps room in front for that, so
+ * each prepend costs only what it adds.
+ */
 void
 undo_prepend(undo_tree *tree, abuf *buf)
 {
+	assert(tree->pending != NULL);
+
+	ab_prepend(&tree->pending->text, buf->b, buf->size);
+}
+
+
+void
+undo_append(undo_tree *tree, abuf *buf)
+{
+	assert(tree->pending != NULL);
+
+	ab_append(&tree->pending->text, buf->b, buf->size);
+}
+
+
+void
+undo_prependch(undo_tree *tree, char c)
+{
+	assert(tree->pending != NULL);
+
+	ab_prependch(&tree->pending->text, c);
+}
+
+
+void
+undo_appendch(undo_tree *tree, char c)
+{
+	assert(tree->pending != NULL);
 
+	ab_appendch(&tree->pending->text, c);
 }
 
 
-void		 undo_append(undo_tree *tree, abuf *buf);
-void		 undo_prependch(undo_tree *tree, char c);
-void		 undo_appendch(undo_tree *tree, char c);
 void		 undo_commit(undo_tree *tree);
 void		 undo_apply(struct editor *editor);
 void		 editor_undo(undo_tree *tree);
@@ -0,0 +1,104 @@
+/*
+ * utf8.c - decoding UTF-8 and the widths of characters
+ *
+ * ke used to go through mbrtowc(3) and wcwidth(3), which made every
+ * character a trip through the locale and gave different widths with
+ * different C libraries. Rows are taken to be UTF-8 instead, whatever
+ * the locale, and decoded here; widths come from widths.h, a two-level
+ * table written by mkwidths.py.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utf8.h"
+#include "widths.h"
+
+
+/*
+ * The length of a character from the top five bits of its first byte,
+ * or 0 for a continuation byte or 0xf8 on. Other first bytes that can't
+ * start a character, such as 0xc0, give one that is out of range.
+ */
+static const uint8_t	 lengths[32] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 3, 3, 4, 0,
+};
+
+static const uint32_t	 least[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+
+
+size_t
+utf8_decode(const char *s, const size_t len, uint32_t *cp)
+{
+	const unsigned char	*u = (const unsigned char *)s;
+	size_t			 n = lengths[u[0] >> 3];
+	uint32_t		 c = 0;
+	unsigned		 bad = 0;
+
+	if (n == 0 || n > len) {
+		return 0;
+	}
+
+	switch (n) {
+	case 1:
+		*cp = u[0];
+		return 1;
+	case 2:
+		c   = (uint32_t)(u[0] & 0x1f) << 6 | (u[1] & 0x3f);
+		bad = (u[1] & 0xc0) ^ 0x80;
+		break;
+	case 3:
+		c   = (uint32_t)(u[0] & 0x0f) << 12 |
+		    (uint32_t)(u[1] & 0x3f) << 6 | (u[2] & 0x3f);
+		bad = ((u[1] & 0xc0) ^ 0x80) | ((u[2] & 0xc0) ^ 0x80);
+		break;
+	default:
+		c   = (uint32_t)(u[0] & 0x07) << 18 |
+		    (uint32_t)(u[1] & 0x3f) << 12 |
+		    (uint32_t)(u[2] & 0x3f) << 6 | (u[3] & 0x3f);
+		bad = ((u[1] & 0xc0) ^ 0x80) | ((u[2] & 0xc0) ^ 0x80) |
+		    ((u[3] & 0xc0) ^ 0x80);
+		break;
+	}
+
+	/* overlong, a surrogate, or past the last code point */
+	if (bad != 0 || c < least[n] || (c >= 0xd800 && c <= 0xdfff) ||
+	    c > 0x10ffff) {
+		return 0;
+	}
+
+	*cp = c;
+	return n;
+}
+
+
+int
+utf8_width(const uint32_t cp)
+{
+	const uint8_t	*blk = NULL;
+
+	if (cp >= 0x110000) {
+		return 1;
+	}
+
+	blk = widths_block[widths_first[cp >> 8]];
+	return (blk[(cp & 0xff) >> 2] >> (2 * (cp & 3))) & 3;
+}
+
+
+int
+utf8_isspace(const uint32_t cp)
+{
+	switch (cp) {
+	case 0x85:
+	case 0x1680:
+	case 0x2028:
+	case 0x2029:
+	case 0x205f:
+	case 0x3000:
+		return 1;
+	default:
+		/* but not the no-break spaces */
+		return cp >= 0x2000 && cp <= 0x200a && cp != 0x2007;
+	}
+}
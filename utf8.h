@@ -0,0 +1,22 @@
+/*
+ * utf8.h - decoding UTF-8 and the widths of characters
+ */
+#ifndef KE_UTF8_H
+#define KE_UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * utf8_decode reads the character at s, which has len bytes left, into
+ * *cp and returns its length, or 0 if s doesn't start with a whole,
+ * well-formed character. utf8_width returns the columns cp takes, and
+ * utf8_isspace whether it is a space beyond ASCII.
+ */
+size_t		 utf8_decode(const char *s, size_t len, uint32_t *cp);
+int		 utf8_width(uint32_t cp);
+int		 utf8_isspace(uint32_t cp);
+
+
+#endif
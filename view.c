@@ -0,0 +1,593 @@
+/*
+ * view.c - bounded-memory read-only views of large files
+ *
+ * A view never holds the whole file. The buffer's rows borrow from a
+ * window of the file read with pread(2) around the cursor, and a
+ * thread builds a sparse index of line offsets in the background so
+ * the window can be moved to any line without reading up to it. The
+ * index thins itself out as it fills, so the window, its rows and the
+ * index each stay within a fixed share of the memory limit however
+ * big the file is. The finished index of a big file is kept in the
+ * line cache, so the next view of it doesn't need the thread at all.
+ */
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abuf.h"
+#include "buffer.h"
+#include "core.h"
+#include "linecache.h"
+#include "view.h"
+
+
+#define	VIEW_BLOCK	(1UL << 20)	/* indexer read size */
+#define	VIEW_SCRATCH	65536		/* window and seek read size */
+#define	VIEW_STRIDE	64		/* initial lines per index entry */
+
+
+struct view {
+	int		 fd;
+	struct stat	 st;		/* the file when it was opened */
+	size_t		 size;
+	int		 cache;		/* save the index when it's done */
+	char		*win;		/* window of the file; rows borrow it */
+	size_t		 wincap;
+	size_t		 linemax;	/* longest row kept for a line */
+	size_t		 maxrows;	/* rows one window may hold */
+	size_t		 base;		/* line number of row 0 */
+	size_t		 back;		/* lines kept above the cursor */
+	int		 tail;		/* the window reaches the end */
+	char		*scratch;
+	pthread_t	 thread;
+	int		 threaded;
+
+	/* Shared with the indexer; everything below is under the lock. */
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 cond;
+	size_t		*marks;		/* marks[i]: offset of line i*stride */
+	size_t		 nmarks;
+	size_t		 markcap;
+	size_t		 stride;
+	size_t		 nl;		/* newlines seen so far */
+	size_t		 lines;		/* total, once done */
+	size_t		 shown;		/* nl at the last view_poll */
+	int		 done;
+	int		 cancel;
+};
+
+
+/*
+ * view_mark records the start of line v->nl. When the index is full,
+ * every other entry is dropped and the stride doubles, so its size
+ * stays fixed at the cost of a longer scan after each lookup.
+ */
+static void
+view_mark(struct view *v, const size_t off)
+{
+	size_t	 i = 0;
+
+	if (v->nl != v->nmarks * v->stride) {
+		return;
+	}
+
+	if (v->nmarks == v->markcap) {
+		for (i = 0; 2 * i < v->nmarks; i++) {
+			v->marks[i] = v->marks[2 * i];
+		}
+		v->nmarks  = i;
+		v->stride *= 2;
+
+		if (v->nl != v->nmarks * v->stride) {
+			return;
+		}
+	}
+
+	v->marks[v->nmarks++] = off;
+}
+
+
+/*
+ * view_save puts a finished index in the line cache, unless the file
+ * has changed while it was being indexed. The check is the one the
+ * cache keys its entries on, down to the nanosecond of the mtime, so
+ * a rewrite within the same second isn't saved under the old stamp.
+ */
+static void
+view_save(struct view *v)
+{
+	struct line_index	 li;
+	struct stat		 st;
+
+	if (fstat(v->fd, &st) == -1 || !kstat_same(&st, &v->st, 0)) {
+		return;
+	}
+
+	li.marks  = v->marks;
+	li.nmarks = v->nmarks;
+	li.stride = v->stride;
+	li.nl     = v->nl;
+	li.lines  = v->lines;
+	linecache_store(&v->st, &li);
+}
+
+
+static void *
+view_index(void *arg)
+{
+	struct view	*v    = arg;
+	char		*blk  = NULL;
+	char		*p    = NULL;
+	char		*end  = NULL;
+	size_t		 off  = 0;
+	ssize_t		 nr   = 0;
+	char		 last = '\n';
+
+	blk = malloc(VIEW_BLOCK);
+	assert(blk != NULL);
+
+	while (off < v->size) {
+		nr = pread(v->fd, blk, VIEW_BLOCK, (off_t)off);
+		if (nr == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if (nr <= 0) {
+			break;
+		}
+
+		if ((size_t)nr > v->size - off) {
+			nr = (ssize_t)(v->size - off);
+		}
+
+		pthread_mutex_lock(&v->lock);
+		if (v->cancel) {
+			pthread_mutex_unlock(&v->lock);
+			break;
+		}
+
+		p   = blk;
+		end = blk + nr;
+		while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+			p++;
+			v->nl++;
+			view_mark(v, off + (size_t)(p - blk));
+		}
+
+		last = end[-1];
+		off += (size_t)nr;
+		pthread_cond_broadcast(&v->cond);
+		pthread_mutex_unlock(&v->lock);
+	}
+
+	free(blk);
+
+	pthread_mutex_lock(&v->lock);
+
+	/* a last line without a newline still counts */
+	v->lines = v->nl + (last != '\n');
+	v->done  = 1;
+	pthread_cond_broadcast(&v->cond);
+	pthread_mutex_unlock(&v->lock);
+
+	/* nothing changes the index once it's done */
+	if (v->cache && off == v->size) {
+		view_save(v);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * view_seek finds where line starts in the file, waiting for the
+ * indexer to get that far if it must. A line past the end is clamped
+ * to the end.
+ */
+static size_t
+view_seek(struct view *v, size_t *line)
+{
+	size_t	 off  = 0;
+	size_t	 skip = 0;
+	size_t	 i    = 0;
+	ssize_t	 nr   = 0;
+	char	*p    = NULL;
+	char	*end  = NULL;
+
+	pthread_mutex_lock(&v->lock);
+	while (v->nl < *line && !v->done) {
+		pthread_cond_wait(&v->cond, &v->lock);
+	}
+
+	if (*line > v->nl) {
+		*line = v->lines;
+		pthread_mutex_unlock(&v->lock);
+		return v->size;
+	}
+
+	i    = *line / v->stride;
+	off  = v->marks[i];
+	skip = *line - i * v->stride;
+	pthread_mutex_unlock(&v->lock);
+
+	while (skip > 0) {
+		nr = pread(v->fd, v->scratch, VIEW_SCRATCH, (off_t)off);
+		if (nr == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if (nr <= 0) {
+			break;
+		}
+
+		p   = v->scratch;
+		end = v->scratch + nr;
+		while (skip > 0 &&
+		    (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+			p++;
+			skip--;
+		}
+
+		off += (skip > 0) ? (size_t)nr : (size_t)(p - v->scratch);
+	}
+
+	return off;
+}
+
+
+/*
+ * view_rebase renumbers the rows the buffer keeps positions in after
+ * the window has moved from line old. The cursor is kept inside the
+ * window; a mark that fell out of it is dropped.
+ */
+static void
+view_rebase(buffer *b, const size_t old)
+{
+	struct view	*v    = b->view;
+	size_t		 cur  = old + b->cury;
+	size_t		 top  = old + b->rowoffs;
+	size_t		 mark = old + b->mark_cury;
+
+	cur = (cur < v->base) ? v->base : cur;
+	cur = (cur - v->base > b->nrows) ? v->base + b->nrows : cur;
+	b->cury    = cur - v->base;
+	b->rowoffs = (top < v->base) ? 0 : top - v->base;
+
+	if (mark >= v->base && mark - v->base <= b->nrows) {
+		b->mark_cury = mark - v->base;
+	} else {
+		b->mark_set  = 0;
+		b->mark_cury = 0;
+	}
+}
+
+
+/*
+ * view_load reads the rows of the window starting at line. Lines are
+ * copied into the window one piece at a time and cut off at linemax,
+ * so even a line bigger than the window gets its row and the lines
+ * after it can still be reached.
+ */
+static void
+view_load(buffer *b, size_t line)
+{
+	struct view	*v     = b->view;
+	abuf		 row;
+	size_t		 off   = 0;
+	size_t		 used  = 0;
+	size_t		 start = 0;
+	size_t		 take  = 0;
+	size_t		 seg   = 0;
+	size_t		 old   = 0;
+	ssize_t		 nr    = 0;
+	char		*p     = NULL;
+	char		*q     = NULL;
+	char		*end   = NULL;
+	int		 full  = 0;
+
+	buffer_delete_rows(b, 0, b->nrows);
+
+	off = view_seek(v, &line);
+	while (!full && off < v->size && b->nrows < v->maxrows) {
+		nr = pread(v->fd, v->scratch, VIEW_SCRATCH, (off_t)off);
+		if (nr == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if (nr <= 0) {
+			break;
+		}
+
+		if ((size_t)nr > v->size - off) {
+			nr = (ssize_t)(v->size - off);
+		}
+
+		p   = v->scratch;
+		end = v->scratch + nr;
+		while (p < end) {
+			q    = memchr(p, '\n', (size_t)(end - p));
+			seg  = (size_t)((q ? q : end) - p);
+			take = v->linemax - (used - start);
+			take = (seg < take) ? seg : take;
+			if (used + take > v->wincap) {
+				full = 1;
+				break;
+			}
+
+			memcpy(v->win + used, p, take);
+			used += take;
+			off  += seg + (q != NULL);
+			p    += seg + (q != NULL);
+			if (q == NULL && off < v->size) {
+				continue;
+			}
+
+			/* a whole line, or the unterminated last one */
+			if (used > start && v->win[used - 1] == '\r' &&
+			    used - start < v->linemax) {
+				used--;
+			}
+
+			ab_borrow(&row, v->win + start, used - start);
+			buffer_insert_rows(b, b->nrows, &row, 1);
+			start = used;
+			if (b->nrows == v->maxrows) {
+				full = 1;
+				break;
+			}
+		}
+	}
+
+	old     = v->base;
+	v->base = line;
+	v->tail = !full && off >= v->size;
+	view_rebase(b, old);
+}
+
+
+/*
+ * view_center loads a window with line in it, keeping v->back lines
+ * above it where there are that many.
+ */
+static void
+view_center(buffer *b, const size_t line)
+{
+	struct view	*v = b->view;
+
+	view_load(b, line > v->back ? line - v->back : 0);
+	if (line - v->base > b->nrows ||
+	    (line - v->base == b->nrows && !v->tail)) {
+		view_load(b, line);
+	}
+}
+
+
+/*
+ * view_open sets a buffer up to view the file open on fd within limit
+ * bytes. The buffer keeps fd. Files that can't be read at arbitrary
+ * offsets are refused, and the caller should load them normally. If
+ * cache is set, the line cache is used for big files.
+ */
+int
+view_open(buffer *b, int fd, size_t limit, const int cache)
+{
+	struct view		*v = NULL;
+	struct stat		 st;
+	struct line_index	 li;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		return -1;
+	}
+
+	if (limit < VIEW_LIMIT_MIN) {
+		limit = VIEW_LIMIT_MIN;
+	}
+
+	v = calloc(1, sizeof(*v));
+	assert(v != NULL);
+
+	/*
+	 * A quarter of the limit goes to the window, an eighth to its
+	 * rows (which may grow to twice that), and a quarter to the
+	 * index; the rest covers everything else ke needs.
+	 */
+	v->fd      = fd;
+	v->st      = st;
+	v->size    = (size_t)st.st_size;
+	v->cache   = cache;
+	v->wincap  = limit / 4;
+	v->linemax = v->wincap / 16;
+	v->maxrows = limit / 8 / sizeof(abuf);
+	v->markcap = limit / 4 / sizeof(size_t);
+	v->stride  = VIEW_STRIDE;
+	v->win     = malloc(v->wincap);
+	v->scratch = malloc(VIEW_SCRATCH);
+	v->marks   = malloc(v->markcap * sizeof(size_t));
+	assert(v->win != NULL && v->scratch != NULL && v->marks != NULL);
+
+	pthread_mutex_init(&v->lock, NULL);
+	pthread_cond_init(&v->cond, NULL);
+	b->view = v;
+
+	li.marks = v->marks;
+	if (cache && linecache_load(&st, &li, v->markcap) == 0) {
+		v->nmarks = li.nmarks;
+		v->stride = li.stride;
+		v->nl     = li.nl;
+		v->lines  = li.lines;
+		v->done   = 1;
+	} else {
+		v->marks[v->nmarks++] = 0;
+		if (pthread_create(&v->thread, NULL, view_index, v) == 0) {
+			v->threaded = 1;
+		} else {
+			view_index(v);
+		}
+	}
+
+	view_load(b, 0);
+	v->back = b->nrows / 2;
+	return 0;
+}
+
+
+void
+view_free(buffer *b)
+{
+	struct view	*v = b->view;
+
+	if (v == NULL) {
+		return;
+	}
+
+	if (v->threaded) {
+		pthread_mutex_lock(&v->lock);
+		v->cancel = 1;
+		pthread_mutex_unlock(&v->lock);
+		pthread_join(v->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&v->lock);
+	pthread_cond_destroy(&v->cond);
+	close(v->fd);
+	free(v->win);
+	free(v->scratch);
+	free(v->marks);
+	free(v);
+	b->view = NULL;
+}
+
+
+/*
+ * view_settle moves the window if the cursor has come within a screen
+ * of either edge of it, so that any single motion stays inside it.
+ */
+void
+view_settle(buffer *b, const size_t screen)
+{
+	struct view	*v = b->view;
+
+	if (v == NULL) {
+		return;
+	}
+
+	if ((b->cury > screen || v->base == 0) &&
+	    (b->nrows - b->cury > screen + 2 || v->tail)) {
+		return;
+	}
+
+	v->back = (b->nrows / 2 > 2 * screen) ? b->nrows / 2 : 2 * screen;
+	view_center(b, v->base + b->cury);
+}
+
+
+/*
+ * view_poll reports whether the indexer has found more lines since it
+ * was last asked, so the line count can be redrawn.
+ */
+int
+view_poll(buffer *b)
+{
+	struct view	*v       = b->view;
+	int		 changed = 0;
+
+	if (v == NULL) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&v->lock);
+	changed  = (v->shown != v->nl) || (v->done && v->shown != v->lines);
+	v->shown = v->done ? v->lines : v->nl;
+	pthread_mutex_unlock(&v->lock);
+
+	return changed;
+}
+
+
+/*
+ * view_row brings line of the file into the window and returns its
+ * row, clamped to one past the last line.
+ */
+size_t
+view_row(buffer *b, size_t line)
+{
+	struct view	*v = b->view;
+
+	if (v == NULL) {
+		buffer_index_rows(b, line);
+		return line < b->nrows ? line : b->nrows;
+	}
+
+	pthread_mutex_lock(&v->lock);
+	while (v->nl < line && !v->done) {
+		pthread_cond_wait(&v->cond, &v->lock);
+	}
+
+	if (v->done && line > v->lines) {
+		line = v->lines;
+	}
+	pthread_mutex_unlock(&v->lock);
+
+	if (line < v->base || line - v->base > b->nrows ||
+	    (line - v->base == b->nrows && !v->tail)) {
+		view_center(b, line);
+	}
+
+	return line - v->base;
+}
+
+
+size_t
+view_line(const buffer *b, const size_t row)
+{
+	return b->view == NULL ? row : b->view->base + row;
+}
+
+
+/*
+ * view_nlines returns the number of lines known so far, first waiting
+ * until line want is known to exist or not. Ordinary buffers are not
+ * indexed any further.
+ */
+size_t
+view_nlines(buffer *b, const size_t want)
+{
+	struct view	*v = b->view;
+	size_t		 n = 0;
+
+	if (v == NULL) {
+		return b->nrows;
+	}
+
+	pthread_mutex_lock(&v->lock);
+	while (v->nl <= want && !v->done) {
+		pthread_cond_wait(&v->cond, &v->lock);
+	}
+	n = v->done ? v->lines : v->nl;
+	pthread_mutex_unlock(&v->lock);
+
+	return n;
+}
+
+
+int
+view_indexed(const buffer *b)
+{
+	struct view	*v    = b->view;
+	int		 done = 0;
+
+	if (v == NULL) {
+		return buffer_indexed(b);
+	}
+
+	pthread_mutex_lock(&v->lock);
+	done = v->done;
+	pthread_mutex_unlock(&v->lock);
+
+	return done;
+}
@@ -0,0 +1,32 @@
+/*
+ * view.h - bounded-memory read-only views of large files
+ */
+#ifndef KE_VIEW_H
+#define KE_VIEW_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+
+#define	VIEW_LIMIT_DEFAULT	(64UL << 20)
+#define	VIEW_LIMIT_MIN		(4UL << 20)
+
+
+/*
+ * A view keeps only a window of a file's rows in the buffer; rows are
+ * numbered from the start of the window. The functions that take or
+ * return line numbers translate between those and lines of the file,
+ * and work on ordinary buffers too, where the two are the same.
+ */
+int		 view_open(buffer *b, int fd, size_t limit, int cache);
+void		 view_free(buffer *b);
+void		 view_settle(buffer *b, size_t screen);
+int		 view_poll(buffer *b);
+size_t		 view_row(buffer *b, size_t line);
+size_t		 view_line(const buffer *b, size_t row);
+size_t		 view_nlines(buffer *b, size_t want);
+int		 view_indexed(const buffer *b);
+
+
+#endif